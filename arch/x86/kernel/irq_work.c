@@ -8,14 +8,18 @@
 #include <linux/irq_work.h>
 #include <linux/hardirq.h>
 #include <asm/apic.h>
+#include <asm/irq_regs.h>
 
 void smp_irq_work_interrupt(struct pt_regs *regs)
 {
+	struct pt_regs *old_regs = set_irq_regs(regs);
+
 	irq_enter();
 	ack_APIC_irq();
 	inc_irq_stat(apic_irq_work_irqs);
 	irq_work_run();
 	irq_exit();
+	set_irq_regs(old_regs);
 }
 
 void arch_irq_work_raise(void)
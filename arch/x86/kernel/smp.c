@@ -28,6 +28,7 @@
 #include <asm/mmu_context.h>
 #include <asm/proto.h>
 #include <asm/apic.h>
+#include <asm/irq_regs.h>
 /*
  *	Some notes on x86 processor bugs affecting SMP operation:
  *
@@ -194,14 +195,17 @@ static void native_stop_other_cpus(int wait)
 }
 
 /*
- * Reschedule call back. Nothing to do,
- * all the work is done automatically when
- * we return from the interrupt.
+ * Reschedule call back. Apart from the wakeups queued for this cpu,
+ * all the work is done automatically when we return from the interrupt.
  */
 void smp_reschedule_interrupt(struct pt_regs *regs)
 {
+	struct pt_regs *old_regs = set_irq_regs(regs);
+
 	ack_APIC_irq();
 	inc_irq_stat(irq_resched_count);
+	scheduler_ipi();
+	set_irq_regs(old_regs);
 	/*
 	 * KVM uses this interrupt to force a cpu out of guest mode
 	 */
@@ -138,6 +138,20 @@ static noinline int gup_huge_pmd(pmd_t pmd, unsigned long addr,
 	refs = 0;
 	head = pte_page(pte);
 	page = head + ((addr & ~PMD_MASK) >> PAGE_SHIFT);
+	if (unlikely(!PageHead(head))) {
+		/*
+		 * A page cache extent mapped by a huge pmd: its pages
+		 * are small pages, each holding its own references.
+		 */
+		do {
+			VM_BUG_ON(page_count(page) == 0);
+			get_page(page);
+			pages[*nr] = page;
+			(*nr)++;
+			page++;
+		} while (addr += PAGE_SIZE, addr != end);
+		return 1;
+	}
 	do {
 		VM_BUG_ON(compound_head(page) != head);
 		pages[*nr] = page;
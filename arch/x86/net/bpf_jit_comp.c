@@ -0,0 +1,631 @@
+/* bpf_jit_comp.c : BPF JIT compiler
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+#include <linux/moduleloader.h>
+#include <asm/cacheflush.h>
+#include <linux/netdevice.h>
+#include <linux/filter.h>
+
+/*
+ * Conventions :
+ *  EAX : BPF A accumulator
+ *  EBX : BPF X register
+ *  RDI : pointer to skb   (first argument given to JIT function)
+ *  RBP : frame pointer (even if CONFIG_FRAME_POINTER=n)
+ *  ECX,EDX,ESI : scratch registers
+ *  r9d : skb->len - skb->data_len (headlen)
+ *  r8  : skb->data
+ *
+ * Stack frame, set up whenever the filter needs more than A :
+ *  -8(%rbp)	saved %rbx
+ * -12(%rbp)	scratch buffer used by bpf_jit.S for skb_copy_bits()
+ * -80(%rbp)	mem[0] ... mem[BPF_MEMWORDS - 1]
+ */
+int bpf_jit_enable __read_mostly;
+
+/*
+ * assembly code in arch/x86/net/bpf_jit.S
+ */
+extern u8 sk_load_word[], sk_load_half[], sk_load_byte[], sk_load_byte_msh[];
+
+static inline u8 *emit_code(u8 *ptr, u32 bytes, unsigned int len)
+{
+	if (len == 1)
+		*ptr = bytes;
+	else if (len == 2)
+		*(u16 *)ptr = bytes;
+	else {
+		*(u32 *)ptr = bytes;
+		barrier();
+	}
+	return ptr + len;
+}
+
+#define EMIT(bytes, len)	do { prog = emit_code(prog, bytes, len); } while (0)
+
+#define EMIT1(b1)		EMIT(b1, 1)
+#define EMIT2(b1, b2)		EMIT((b1) + ((b2) << 8), 2)
+#define EMIT3(b1, b2, b3)	EMIT((b1) + ((b2) << 8) + ((b3) << 16), 3)
+#define EMIT4(b1, b2, b3, b4)	EMIT((b1) + ((b2) << 8) + ((b3) << 16) + ((b4) << 24), 4)
+#define EMIT1_off32(b1, off)	do { EMIT1(b1); EMIT(off, 4); } while (0)
+#define EMIT2_off32(b1, b2, off) do { EMIT2(b1, b2); EMIT(off, 4); } while (0)
+#define EMIT3_off32(b1, b2, b3, off) do { EMIT3(b1, b2, b3); EMIT(off, 4); } while (0)
+
+#define CLEAR_A() EMIT2(0x31, 0xc0) /* xor %eax,%eax */
+#define CLEAR_X() EMIT2(0x31, 0xdb) /* xor %ebx,%ebx */
+
+static inline bool is_imm8(int value)
+{
+	return value <= 127 && value >= -128;
+}
+
+static inline bool is_near(int offset)
+{
+	return offset <= 127 && offset >= -128;
+}
+
+#define EMIT_JMP(offset)						\
+do {									\
+	if (offset) {							\
+		if (is_near(offset))					\
+			EMIT2(0xeb, offset); /* jmp .+off8 */		\
+		else							\
+			EMIT1_off32(0xe9, offset); /* jmp .+off32 */	\
+	}								\
+} while (0)
+
+/* list of x86 cond jumps opcodes (. + s8)
+ * Add 0x10 (and an extra 0x0f) to generate far jumps (. + s32)
+ */
+#define X86_JB  0x72
+#define X86_JAE 0x73
+#define X86_JE  0x74
+#define X86_JNE 0x75
+#define X86_JBE 0x76
+#define X86_JA  0x77
+
+#define EMIT_COND_JMP(op, offset)				\
+do {								\
+	if (is_near(offset))					\
+		EMIT2(op, offset); /* jxx .+off8 */		\
+	else {							\
+		EMIT2(0x0f, op + 0x10);				\
+		EMIT(offset, 4); /* jxx .+off32 */		\
+	}							\
+} while (0)
+
+#define SEEN_DATAREF 1 /* might call external helpers */
+#define SEEN_XREG    2 /* ebx is used */
+#define SEEN_MEM     4 /* use mem[] for temporary storage */
+
+#define STACK_SIZE	80
+#define SCRATCH_OFF(k)	(-STACK_SIZE + 4 * (k))
+
+/* mov -8(%rbp),%rbx ; leaveq ; ret  or just  ret */
+#define EPILOGUE_LEN(seen)	((seen) ? 6 : 1)
+
+static u8 *emit_epilogue(u8 *prog, unsigned int seen)
+{
+	if (seen) {
+		EMIT4(0x48, 0x8b, 0x5d, 0xf8);	/* mov -8(%rbp),%rbx */
+		EMIT1(0xc9);			/* leaveq */
+	}
+	EMIT1(0xc3);				/* ret */
+	return prog;
+}
+
+/*
+ * Return 0 from the filter unless the last test set the flags for
+ * @op: skip over an inline "xor %eax,%eax" plus epilogue.
+ */
+#define EMIT_RET0_UNLESS(op)					\
+do {								\
+	EMIT2(op, 2 + EPILOGUE_LEN(seen));			\
+	CLEAR_A();						\
+	prog = emit_epilogue(prog, seen);			\
+} while (0)
+
+/*
+ * Find out what the filter needs before emitting anything, so that the
+ * prologue and epilogue are the same in every pass.  Returns -1 for
+ * instructions we leave to the interpreter.
+ */
+static int bpf_jit_scan(const struct sock_filter *filter, int flen)
+{
+	unsigned int seen = 0;
+	int i;
+
+	for (i = 0; i < flen; i++) {
+		switch (filter[i].code) {
+		case BPF_S_ALU_ADD_X:
+		case BPF_S_ALU_SUB_X:
+		case BPF_S_ALU_MUL_X:
+		case BPF_S_ALU_DIV_X:
+		case BPF_S_ALU_AND_X:
+		case BPF_S_ALU_OR_X:
+		case BPF_S_ALU_LSH_X:
+		case BPF_S_ALU_RSH_X:
+		case BPF_S_JMP_JGT_X:
+		case BPF_S_JMP_JGE_X:
+		case BPF_S_JMP_JEQ_X:
+		case BPF_S_JMP_JSET_X:
+		case BPF_S_LDX_W_LEN:
+		case BPF_S_LDX_IMM:
+		case BPF_S_MISC_TAX:
+		case BPF_S_MISC_TXA:
+			seen |= SEEN_XREG;
+			break;
+		case BPF_S_LD_MEM:
+		case BPF_S_ST:
+			seen |= SEEN_MEM;
+			break;
+		case BPF_S_LDX_MEM:
+		case BPF_S_STX:
+			seen |= SEEN_MEM | SEEN_XREG;
+			break;
+		case BPF_S_LD_W_ABS:
+		case BPF_S_LD_H_ABS:
+		case BPF_S_LD_B_ABS:
+			seen |= SEEN_DATAREF;
+			break;
+		case BPF_S_LD_W_IND:
+		case BPF_S_LD_H_IND:
+		case BPF_S_LD_B_IND:
+		case BPF_S_LDX_B_MSH:
+			seen |= SEEN_DATAREF | SEEN_XREG;
+			break;
+		case BPF_S_ANC_PKTTYPE:
+		case BPF_S_ANC_NLATTR:
+		case BPF_S_ANC_NLATTR_NEST:
+			return -1;
+		default:
+			break;
+		}
+	}
+
+	return seen;
+}
+
+#define COND_SEL(CODE, TOP, FOP)	\
+	case CODE:			\
+		t_op = TOP;		\
+		f_op = FOP;		\
+		goto cond_branch
+
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	u8 temp[64];
+	u8 *prog;
+	unsigned int proglen, oldproglen = 0;
+	int ilen, i;
+	int t_offset, f_offset;
+	u8 t_op, f_op;
+	int seen, pass;
+	u8 *image = NULL;
+	u8 *func;
+	unsigned int *addrs;
+	const struct sock_filter *filter = fp->insns;
+	int flen = fp->len;
+
+	if (!bpf_jit_enable)
+		return;
+
+	seen = bpf_jit_scan(filter, flen);
+	if (seen < 0)
+		return;
+
+	addrs = kmalloc(flen * sizeof(*addrs), GFP_KERNEL);
+	if (addrs == NULL)
+		return;
+
+	/* Before first pass, make a rough estimation of addrs[]
+	 * each bpf instruction is translated to less than 64 bytes
+	 */
+	for (proglen = 0, i = 0; i < flen; i++) {
+		proglen += 64;
+		addrs[i] = proglen;
+	}
+
+	for (pass = 0; pass < 10; pass++) {
+		/* no prologue/epilogue for trivial filters (RET something) */
+		proglen = 0;
+		prog = temp;
+
+		if (seen) {
+			EMIT4(0x55, 0x48, 0x89, 0xe5); /* push %rbp; mov %rsp,%rbp */
+			EMIT4(0x48, 0x83, 0xec, STACK_SIZE); /* subq $STACK_SIZE,%rsp */
+			EMIT4(0x48, 0x89, 0x5d, 0xf8); /* mov %rbx,-8(%rbp) */
+
+			if (seen & SEEN_DATAREF) {
+				/*
+				 * r9d = skb->len - skb->data_len
+				 * r8 = skb->data
+				 */
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, len) != 4);
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, data_len) != 4);
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, data) != 8);
+				/* mov off32(%rdi),%r9d */
+				EMIT3_off32(0x44, 0x8b, 0x8f,
+					    offsetof(struct sk_buff, len));
+				/* sub off32(%rdi),%r9d */
+				EMIT3_off32(0x44, 0x2b, 0x8f,
+					    offsetof(struct sk_buff, data_len));
+				/* mov off32(%rdi),%r8 */
+				EMIT3_off32(0x4c, 0x8b, 0x87,
+					    offsetof(struct sk_buff, data));
+			}
+		}
+
+		/* A and X start out as zero, like in sk_run_filter() */
+		CLEAR_A();
+		if (seen & SEEN_XREG)
+			CLEAR_X();
+
+		ilen = prog - temp;
+		if (image)
+			memcpy(image + proglen, temp, ilen);
+		proglen += ilen;
+		prog = temp;
+
+		for (i = 0; i < flen; i++) {
+			unsigned int K = filter[i].k;
+
+			switch (filter[i].code) {
+			case BPF_S_ALU_ADD_X: /* A += X; */
+				EMIT2(0x01, 0xd8);		/* add %ebx,%eax */
+				break;
+			case BPF_S_ALU_ADD_K: /* A += K; */
+				if (!K)
+					break;
+				if (is_imm8(K))
+					EMIT3(0x83, 0xc0, K);	/* add imm8,%eax */
+				else
+					EMIT1_off32(0x05, K);	/* add imm32,%eax */
+				break;
+			case BPF_S_ALU_SUB_X: /* A -= X; */
+				EMIT2(0x29, 0xd8);		/* sub    %ebx,%eax */
+				break;
+			case BPF_S_ALU_SUB_K: /* A -= K */
+				if (!K)
+					break;
+				if (is_imm8(K))
+					EMIT3(0x83, 0xe8, K); /* sub imm8,%eax */
+				else
+					EMIT1_off32(0x2d, K); /* sub imm32,%eax */
+				break;
+			case BPF_S_ALU_MUL_X: /* A *= X; */
+				EMIT3(0x0f, 0xaf, 0xc3);	/* imul %ebx,%eax */
+				break;
+			case BPF_S_ALU_MUL_K: /* A *= K */
+				if (is_imm8(K))
+					EMIT3(0x6b, 0xc0, K); /* imul imm8,%eax,%eax */
+				else
+					EMIT2_off32(0x69, 0xc0, K); /* imul imm32,%eax,%eax */
+				break;
+			case BPF_S_ALU_DIV_X: /* if (!X) return 0; A /= X; */
+				EMIT2(0x85, 0xdb);	/* test %ebx,%ebx */
+				EMIT_RET0_UNLESS(X86_JNE);
+				EMIT4(0x31, 0xd2, 0xf7, 0xf3); /* xor %edx,%edx; div %ebx */
+				break;
+			case BPF_S_ALU_DIV_K: /* A = reciprocal_divide(A, K); */
+				EMIT1_off32(0xba, K);	/* mov imm32,%edx */
+				EMIT2(0xf7, 0xe2);	/* mul %edx */
+				EMIT2(0x89, 0xd0);	/* mov %edx,%eax */
+				break;
+			case BPF_S_ALU_AND_X:
+				EMIT2(0x21, 0xd8);		/* and %ebx,%eax */
+				break;
+			case BPF_S_ALU_AND_K:
+				if (is_imm8(K))
+					EMIT3(0x83, 0xe0, K); /* and imm8,%eax */
+				else
+					EMIT1_off32(0x25, K);	/* and imm32,%eax */
+				break;
+			case BPF_S_ALU_OR_X:
+				EMIT2(0x09, 0xd8);		/* or %ebx,%eax */
+				break;
+			case BPF_S_ALU_OR_K:
+				if (is_imm8(K))
+					EMIT3(0x83, 0xc8, K); /* or imm8,%eax */
+				else
+					EMIT1_off32(0x0d, K);	/* or imm32,%eax */
+				break;
+			case BPF_S_ALU_LSH_X: /* A <<= X; */
+				EMIT4(0x89, 0xd9, 0xd3, 0xe0);	/* mov %ebx,%ecx; shl %cl,%eax */
+				break;
+			case BPF_S_ALU_LSH_K:
+				if (K == 0)
+					break;
+				else if (K == 1)
+					EMIT2(0xd1, 0xe0); /* shl %eax */
+				else
+					EMIT3(0xc1, 0xe0, K);
+				break;
+			case BPF_S_ALU_RSH_X: /* A >>= X; */
+				EMIT4(0x89, 0xd9, 0xd3, 0xe8);	/* mov %ebx,%ecx; shr %cl,%eax */
+				break;
+			case BPF_S_ALU_RSH_K: /* A >>= K; */
+				if (K == 0)
+					break;
+				else if (K == 1)
+					EMIT2(0xd1, 0xe8); /* shr %eax */
+				else
+					EMIT3(0xc1, 0xe8, K);
+				break;
+			case BPF_S_ALU_NEG:
+				EMIT2(0xf7, 0xd8);		/* neg %eax */
+				break;
+			case BPF_S_RET_K:
+				if (!K)
+					CLEAR_A();
+				else
+					EMIT1_off32(0xb8, K);	/* mov $imm32,%eax */
+				/* fallinto */
+			case BPF_S_RET_A:
+				prog = emit_epilogue(prog, seen);
+				break;
+			case BPF_S_MISC_TAX: /* X = A */
+				EMIT2(0x89, 0xc3);	/* mov    %eax,%ebx */
+				break;
+			case BPF_S_MISC_TXA: /* A = X */
+				EMIT2(0x89, 0xd8);	/* mov    %ebx,%eax */
+				break;
+			case BPF_S_LD_IMM: /* A = K */
+				if (!K)
+					CLEAR_A();
+				else
+					EMIT1_off32(0xb8, K); /* mov $imm32,%eax */
+				break;
+			case BPF_S_LDX_IMM: /* X = K */
+				if (!K)
+					CLEAR_X();
+				else
+					EMIT1_off32(0xbb, K); /* mov $imm32,%ebx */
+				break;
+			case BPF_S_LD_MEM: /* A = mem[K] : mov off8(%rbp),%eax */
+				EMIT3(0x8b, 0x45, 0xff & SCRATCH_OFF(K));
+				break;
+			case BPF_S_LDX_MEM: /* X = mem[K] : mov off8(%rbp),%ebx */
+				EMIT3(0x8b, 0x5d, 0xff & SCRATCH_OFF(K));
+				break;
+			case BPF_S_ST: /* mem[K] = A : mov %eax,off8(%rbp) */
+				EMIT3(0x89, 0x45, 0xff & SCRATCH_OFF(K));
+				break;
+			case BPF_S_STX: /* mem[K] = X : mov %ebx,off8(%rbp) */
+				EMIT3(0x89, 0x5d, 0xff & SCRATCH_OFF(K));
+				break;
+			case BPF_S_LD_W_LEN: /*	A = skb->len; */
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, len) != 4);
+				/* mov off32(%rdi),%eax */
+				EMIT2_off32(0x8b, 0x87, offsetof(struct sk_buff, len));
+				break;
+			case BPF_S_LDX_W_LEN: /* X = skb->len; */
+				/* mov off32(%rdi),%ebx */
+				EMIT2_off32(0x8b, 0x9f, offsetof(struct sk_buff, len));
+				break;
+			case BPF_S_ANC_PROTOCOL: /* A = ntohs(skb->protocol); */
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, protocol) != 2);
+				/* movzwl off32(%rdi),%eax */
+				EMIT3_off32(0x0f, 0xb7, 0x87,
+					    offsetof(struct sk_buff, protocol));
+				EMIT2(0x86, 0xc4); /* ntohs() : xchg   %al,%ah */
+				break;
+			case BPF_S_ANC_IFINDEX:
+			case BPF_S_ANC_HATYPE:
+				/* if (!skb->dev) return 0; */
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, dev) != 8);
+				/* mov off32(%rdi),%rax */
+				EMIT3_off32(0x48, 0x8b, 0x87,
+					    offsetof(struct sk_buff, dev));
+				EMIT3(0x48, 0x85, 0xc0);	/* test %rax,%rax */
+				EMIT_RET0_UNLESS(X86_JNE);
+				if (filter[i].code == BPF_S_ANC_IFINDEX) {
+					BUILD_BUG_ON(FIELD_SIZEOF(struct net_device, ifindex) != 4);
+					/* mov off32(%rax),%eax */
+					EMIT2_off32(0x8b, 0x80,
+						    offsetof(struct net_device, ifindex));
+				} else {
+					BUILD_BUG_ON(FIELD_SIZEOF(struct net_device, type) != 2);
+					/* movzwl off32(%rax),%eax */
+					EMIT3_off32(0x0f, 0xb7, 0x80,
+						    offsetof(struct net_device, type));
+				}
+				break;
+			case BPF_S_ANC_MARK:
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, mark) != 4);
+				/* mov off32(%rdi),%eax */
+				EMIT2_off32(0x8b, 0x87, offsetof(struct sk_buff, mark));
+				break;
+			case BPF_S_ANC_RXHASH:
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, rxhash) != 4);
+				/* mov off32(%rdi),%eax */
+				EMIT2_off32(0x8b, 0x87, offsetof(struct sk_buff, rxhash));
+				break;
+			case BPF_S_ANC_QUEUE:
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, queue_mapping) != 2);
+				/* movzwl off32(%rdi),%eax */
+				EMIT3_off32(0x0f, 0xb7, 0x87,
+					    offsetof(struct sk_buff, queue_mapping));
+				break;
+			case BPF_S_ANC_CPU:
+#ifdef CONFIG_SMP
+				EMIT4(0x65, 0x8b, 0x04, 0x25); /* mov %gs:off32,%eax */
+				EMIT((u32)(unsigned long)&cpu_number, 4); /* A = smp_processor_id(); */
+#else
+				CLEAR_A();
+#endif
+				break;
+			case BPF_S_LD_W_ABS:
+				func = sk_load_word;
+common_load:
+				t_offset = image ? func - (image + addrs[i]) : 0;
+				EMIT1_off32(0xbe, K); /* mov imm32,%esi */
+				EMIT1_off32(0xe8, t_offset); /* call */
+				break;
+			case BPF_S_LD_H_ABS:
+				func = sk_load_half;
+				goto common_load;
+			case BPF_S_LD_B_ABS:
+				func = sk_load_byte;
+				goto common_load;
+			case BPF_S_LDX_B_MSH:
+				func = sk_load_byte_msh;
+				goto common_load;
+			case BPF_S_LD_W_IND:
+				func = sk_load_word;
+common_load_ind:
+				t_offset = image ? func - (image + addrs[i]) : 0;
+				EMIT2(0x89, 0xde); /* mov %ebx,%esi */
+				if (K) {
+					if (is_imm8(K))
+						EMIT3(0x83, 0xc6, K); /* add imm8,%esi */
+					else
+						EMIT2_off32(0x81, 0xc6, K); /* add imm32,%esi */
+				}
+				EMIT1_off32(0xe8, t_offset); /* call */
+				break;
+			case BPF_S_LD_H_IND:
+				func = sk_load_half;
+				goto common_load_ind;
+			case BPF_S_LD_B_IND:
+				func = sk_load_byte;
+				goto common_load_ind;
+			case BPF_S_JMP_JA:
+				t_offset = addrs[i + K] - addrs[i];
+				EMIT_JMP(t_offset);
+				break;
+			COND_SEL(BPF_S_JMP_JGT_K, X86_JA, X86_JBE);
+			COND_SEL(BPF_S_JMP_JGE_K, X86_JAE, X86_JB);
+			COND_SEL(BPF_S_JMP_JEQ_K, X86_JE, X86_JNE);
+			COND_SEL(BPF_S_JMP_JSET_K, X86_JNE, X86_JE);
+			COND_SEL(BPF_S_JMP_JGT_X, X86_JA, X86_JBE);
+			COND_SEL(BPF_S_JMP_JGE_X, X86_JAE, X86_JB);
+			COND_SEL(BPF_S_JMP_JEQ_X, X86_JE, X86_JNE);
+			COND_SEL(BPF_S_JMP_JSET_X, X86_JNE, X86_JE);
+
+cond_branch:			f_offset = addrs[i + filter[i].jf] - addrs[i];
+				t_offset = addrs[i + filter[i].jt] - addrs[i];
+
+				/* same targets, can avoid doing the test :) */
+				if (filter[i].jt == filter[i].jf) {
+					EMIT_JMP(t_offset);
+					break;
+				}
+
+				switch (filter[i].code) {
+				case BPF_S_JMP_JGT_X:
+				case BPF_S_JMP_JGE_X:
+				case BPF_S_JMP_JEQ_X:
+					EMIT2(0x39, 0xd8); /* cmp %ebx,%eax */
+					break;
+				case BPF_S_JMP_JSET_X:
+					EMIT2(0x85, 0xd8); /* test %ebx,%eax */
+					break;
+				case BPF_S_JMP_JEQ_K:
+					if (K == 0) {
+						EMIT2(0x85, 0xc0); /* test   %eax,%eax */
+						break;
+					}
+				case BPF_S_JMP_JGT_K:
+				case BPF_S_JMP_JGE_K:
+					if (is_imm8(K))
+						EMIT3(0x83, 0xf8, K); /* cmp imm8,%eax */
+					else
+						EMIT1_off32(0x3d, K); /* cmp imm32,%eax */
+					break;
+				case BPF_S_JMP_JSET_K:
+					if (K <= 0xFF)
+						EMIT2(0xa8, K); /* test imm8,%al */
+					else if (!(K & 0xFFFF00FF))
+						EMIT3(0xf6, 0xc4, K >> 8); /* test imm8,%ah */
+					else if (K <= 0xFFFF) {
+						EMIT2(0x66, 0xa9); /* test imm16,%ax */
+						EMIT(K, 2);
+					} else {
+						EMIT1_off32(0xa9, K); /* test imm32,%eax */
+					}
+					break;
+				}
+				if (filter[i].jt != 0) {
+					/* the true jump goes past the false one */
+					if (filter[i].jf && f_offset)
+						t_offset += is_near(f_offset) ? 2 : 5;
+					EMIT_COND_JMP(t_op, t_offset);
+					if (filter[i].jf)
+						EMIT_JMP(f_offset);
+					break;
+				}
+				EMIT_COND_JMP(f_op, f_offset);
+				break;
+			default:
+				/* hmm, too complex filter, give up with jit compiler */
+				goto out;
+			}
+			ilen = prog - temp;
+			if (image) {
+				if (unlikely(proglen + ilen > oldproglen)) {
+					pr_err("bpf_jit_compile fatal error\n");
+					kfree(addrs);
+					module_free(NULL, image);
+					return;
+				}
+				memcpy(image + proglen, temp, ilen);
+			}
+			proglen += ilen;
+			addrs[i] = proglen;
+			prog = temp;
+		}
+
+		if (image) {
+			if (unlikely(proglen != oldproglen))
+				pr_err("bpf_jit_compile proglen=%u != oldproglen=%u\n",
+				       proglen, oldproglen);
+			break;
+		}
+		if (proglen == oldproglen) {
+			image = module_alloc(max_t(unsigned int,
+						   proglen,
+						   sizeof(struct work_struct)));
+			if (!image)
+				goto out;
+		}
+		oldproglen = proglen;
+	}
+
+	if (bpf_jit_enable > 1)
+		pr_err("flen=%d proglen=%u pass=%d image=%p\n",
+		       flen, proglen, pass, image);
+
+	if (image) {
+		if (bpf_jit_enable > 1)
+			print_hex_dump(KERN_ERR, "JIT code: ", DUMP_PREFIX_ADDRESS,
+				       16, 1, image, proglen, false);
+
+		fp->bpf_func = (void *)image;
+	}
+out:
+	kfree(addrs);
+	return;
+}
+
+static void jit_free_defer(struct work_struct *arg)
+{
+	module_free(NULL, arg);
+}
+
+/* run from softirq, we must use a work_struct to call
+ * module_free() from process context
+ */
+void bpf_jit_free(struct sk_filter *fp)
+{
+	if (fp->bpf_func != sk_run_filter) {
+		struct work_struct *work = (struct work_struct *)fp->bpf_func;
+
+		INIT_WORK(work, jit_free_defer);
+		schedule_work(work);
+	}
+}
@@ -0,0 +1,203 @@
+/*
+ * Tag allocation for multiqueue devices.
+ *
+ * Tags are handed out from a plain bitmap with atomic bit operations, so
+ * there is no lock shared between submitting CPUs. Each CPU remembers
+ * where its last allocation succeeded and starts searching from there,
+ * which keeps CPUs on different words of the map as long as the device
+ * is not close to saturation.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+
+#include <linux/blk-mq.h>
+#include "blk-mq.h"
+
+struct blk_mq_bitmap {
+	unsigned int		depth;
+	unsigned int		offset;		/* tag of bit 0 */
+	unsigned long		*map;
+	wait_queue_head_t	wait;
+};
+
+struct blk_mq_tags {
+	unsigned int		nr_tags;
+	unsigned int		nr_reserved_tags;
+
+	/* where each cpu starts looking for a free normal tag */
+	unsigned int __percpu	*hint;
+
+	struct blk_mq_bitmap	normal;
+	struct blk_mq_bitmap	reserved;
+};
+
+static int __bt_find(unsigned long *map, unsigned int from, unsigned int to)
+{
+	unsigned int bit = from;
+
+	while ((bit = find_next_zero_bit(map, to, bit)) < to) {
+		if (!test_and_set_bit_lock(bit, map))
+			return bit;
+		bit++;
+	}
+
+	return -1;
+}
+
+static int __bt_get(struct blk_mq_bitmap *bm, unsigned int start)
+{
+	int bit;
+
+	if (start >= bm->depth)
+		start = 0;
+
+	bit = __bt_find(bm->map, start, bm->depth);
+	if (bit < 0 && start)
+		bit = __bt_find(bm->map, 0, start);
+
+	return bit;
+}
+
+static int bt_get(struct blk_mq_tags *tags, struct blk_mq_bitmap *bm)
+{
+	int bit;
+
+	if (bm != &tags->normal)
+		return __bt_get(bm, 0);
+
+	bit = __bt_get(bm, this_cpu_read(*tags->hint));
+	if (bit >= 0)
+		this_cpu_write(*tags->hint, bit + 1);
+
+	return bit;
+}
+
+/**
+ * blk_mq_get_tag - allocate a tag
+ * @tags:	tag map of the hardware context
+ * @gfp:	allocation mask, __GFP_WAIT means we may sleep for a tag
+ * @reserved:	allocate from the reserved pool
+ *
+ * Returns the tag or %BLK_MQ_TAG_FAIL if none was free and the caller
+ * did not allow sleeping.
+ */
+unsigned int blk_mq_get_tag(struct blk_mq_tags *tags, gfp_t gfp,
+			    bool reserved)
+{
+	struct blk_mq_bitmap *bm = reserved ? &tags->reserved : &tags->normal;
+	DEFINE_WAIT(wait);
+	int bit;
+
+	if (unlikely(!bm->depth))
+		return BLK_MQ_TAG_FAIL;
+
+	bit = bt_get(tags, bm);
+	if (bit >= 0 || !(gfp & __GFP_WAIT))
+		goto out;
+
+	for (;;) {
+		prepare_to_wait_exclusive(&bm->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		bit = bt_get(tags, bm);
+		if (bit >= 0)
+			break;
+		io_schedule();
+	}
+	finish_wait(&bm->wait, &wait);
+out:
+	if (bit < 0)
+		return BLK_MQ_TAG_FAIL;
+	return bit + bm->offset;
+}
+
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	struct blk_mq_bitmap *bm;
+
+	BUG_ON(tag >= tags->nr_tags);
+
+	if (tag < tags->nr_reserved_tags)
+		bm = &tags->reserved;
+	else
+		bm = &tags->normal;
+
+	clear_bit_unlock(tag - bm->offset, bm->map);
+
+	/* pairs with the barrier in prepare_to_wait_exclusive() */
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&bm->wait))
+		wake_up(&bm->wait);
+}
+
+static int bt_init(struct blk_mq_bitmap *bm, unsigned int depth,
+		   unsigned int offset, int node)
+{
+	bm->depth = depth;
+	bm->offset = offset;
+	init_waitqueue_head(&bm->wait);
+
+	bm->map = kzalloc_node(BITS_TO_LONGS(depth) * sizeof(long),
+			       GFP_KERNEL, node);
+	if (!bm->map)
+		return -ENOMEM;
+
+	return 0;
+}
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags,
+				     unsigned int reserved_tags, int node)
+{
+	struct blk_mq_tags *tags;
+	unsigned int nr_normal;
+	int cpu;
+
+	if (nr_tags > BLK_MQ_MAX_DEPTH || reserved_tags >= nr_tags) {
+		printk(KERN_ERR "blk-mq: bad tag depth %u/%u\n",
+		       nr_tags, reserved_tags);
+		return NULL;
+	}
+
+	tags = kzalloc_node(sizeof(*tags), GFP_KERNEL, node);
+	if (!tags)
+		return NULL;
+
+	tags->nr_tags = nr_tags;
+	tags->nr_reserved_tags = reserved_tags;
+	nr_normal = nr_tags - reserved_tags;
+
+	tags->hint = alloc_percpu(unsigned int);
+	if (!tags->hint)
+		goto err_free;
+
+	/*
+	 * Start every cpu on its own word of the map, so that concurrent
+	 * allocations from different CPUs don't all fight over bit 0.
+	 */
+	for_each_possible_cpu(cpu)
+		*per_cpu_ptr(tags->hint, cpu) =
+			(cpu * BITS_PER_LONG) % nr_normal;
+
+	if (bt_init(&tags->normal, nr_normal, reserved_tags, node))
+		goto err_free;
+	if (bt_init(&tags->reserved, reserved_tags, 0, node))
+		goto err_free;
+
+	return tags;
+
+err_free:
+	blk_mq_free_tags(tags);
+	return NULL;
+}
+
+void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	kfree(tags->normal.map);
+	kfree(tags->reserved.map);
+	free_percpu(tags->hint);
+	kfree(tags);
+}
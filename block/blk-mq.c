@@ -0,0 +1,1019 @@
+/*
+ * Block multiqueue core code
+ *
+ * Requests are staged on per-cpu software queues (struct blk_mq_ctx) and
+ * handed to the driver through one or more hardware dispatch contexts
+ * (struct blk_mq_hw_ctx).  Neither q->queue_lock nor an io scheduler is
+ * involved, so submitters on different CPUs only meet on the hardware
+ * context they share.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/mm.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/smp.h>
+#include <linux/topology.h>
+#include <linux/log2.h>
+
+#include <trace/events/block.h>
+
+#include <linux/blk-mq.h>
+#include "blk.h"
+#include "blk-mq.h"
+
+#define QUEUE_FLAG_MQ_DEFAULT	((1 << QUEUE_FLAG_IO_STAT) |		\
+				 (1 << QUEUE_FLAG_SAME_COMP))
+
+#define BLK_MQ_DEFAULT_TIMEOUT	(30 * HZ)
+
+/* FLUSH/FUA sequences */
+enum {
+	MQ_FSEQ_PREFLUSH	= (1 << 0), /* pre-flush still to be issued */
+	MQ_FSEQ_DATA		= (1 << 1), /* data write still to be issued */
+	MQ_FSEQ_POSTFLUSH	= (1 << 2), /* post-flush still to be issued */
+};
+
+/*
+ * Extra tags kept back per hardware context for the flush requests of
+ * FLUSH/FUA sequences, see blk_mq_insert_flush().  Every sequence in
+ * flight holds one, so they scale with the queue depth; a single tag
+ * would serialize all flushes on the context behind it.
+ */
+static unsigned int blk_mq_flush_tags(unsigned int queue_depth)
+{
+	return clamp_t(unsigned int, queue_depth / 4, 1,
+		       BLK_MQ_MAX_DEPTH - queue_depth);
+}
+
+static void blk_mq_flush_next(struct request *rq);
+
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+/*
+ * Check if any of the ctx's have pending work in this hardware queue
+ */
+static bool blk_mq_hctx_has_pending(struct blk_mq_hw_ctx *hctx)
+{
+	return !list_empty_careful(&hctx->dispatch) ||
+		find_first_bit(hctx->ctx_map, hctx->nr_ctx) < hctx->nr_ctx;
+}
+
+/*
+ * Mark this ctx as having pending work in this hardware queue
+ */
+static void blk_mq_hctx_mark_pending(struct blk_mq_hw_ctx *hctx,
+				     struct blk_mq_ctx *ctx)
+{
+	if (!test_bit(ctx->index_hw, hctx->ctx_map))
+		set_bit(ctx->index_hw, hctx->ctx_map);
+}
+
+static void blk_mq_rq_ctx_init(struct request_queue *q, struct blk_mq_ctx *ctx,
+			       struct request *rq, unsigned int rw_flags)
+{
+	int tag = rq->tag;
+
+	blk_rq_init(q, rq);
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	rq->cmd_flags = rw_flags;
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+
+	ctx->rq_dispatched[rw_is_sync(rw_flags)]++;
+}
+
+static void blk_mq_wait_for_tags(struct blk_mq_tags *tags, bool reserved)
+{
+	unsigned int tag;
+
+	tag = blk_mq_get_tag(tags, __GFP_WAIT, reserved);
+	blk_mq_put_tag(tags, tag);
+}
+
+static struct request *blk_mq_alloc_request_pinned(struct request_queue *q,
+						   int rw, gfp_t gfp,
+						   bool reserved)
+{
+	struct blk_mq_ctx *ctx;
+	struct blk_mq_hw_ctx *hctx;
+	struct request *rq;
+	unsigned int tag;
+
+	for (;;) {
+		ctx = blk_mq_get_ctx(q);
+		hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+		tag = blk_mq_get_tag(hctx->tags, gfp & ~__GFP_WAIT, reserved);
+		if (tag != BLK_MQ_TAG_FAIL) {
+			rq = hctx->rqs[tag];
+			blk_mq_rq_ctx_init(q, ctx, rq, rw);
+			blk_mq_put_ctx(ctx);
+			return rq;
+		}
+		blk_mq_put_ctx(ctx);
+
+		if (!(gfp & __GFP_WAIT))
+			return NULL;
+
+		/*
+		 * Out of tags. Make sure everything staged for this
+		 * context is on its way to the hardware, then wait for
+		 * a completion to give one back.
+		 */
+		blk_mq_run_hw_queue(hctx, false);
+		blk_mq_wait_for_tags(hctx->tags, reserved);
+	}
+}
+
+/**
+ * blk_mq_alloc_request - allocate a request from a multiqueue device
+ * @q:		the queue
+ * @rw:		request flags, READ or WRITE plus modifiers
+ * @gfp:	__GFP_WAIT allows sleeping until a tag is available
+ * @reserved:	allocate from the reserved tag pool
+ *
+ * The request comes back initialized and tagged, with rq->tag matching
+ * its slot in the hardware context.
+ */
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp, bool reserved)
+{
+	return blk_mq_alloc_request_pinned(q, rw, gfp, reserved);
+}
+EXPORT_SYMBOL(blk_mq_alloc_request);
+
+static void __blk_mq_free_request(struct blk_mq_hw_ctx *hctx,
+				  struct blk_mq_ctx *ctx, struct request *rq)
+{
+	const int tag = rq->tag;
+
+	ctx->rq_completed[rq_is_sync(rq)]++;
+	rq->cmd_flags = 0;
+
+	blk_mq_put_tag(hctx->tags, tag);
+}
+
+void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct request_queue *q = rq->q;
+
+	__blk_mq_free_request(q->mq_ops->map_queue(q, ctx->cpu), ctx, rq);
+}
+EXPORT_SYMBOL(blk_mq_free_request);
+
+static void __blk_mq_end_io(struct request *rq, int error)
+{
+	/* part of a FLUSH/FUA sequence, let it decide what comes next */
+	if (unlikely(rq->mq_flush_seq || rq->mq_flush_rq)) {
+		if (error && !rq->mq_flush_err)
+			rq->mq_flush_err = error;
+		blk_mq_flush_next(rq);
+		return;
+	}
+
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	blk_account_io_done(rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		blk_mq_free_request(rq);
+}
+
+/**
+ * blk_mq_end_io - complete a request
+ * @rq:		the request being completed
+ * @error:	%0 for success, < %0 for error
+ *
+ * Description:
+ *     Ends all I/O on @rq and gives its tag back.  May be called from
+ *     interrupt context, no locks need to be held.  Does nothing if @rq
+ *     has already been timed out and ended by blk_mq_rq_timer().
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (blk_mark_rq_complete(rq))
+		return;
+
+	__blk_mq_end_io(rq, error);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static unsigned long blk_mq_rq_deadline(struct request *rq)
+{
+	return jiffies + (rq->timeout ? rq->timeout : rq->q->rq_timeout);
+}
+
+static void blk_mq_start_request(struct blk_mq_hw_ctx *hctx,
+				 struct request *rq)
+{
+	struct timer_list *timer = &hctx->timeout;
+	unsigned long expiry;
+
+	trace_block_rq_issue(rq->q, rq);
+
+	rq->deadline = blk_mq_rq_deadline(rq);
+	blk_clear_rq_complete(rq);
+	/* blk_mq_rq_timer() must not see REQ_STARTED with a stale deadline */
+	smp_wmb();
+	rq->cmd_flags |= REQ_STARTED;
+
+	if (!rq->q->mq_ops->timeout)
+		return;
+
+	expiry = round_jiffies_up(rq->deadline);
+	if (!timer_pending(timer) || time_before(expiry, timer->expires))
+		mod_timer(timer, expiry);
+}
+
+static void blk_mq_requeue_request(struct request *rq)
+{
+	trace_block_rq_requeue(rq->q, rq);
+	rq->cmd_flags &= ~REQ_STARTED;
+}
+
+/*
+ * Run this hardware queue, pulling any software queues mapped to it in.
+ * Requests the driver bounced last time go first; beyond that there is no
+ * ordering between the software queues of different CPUs.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit, queued;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	hctx->run++;
+
+	/*
+	 * If we have previous entries on our dispatch list, grab them
+	 * first for more fair dispatch.
+	 */
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock_irq(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock_irq(&hctx->lock);
+	}
+
+	/*
+	 * Touch any software queue that has pending entries.
+	 */
+	for_each_set_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		clear_bit(bit, hctx->ctx_map);
+		ctx = hctx->ctxs[bit];
+
+		spin_lock_irq(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock_irq(&ctx->lock);
+	}
+
+	/*
+	 * Now process all the entries, sending them to the driver.
+	 */
+	queued = 0;
+	while (!list_empty(&rq_list)) {
+		int ret;
+
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		blk_mq_start_request(hctx, rq);
+
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		switch (ret) {
+		case BLK_MQ_RQ_QUEUE_OK:
+			queued++;
+			continue;
+		case BLK_MQ_RQ_QUEUE_BUSY:
+			list_add(&rq->queuelist, &rq_list);
+			blk_mq_requeue_request(rq);
+			break;
+		default:
+			printk(KERN_ERR "blk-mq: bad return on queue: %d\n",
+			       ret);
+			/* fall through */
+		case BLK_MQ_RQ_QUEUE_ERROR:
+			rq->errors = -EIO;
+			__blk_mq_end_io(rq, rq->errors);
+			continue;
+		}
+
+		break;
+	}
+
+	if (queued && q->mq_ops->commit_rqs)
+		q->mq_ops->commit_rqs(hctx);
+
+	if (!queued)
+		hctx->dispatched[0]++;
+	else if (queued < (1 << (BLK_MQ_MAX_DISPATCH_ORDER - 1)))
+		hctx->dispatched[ilog2(queued) + 1]++;
+
+	/*
+	 * Any items that need requeuing? Stuff them into hctx->dispatch,
+	 * that is where we will continue on next queue run.  The driver
+	 * stops the hardware queue before returning BUSY; if a completion
+	 * restarted it before we got here, nobody else will pick these
+	 * up, so kick the queue again.
+	 */
+	if (!list_empty(&rq_list)) {
+		spin_lock_irq(&hctx->lock);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock_irq(&hctx->lock);
+
+		if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			blk_mq_run_hw_queue(hctx, true);
+	}
+}
+
+/**
+ * blk_mq_run_hw_queue - send staged requests to the driver
+ * @hctx:	hardware context to run
+ * @async:	punt the run to kblockd instead of doing it inline
+ *
+ * Runs from interrupt context, or with interrupts disabled, are always
+ * punted to kblockd.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (!async && !in_interrupt() && !irqs_disabled())
+		__blk_mq_run_hw_queue(hctx);
+	else
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!blk_mq_hctx_has_pending(hctx))
+			continue;
+
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+/**
+ * blk_mq_stop_hw_queue - stop dispatching to a hardware context
+ * @hctx:	the context to stop
+ *
+ * Description:
+ *     Called by the driver when it runs out of resources, typically
+ *     right before returning %BLK_MQ_RQ_QUEUE_BUSY from ->queue_rq().
+ *     Restart it with blk_mq_start_stopped_hw_queues() once something
+ *     has completed.
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_start_stopped_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+
+		clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+		blk_mq_run_hw_queue(hctx, true);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, run_work);
+	__blk_mq_run_hw_queue(hctx);
+}
+
+static void blk_mq_rq_timed_out(struct request *rq)
+{
+	switch (rq->q->mq_ops->timeout(rq)) {
+	case BLK_EH_HANDLED:
+		/* the driver is done with @rq, fail it */
+		__blk_mq_end_io(rq, -EIO);
+		break;
+	case BLK_EH_NOT_HANDLED:
+		/*
+		 * The driver is still working on it and will end it with
+		 * blk_mq_end_io(), look again after another timeout.
+		 */
+	case BLK_EH_RESET_TIMER:
+		rq->deadline = blk_mq_rq_deadline(rq);
+		blk_clear_rq_complete(rq);
+		break;
+	}
+}
+
+/*
+ * Per hardware context request timeout.  Started requests are found by
+ * walking the context's request map; whoever marks one complete first,
+ * this timer or blk_mq_end_io(), gets to end it.
+ */
+static void blk_mq_rq_timer(unsigned long data)
+{
+	struct blk_mq_hw_ctx *hctx = (struct blk_mq_hw_ctx *)data;
+	unsigned long next = 0;
+	bool pending = false;
+	unsigned int i;
+
+	for (i = 0; i < hctx->queue_depth; i++) {
+		struct request *rq = hctx->rqs[i];
+
+		if (!(rq->cmd_flags & REQ_STARTED))
+			continue;
+		smp_rmb();
+
+		if (time_after_eq(jiffies, rq->deadline)) {
+			if (blk_mark_rq_complete(rq))
+				continue;
+
+			blk_mq_rq_timed_out(rq);
+			if (test_bit(REQ_ATOM_COMPLETE, &rq->atomic_flags))
+				continue;
+		}
+
+		if (!pending || time_after(next, rq->deadline))
+			next = rq->deadline;
+		pending = true;
+	}
+
+	if (pending)
+		mod_timer(&hctx->timeout, round_jiffies_up(next));
+}
+
+static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
+				    struct request *rq, bool at_head)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+
+	trace_block_rq_insert(hctx->queue, rq);
+
+	if (at_head)
+		list_add(&rq->queuelist, &ctx->rq_list);
+	else
+		list_add_tail(&rq->queuelist, &ctx->rq_list);
+	blk_mq_hctx_mark_pending(hctx, ctx);
+
+	/*
+	 * We do this early, to ensure we are on the right CPU.
+	 */
+	hctx->queued++;
+}
+
+/**
+ * blk_mq_insert_request - queue a prepared request
+ * @rq:		request, from blk_mq_alloc_request()
+ * @at_head:	insert at the head of its software queue
+ * @run_queue:	run the hardware queue afterwards
+ * @async:	run it from kblockd rather than from this context
+ *
+ * The request goes on the software queue of the CPU it was allocated
+ * on.  Safe to call from any context.
+ */
+void blk_mq_insert_request(struct request *rq, bool at_head, bool run_queue,
+			   bool async)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct blk_mq_hw_ctx *hctx;
+	unsigned long flags;
+
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	__blk_mq_insert_request(hctx, rq, at_head);
+	spin_unlock_irqrestore(&ctx->lock, flags);
+
+	if (run_queue)
+		blk_mq_run_hw_queue(hctx, async);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+/*
+ * FLUSH/FUA sequencing.
+ *
+ * The single-queue code serializes flush sequences on q->flush_rq.  There
+ * is no such central place here, so every sequence runs on its own: the
+ * original request carries the remaining steps in ->mq_flush_seq, and the
+ * pre/post flushes are issued on a second request taken from the reserved
+ * flush tags of its hardware context.  Each step is started from the
+ * completion of the previous one.
+ */
+static void blk_mq_flush_end_io(struct request *flush_rq, int error)
+{
+	struct request *rq = flush_rq->end_io_data;
+
+	if (error && !rq->mq_flush_err)
+		rq->mq_flush_err = error;
+
+	blk_mq_flush_next(rq);
+}
+
+static void blk_mq_issue_flush(struct request *rq)
+{
+	struct request *flush_rq = rq->mq_flush_rq;
+
+	blk_mq_rq_ctx_init(rq->q, flush_rq->mq_ctx, flush_rq, WRITE_FLUSH);
+	flush_rq->cmd_type = REQ_TYPE_FS;
+	flush_rq->cmd_flags &= ~REQ_IO_STAT;
+	flush_rq->rq_disk = rq->rq_disk;
+	flush_rq->end_io = blk_mq_flush_end_io;
+	flush_rq->end_io_data = rq;
+
+	blk_mq_insert_request(flush_rq, true, true, true);
+}
+
+static void blk_mq_flush_next(struct request *rq)
+{
+	unsigned int seq = rq->mq_flush_seq;
+
+	if (seq & MQ_FSEQ_PREFLUSH) {
+		rq->mq_flush_seq &= ~MQ_FSEQ_PREFLUSH;
+		blk_mq_issue_flush(rq);
+	} else if (seq & MQ_FSEQ_DATA) {
+		rq->mq_flush_seq &= ~MQ_FSEQ_DATA;
+		blk_mq_insert_request(rq, true, true, true);
+	} else if (seq & MQ_FSEQ_POSTFLUSH) {
+		rq->mq_flush_seq &= ~MQ_FSEQ_POSTFLUSH;
+		blk_mq_issue_flush(rq);
+	} else {
+		/* sequence done, complete the original request */
+		blk_mq_free_request(rq->mq_flush_rq);
+		rq->mq_flush_rq = NULL;
+		__blk_mq_end_io(rq, rq->mq_flush_err);
+	}
+}
+
+static void blk_mq_insert_flush(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	unsigned int fflags = q->flush_flags; /* may change, cache it */
+	bool has_flush = fflags & REQ_FLUSH, has_fua = fflags & REQ_FUA;
+	unsigned int seq = 0;
+
+	if (has_flush && (rq->cmd_flags & REQ_FLUSH))
+		seq |= MQ_FSEQ_PREFLUSH;
+	if (blk_rq_sectors(rq))
+		seq |= MQ_FSEQ_DATA;
+	if (has_flush && !has_fua && (rq->cmd_flags & REQ_FUA))
+		seq |= MQ_FSEQ_POSTFLUSH;
+
+	rq->cmd_flags &= ~REQ_FLUSH;
+	if (!has_fua)
+		rq->cmd_flags &= ~REQ_FUA;
+
+	switch (seq) {
+	case 0:
+		/* empty flush to a device without a volatile cache */
+		__blk_mq_end_io(rq, 0);
+		return;
+	case MQ_FSEQ_DATA:
+		/* nothing to sequence, issue it like any other write */
+		blk_mq_insert_request(rq, false, true, false);
+		return;
+	case MQ_FSEQ_PREFLUSH:
+		/* empty flush, the request itself is the flush command */
+		rq->cmd_flags |= REQ_FLUSH;
+		blk_mq_insert_request(rq, false, true, false);
+		return;
+	}
+
+	/*
+	 * The flush request comes from the reserved pool, so this can't
+	 * deadlock against the normal tag @rq is holding.
+	 */
+	rq->mq_flush_rq = blk_mq_alloc_request_pinned(q, WRITE, GFP_NOIO, true);
+	rq->mq_flush_err = 0;
+	rq->mq_flush_seq = seq;
+	rq->cmd_flags |= REQ_NOMERGE;
+	blk_mq_flush_next(rq);
+}
+
+/*
+ * Try to merge @bio into one of the last few requests staged on @ctx.
+ * Called with ctx->lock held.
+ */
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	struct request *rq;
+	int checked = 8;
+
+	list_for_each_entry_reverse(rq, &ctx->rq_list, queuelist) {
+		if (!checked--)
+			break;
+
+		if (!elv_rq_merge_ok(rq, bio))
+			continue;
+
+		if (blk_rq_pos(rq) + blk_rq_sectors(rq) == bio->bi_sector) {
+			if (bio_attempt_back_merge(q, rq, bio)) {
+				ctx->rq_merged++;
+				return true;
+			}
+			break;
+		} else if (blk_rq_pos(rq) - bio_sectors(bio) == bio->bi_sector) {
+			if (bio_attempt_front_merge(q, rq, bio)) {
+				ctx->rq_merged++;
+				return true;
+			}
+			break;
+		}
+	}
+
+	return false;
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	const int is_sync = rw_is_sync(bio->bi_rw);
+	const int is_flush_fua = bio->bi_rw & (REQ_FLUSH | REQ_FUA);
+	const bool unplug = !!(bio->bi_rw & REQ_UNPLUG);
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct blk_plug *plug;
+	struct request *rq;
+	unsigned int rw_flags;
+
+	/*
+	 * low level driver can indicate that it wants pages above a
+	 * certain limit bounced to low memory (ie for highmem, or even
+	 * ISA dma in theory)
+	 */
+	blk_queue_bounce(q, &bio);
+
+	if (!is_flush_fua && blk_attempt_plug_merge(q, bio))
+		return 0;
+
+	ctx = blk_mq_get_ctx(q);
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	if (!is_flush_fua && (hctx->flags & BLK_MQ_F_SHOULD_MERGE) &&
+	    !blk_queue_nomerges(q)) {
+		bool merged;
+
+		spin_lock_irq(&ctx->lock);
+		merged = blk_mq_attempt_merge(q, ctx, bio);
+		spin_unlock_irq(&ctx->lock);
+
+		if (merged) {
+			blk_mq_put_ctx(ctx);
+			return 0;
+		}
+	}
+	blk_mq_put_ctx(ctx);
+
+	rw_flags = bio_data_dir(bio);
+	if (is_sync)
+		rw_flags |= REQ_SYNC;
+
+	trace_block_getrq(q, bio, rw_flags & 1);
+
+	/*
+	 * Grab a free request. This might sleep but can not fail.
+	 */
+	rq = blk_mq_alloc_request_pinned(q, rw_flags, GFP_NOIO, false);
+
+	init_request_from_bio(rq, bio);
+	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
+	    bio_flagged(bio, BIO_CPU_AFFINE))
+		rq->cpu = rq->mq_ctx->cpu;
+	drive_stat_acct(rq, 1);
+
+	if (unlikely(is_flush_fua)) {
+		blk_mq_insert_flush(rq);
+		return 0;
+	}
+
+	/*
+	 * A plugging task collects its requests and inserts them in one
+	 * go from blk_flush_plug_list().
+	 */
+	plug = current->plug;
+	if (plug) {
+		blk_add_request_to_plug(plug, rq);
+		if (unplug)
+			blk_flush_plug_list(plug, false);
+		return 0;
+	}
+
+	/*
+	 * Sync IO is sent to the driver right away.  Async IO is left for
+	 * kblockd, which gives following bios a chance to merge with it.
+	 */
+	blk_mq_insert_request(rq, false, true, !is_sync && !unplug);
+	return 0;
+}
+
+/*
+ * Spread the possible CPUs evenly over @nr_queues hardware queues, keeping
+ * hyperthread siblings on the same queue.
+ */
+static void blk_mq_update_queue_map(unsigned int *map, unsigned int nr_queues)
+{
+	unsigned int i, nr_cpus, index, first_sibling;
+
+	nr_cpus = num_possible_cpus();
+	index = 0;
+	for_each_possible_cpu(i) {
+		first_sibling = cpumask_first(topology_thread_cpumask(i));
+		if (first_sibling < i && cpu_possible(first_sibling) &&
+		    nr_queues < nr_cpus) {
+			map[i] = map[first_sibling];
+			continue;
+		}
+
+		map[i] = (index++ * nr_queues) / nr_cpus;
+	}
+}
+
+static int blk_mq_init_rq_map(struct blk_mq_hw_ctx *hctx,
+			      unsigned int reserved_tags, unsigned int cmd_size)
+{
+	unsigned int i;
+
+	hctx->tags = blk_mq_init_tags(hctx->queue_depth, reserved_tags,
+				      hctx->numa_node);
+	if (!hctx->tags)
+		return -ENOMEM;
+
+	hctx->rqs = kzalloc_node(hctx->queue_depth * sizeof(struct request *),
+				 GFP_KERNEL, hctx->numa_node);
+	if (!hctx->rqs)
+		return -ENOMEM;
+
+	for (i = 0; i < hctx->queue_depth; i++) {
+		struct request *rq;
+
+		rq = kzalloc_node(sizeof(*rq) + cmd_size, GFP_KERNEL,
+				  hctx->numa_node);
+		if (!rq)
+			return -ENOMEM;
+
+		rq->q = hctx->queue;
+		rq->tag = i;
+		hctx->rqs[i] = rq;
+	}
+
+	return 0;
+}
+
+static void blk_mq_free_rq_map(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	if (hctx->rqs) {
+		for (i = 0; i < hctx->queue_depth; i++)
+			kfree(hctx->rqs[i]);
+		kfree(hctx->rqs);
+	}
+
+	if (hctx->tags)
+		blk_mq_free_tags(hctx->tags);
+}
+
+static struct blk_mq_hw_ctx *blk_mq_alloc_hctx(struct request_queue *q,
+					       struct blk_mq_reg *reg,
+					       unsigned int index)
+{
+	unsigned int flush_tags = blk_mq_flush_tags(reg->queue_depth);
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, reg->numa_node);
+	if (!hctx)
+		return NULL;
+
+	/* from here on blk_mq_free_queue() can clean up after us */
+	q->queue_hw_ctx[index] = hctx;
+
+	spin_lock_init(&hctx->lock);
+	INIT_LIST_HEAD(&hctx->dispatch);
+	INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+	setup_timer(&hctx->timeout, blk_mq_rq_timer, (unsigned long)hctx);
+	hctx->queue = q;
+	hctx->queue_num = index;
+	hctx->flags = reg->flags;
+	hctx->numa_node = reg->numa_node;
+	hctx->queue_depth = reg->queue_depth + flush_tags;
+
+	if (!zalloc_cpumask_var(&hctx->cpumask, GFP_KERNEL))
+		return NULL;
+
+	hctx->ctxs = kzalloc_node(nr_cpu_ids * sizeof(void *), GFP_KERNEL,
+				  reg->numa_node);
+	if (!hctx->ctxs)
+		return NULL;
+
+	hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) * sizeof(long),
+				     GFP_KERNEL, reg->numa_node);
+	if (!hctx->ctx_map)
+		return NULL;
+
+	if (blk_mq_init_rq_map(hctx, reg->reserved_tags + flush_tags,
+			       reg->cmd_size))
+		return NULL;
+
+	return hctx;
+}
+
+static void blk_mq_init_cpu_queues(struct request_queue *q)
+{
+	unsigned int i;
+
+	for_each_possible_cpu(i) {
+		struct blk_mq_ctx *__ctx = per_cpu_ptr(q->queue_ctx, i);
+		struct blk_mq_hw_ctx *hctx;
+
+		memset(__ctx, 0, sizeof(*__ctx));
+		__ctx->cpu = i;
+		spin_lock_init(&__ctx->lock);
+		INIT_LIST_HEAD(&__ctx->rq_list);
+		__ctx->queue = q;
+
+		/*
+		 * Every possible CPU gets a slot, online or not.  Requests
+		 * are always run right after they are staged, and a run
+		 * drains all the software queues of its hardware context,
+		 * so nothing gets stranded on a CPU that goes away.
+		 */
+		hctx = q->mq_ops->map_queue(q, i);
+		cpumask_set_cpu(i, hctx->cpumask);
+		__ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = __ctx;
+	}
+}
+
+/**
+ * blk_mq_init_queue - set up a multiqueue request queue
+ * @reg:	queue geometry and operations of the driver
+ * @driver_data: passed to ->init_hctx()
+ *
+ * Description:
+ *    Allocates a request queue whose bios are turned into requests on
+ *    per-cpu software queues, and handed to @reg->ops->queue_rq() on one
+ *    of @reg->nr_hw_queues hardware contexts.  Each context gets
+ *    @reg->queue_depth preallocated requests, each followed by
+ *    @reg->cmd_size bytes for the driver, see blk_mq_rq_to_pdu().
+ *
+ *    Returns %NULL on failure.  Like blk_init_queue(), must be paired with
+ *    a blk_cleanup_queue() call when the device goes away.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct request_queue *q;
+	unsigned int nr_hw_queues;
+	int i;
+
+	if (!reg->nr_hw_queues || !reg->ops->queue_rq ||
+	    !reg->ops->map_queue || !reg->queue_depth ||
+	    reg->queue_depth >= BLK_MQ_MAX_DEPTH ||
+	    reg->reserved_tags >= reg->queue_depth)
+		return NULL;
+
+	nr_hw_queues = min_t(unsigned int, reg->nr_hw_queues, nr_cpu_ids);
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	/*
+	 * Set these before anything can fail, blk_release_queue() keys
+	 * off q->mq_ops to free whatever was set up.
+	 */
+	q->mq_ops = reg->ops;
+	q->nr_queues = nr_cpu_ids;
+	q->nr_hw_queues = nr_hw_queues;
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->queue_hw_ctx = kzalloc_node(nr_hw_queues * sizeof(*q->queue_hw_ctx),
+				       GFP_KERNEL, reg->numa_node);
+	q->mq_map = kzalloc_node(nr_cpu_ids * sizeof(unsigned int),
+				 GFP_KERNEL, reg->numa_node);
+	if (!q->queue_ctx || !q->queue_hw_ctx || !q->mq_map)
+		goto err;
+
+	blk_mq_update_queue_map(q->mq_map, nr_hw_queues);
+
+	for (i = 0; i < nr_hw_queues; i++)
+		if (!blk_mq_alloc_hctx(q, reg, i))
+			goto err;
+
+	blk_mq_init_cpu_queues(q);
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->queue_flags |= QUEUE_FLAG_MQ_DEFAULT;
+	q->nr_requests = reg->queue_depth;
+	blk_queue_rq_timeout(q, reg->timeout ? reg->timeout :
+			     BLK_MQ_DEFAULT_TIMEOUT);
+	q->sg_reserved_size = INT_MAX;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!reg->ops->init_hctx)
+			break;
+		if (reg->ops->init_hctx(hctx, driver_data, i)) {
+			while (--i >= 0)
+				if (reg->ops->exit_hctx)
+					reg->ops->exit_hctx(q->queue_hw_ctx[i],
+							    i);
+			goto err;
+		}
+	}
+
+	return q;
+
+err:
+	/*
+	 * The driver's init_hctx either never ran or has been unwound.
+	 * Free everything here and turn this back into a plain queue, so
+	 * that blk_cleanup_queue() doesn't try again.
+	 */
+	blk_mq_free_queue(q);
+	q->mq_ops = NULL;
+	q->nr_hw_queues = 0;
+	blk_cleanup_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called from blk_cleanup_queue(), while the driver is still around to
+ * tear down its per-context state.
+ */
+void blk_mq_exit_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		del_timer_sync(&hctx->timeout);
+		cancel_work_sync(&hctx->run_work);
+
+		if (q->mq_ops->exit_hctx)
+			q->mq_ops->exit_hctx(hctx, i);
+	}
+}
+
+/*
+ * Called when the last reference to the queue is dropped, also copes
+ * with a partially set up queue.
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	for (i = 0; q->queue_hw_ctx && i < q->nr_hw_queues; i++) {
+		hctx = q->queue_hw_ctx[i];
+		if (!hctx)
+			break;
+
+		del_timer_sync(&hctx->timeout);
+		cancel_work_sync(&hctx->run_work);
+		blk_mq_free_rq_map(hctx);
+		kfree(hctx->ctx_map);
+		kfree(hctx->ctxs);
+		free_cpumask_var(hctx->cpumask);
+		kfree(hctx);
+		q->queue_hw_ctx[i] = NULL;
+	}
+
+	kfree(q->queue_hw_ctx);
+	q->queue_hw_ctx = NULL;
+	kfree(q->mq_map);
+	q->mq_map = NULL;
+	free_percpu(q->queue_ctx);
+	q->queue_ctx = NULL;
+}
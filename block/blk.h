@@ -16,6 +16,14 @@ void blk_rq_bio_prep(struct request_queue *q, struct request *rq,
 int blk_rq_append_bio(struct request_queue *q, struct request *rq,
 		      struct bio *bio);
 void blk_dequeue_request(struct request *rq);
+void drive_stat_acct(struct request *rq, int new_io);
+void blk_account_io_done(struct request *req);
+bool bio_attempt_back_merge(struct request_queue *q, struct request *req,
+			    struct bio *bio);
+bool bio_attempt_front_merge(struct request_queue *q, struct request *req,
+			     struct bio *bio);
+bool blk_attempt_plug_merge(struct request_queue *q, struct bio *bio);
+void blk_add_request_to_plug(struct blk_plug *plug, struct request *rq);
 void __blk_queue_free_tags(struct request_queue *q);
 
 void blk_unplug_work(struct work_struct *work);
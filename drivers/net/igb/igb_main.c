@@ -3062,6 +3062,8 @@ static void igb_clean_tx_ring(struct igb_ring *tx_ring)
 		igb_unmap_and_free_tx_resource(tx_ring, buffer_info);
 	}
 
+	netdev_tx_reset_queue(txring_txq(tx_ring));
+
 	size = sizeof(struct igb_buffer) * tx_ring->count;
 	memset(tx_ring->buffer_info, 0, size);
 
@@ -4208,6 +4210,8 @@ netdev_tx_t igb_xmit_frame_ring_adv(struct sk_buff *skb,
 		return NETDEV_TX_OK;
 	}
 
+	netdev_tx_sent_queue(txring_txq(tx_ring), skb->len);
+
 	igb_tx_queue_adv(tx_ring, tx_flags, count, skb->len, hdr_len);
 
 	/* Make sure there is space in the ring for the next send. */
@@ -5447,6 +5451,7 @@ static bool igb_clean_tx_irq(struct igb_q_vector *q_vector)
 	struct igb_buffer *buffer_info;
 	union e1000_adv_tx_desc *tx_desc, *eop_desc;
 	unsigned int total_bytes = 0, total_packets = 0;
+	unsigned int bytes_compl = 0, pkts_compl = 0;
 	unsigned int i, eop, count = 0;
 	bool cleaned = false;
 
@@ -5466,6 +5471,8 @@ static bool igb_clean_tx_irq(struct igb_q_vector *q_vector)
 				total_bytes += buffer_info->bytecount;
 				/* gso_segs is currently only valid for tcp */
 				total_packets += buffer_info->gso_segs;
+				bytes_compl += buffer_info->skb->len;
+				pkts_compl++;
 				igb_tx_hwtstamp(q_vector, buffer_info);
 			}
 
@@ -5482,6 +5489,8 @@ static bool igb_clean_tx_irq(struct igb_q_vector *q_vector)
 
 	tx_ring->next_to_clean = i;
 
+	netdev_tx_completed_queue(txring_txq(tx_ring), pkts_compl, bytes_compl);
+
 	if (unlikely(count &&
 		     netif_carrier_ok(netdev) &&
 		     igb_desc_unused(tx_ring) >= IGB_TX_QUEUE_WAKE)) {
@@ -824,6 +824,7 @@ static bool ixgbe_clean_tx_irq(struct ixgbe_q_vector *q_vector,
 	union ixgbe_adv_tx_desc *tx_desc, *eop_desc;
 	struct ixgbe_tx_buffer *tx_buffer_info;
 	unsigned int total_bytes = 0, total_packets = 0;
+	unsigned int bytes_compl = 0, pkts_compl = 0;
 	u16 i, eop, count = 0;
 
 	i = tx_ring->next_to_clean;
@@ -850,6 +851,11 @@ static bool ixgbe_clean_tx_irq(struct ixgbe_q_vector *q_vector,
 				total_packets += tx_buffer_info->gso_segs;
 			}
 
+			if (tx_buffer_info->skb) {
+				bytes_compl += tx_buffer_info->skb->len;
+				pkts_compl++;
+			}
+
 			ixgbe_unmap_and_free_tx_resource(tx_ring,
 							 tx_buffer_info);
 		}
@@ -860,6 +866,7 @@ static bool ixgbe_clean_tx_irq(struct ixgbe_q_vector *q_vector,
 	}
 
 	tx_ring->next_to_clean = i;
+	netdev_tx_completed_queue(txring_txq(tx_ring), pkts_compl, bytes_compl);
 	tx_ring->total_bytes += total_bytes;
 	tx_ring->total_packets += total_packets;
 	u64_stats_update_begin(&tx_ring->syncp);
@@ -4037,6 +4044,8 @@ static void ixgbe_clean_tx_ring(struct ixgbe_ring *tx_ring)
 		ixgbe_unmap_and_free_tx_resource(tx_ring, tx_buffer_info);
 	}
 
+	netdev_tx_reset_queue(txring_txq(tx_ring));
+
 	size = sizeof(struct ixgbe_tx_buffer) * tx_ring->count;
 	memset(tx_ring->tx_buffer_info, 0, size);
 
@@ -6769,6 +6778,7 @@ netdev_tx_t ixgbe_xmit_frame_ring(struct sk_buff *skb,
 		/* add the ATR filter if ATR is on */
 		if (test_bit(__IXGBE_TX_FDIR_INIT_DONE, &tx_ring->state))
 			ixgbe_atr(tx_ring, skb, tx_flags, protocol);
+		netdev_tx_sent_queue(txring_txq(tx_ring), skb->len);
 		ixgbe_tx_queue(tx_ring, tx_flags, count, skb->len, hdr_len);
 		ixgbe_maybe_stop_tx(tx_ring, DESC_NEEDED);
 
@@ -27,6 +27,7 @@
 #include <linux/backing-dev.h>
 #include <linux/buffer_head.h>
 #include <linux/tracepoint.h>
+#include <linux/memcontrol.h>
 #include "internal.h"
 
 /*
@@ -39,6 +40,7 @@ struct wb_writeback_work {
 	unsigned int for_kupdate:1;
 	unsigned int range_cyclic:1;
 	unsigned int for_background:1;
+	unsigned short memcg_id;	/* background writeback for a memcg */
 
 	struct list_head list;		/* pending work list */
 	struct completion *done;	/* set if the caller waits */
@@ -175,6 +177,46 @@ void bdi_start_background_writeback(struct backing_dev_info *bdi)
 	spin_unlock_bh(&bdi->wb_lock);
 }
 
+/**
+ * bdi_start_memcg_writeback - start background writeback for a memcg
+ * @bdi: the backing device to write from
+ * @memcg_id: css_id of the memory cgroup over its background threshold
+ *
+ * Description:
+ *   Queue WB_SYNC_NONE background writeback of the inodes dirtied by the
+ *   memory cgroup @memcg_id, which goes on until that cgroup is back under
+ *   its own background threshold.  Nothing is queued if such work is
+ *   already pending for the cgroup.
+ */
+void bdi_start_memcg_writeback(struct backing_dev_info *bdi,
+			       unsigned short memcg_id)
+{
+	struct wb_writeback_work *work;
+
+	spin_lock_bh(&bdi->wb_lock);
+	list_for_each_entry(work, &bdi->work_list, list) {
+		if (work->for_background && work->memcg_id == memcg_id) {
+			spin_unlock_bh(&bdi->wb_lock);
+			return;
+		}
+	}
+	spin_unlock_bh(&bdi->wb_lock);
+
+	work = kzalloc(sizeof(*work), GFP_NOWAIT);
+	if (!work) {
+		bdi_start_background_writeback(bdi);
+		return;
+	}
+
+	work->sync_mode	= WB_SYNC_NONE;
+	work->nr_pages	= LONG_MAX;
+	work->range_cyclic = 1;
+	work->for_background = 1;
+	work->memcg_id = memcg_id;
+
+	bdi_queue_work(bdi, work);
+}
+
 /*
  * Redirty an inode: set its when-it-was dirtied timestamp and move it to the
  * furthest end of its superblock's dirty-inode list.
@@ -198,6 +240,18 @@ static void redirty_tail(struct inode *inode)
 	list_move(&inode->i_wb_list, &wb->b_dirty);
 }
 
+/*
+ * Put an inode that a memcg writeback pass does not care for back at the
+ * old end of b_dirty.  Its dirtied_when is left alone, so the pass does not
+ * postpone the kupdate writeback of other cgroups' inodes.
+ */
+static void requeue_dirty(struct inode *inode)
+{
+	struct bdi_writeback *wb = &inode_to_bdi(inode)->wb;
+
+	list_move_tail(&inode->i_wb_list, &wb->b_dirty);
+}
+
 /*
  * requeue inode for re-scanning after bdi->b_io list is exhausted.
  */
@@ -234,10 +288,13 @@ static bool inode_dirtied_after(struct inode *inode, unsigned long t)
 
 /*
  * Move expired dirty inodes from @delaying_queue to @dispatch_queue.
+ * If @memcg_id is set, only the inodes that memory cgroup dirtied are
+ * moved, the others stay where they are.
  */
 static void move_expired_inodes(struct list_head *delaying_queue,
 			       struct list_head *dispatch_queue,
-				unsigned long *older_than_this)
+				unsigned long *older_than_this,
+				unsigned short memcg_id)
 {
 	LIST_HEAD(tmp);
 	struct list_head *pos, *node;
@@ -245,11 +302,16 @@ static void move_expired_inodes(struct list_head *delaying_queue,
 	struct inode *inode;
 	int do_sb_sort = 0;
 
-	while (!list_empty(delaying_queue)) {
-		inode = wb_inode(delaying_queue->prev);
+	for (pos = delaying_queue->prev; pos != delaying_queue; pos = node) {
+		node = pos->prev;
+		inode = wb_inode(pos);
 		if (older_than_this &&
 		    inode_dirtied_after(inode, *older_than_this))
 			break;
+		if (memcg_id &&
+		    !mem_cgroup_should_writeback_mapping(inode->i_mapping,
+							 memcg_id))
+			continue;
 		if (sb && sb != inode->i_sb)
 			do_sb_sort = 1;
 		sb = inode->i_sb;
@@ -284,10 +346,12 @@ static void move_expired_inodes(struct list_head *delaying_queue,
  *                                           |
  *                                           +--> dequeue for IO
  */
-static void queue_io(struct bdi_writeback *wb, unsigned long *older_than_this)
+static void queue_io(struct bdi_writeback *wb, unsigned long *older_than_this,
+		     unsigned short memcg_id)
 {
 	list_splice_init(&wb->b_more_io, &wb->b_io);
-	move_expired_inodes(&wb->b_dirty, &wb->b_io, older_than_this);
+	move_expired_inodes(&wb->b_dirty, &wb->b_io, older_than_this,
+			    memcg_id);
 }
 
 static int write_inode(struct inode *inode, struct writeback_control *wbc)
@@ -433,6 +497,7 @@ writeback_single_inode(struct inode *inode, struct writeback_control *wbc)
 			 * No need to add it back to the LRU.
 			 */
 			list_del_init(&inode->i_wb_list);
+			mem_cgroup_clear_inode_dirty(mapping);
 		}
 	}
 	inode_sync_complete(inode);
@@ -511,6 +576,17 @@ static int writeback_sb_inodes(struct super_block *sb, struct bdi_writeback *wb,
 			continue;
 		}
 
+		/*
+		 * Writeback on behalf of a memory cgroup only cares for the
+		 * inodes that cgroup dirtied.  queue_io() leaves the others
+		 * on b_dirty, but earlier passes may have queued some.
+		 */
+		if (!mem_cgroup_should_writeback_mapping(inode->i_mapping,
+							 wbc->memcg_id)) {
+			requeue_dirty(inode);
+			continue;
+		}
+
 		/*
 		 * Was this inode dirtied after sync_sb_inodes was called?
 		 * This keeps sync from extra jobs and livelock.
@@ -552,7 +628,7 @@ void writeback_inodes_wb(struct bdi_writeback *wb,
 		wbc->wb_start = jiffies; /* livelock avoidance */
 	spin_lock(&inode_lock);
 	if (!wbc->for_kupdate || list_empty(&wb->b_io))
-		queue_io(wb, wbc->older_than_this);
+		queue_io(wb, wbc->older_than_this, wbc->memcg_id);
 
 	while (!list_empty(&wb->b_io)) {
 		struct inode *inode = wb_inode(wb->b_io.prev);
@@ -579,7 +655,7 @@ static void __writeback_inodes_sb(struct super_block *sb,
 
 	spin_lock(&inode_lock);
 	if (!wbc->for_kupdate || list_empty(&wb->b_io))
-		queue_io(wb, wbc->older_than_this);
+		queue_io(wb, wbc->older_than_this, wbc->memcg_id);
 	writeback_sb_inodes(sb, wb, wbc, true);
 	spin_unlock(&inode_lock);
 }
@@ -593,10 +669,13 @@ static void __writeback_inodes_sb(struct super_block *sb,
  */
 #define MAX_WRITEBACK_PAGES     1024
 
-static inline bool over_bground_thresh(void)
+static inline bool over_bground_thresh(unsigned short memcg_id)
 {
 	unsigned long background_thresh, dirty_thresh;
 
+	if (memcg_id)
+		return mem_cgroup_over_bground_thresh(memcg_id);
+
 	global_dirty_limits(&background_thresh, &dirty_thresh);
 
 	return (global_page_state(NR_FILE_DIRTY) +
@@ -627,6 +706,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 		.for_kupdate		= work->for_kupdate,
 		.for_background		= work->for_background,
 		.range_cyclic		= work->range_cyclic,
+		.memcg_id		= work->memcg_id,
 	};
 	unsigned long oldest_jif;
 	long wrote = 0;
@@ -683,7 +763,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 		 * For background writeout, stop when we are below the
 		 * background dirty threshold
 		 */
-		if (work->for_background && !over_bground_thresh())
+		if (work->for_background && !over_bground_thresh(work->memcg_id))
 			break;
 
 		wbc.more_io = 0;
@@ -700,6 +780,8 @@ static long wb_writeback(struct bdi_writeback *wb,
 		work->nr_pages -= write_chunk - wbc.nr_to_write;
 		wrote += write_chunk - wbc.nr_to_write;
 
+		bdi_update_bandwidth(wb->bdi, 0, 0, 0, 0, 0, wbc.wb_start);
+
 		/*
 		 * If we consumed everything, see if we have more
 		 */
@@ -763,7 +845,7 @@ static unsigned long get_nr_dirty_pages(void)
 
 static long wb_check_background_flush(struct bdi_writeback *wb)
 {
-	if (over_bground_thresh()) {
+	if (over_bground_thresh(0)) {
 
 		struct wb_writeback_work work = {
 			.nr_pages	= LONG_MAX,
@@ -333,6 +333,34 @@ struct mem_size_stats {
 	u64 pss;
 };
 
+static void smaps_account(struct mem_size_stats *mss, struct page *page,
+			  bool young, bool dirty)
+{
+	int mapcount;
+
+	if (PageAnon(page))
+		mss->anonymous += PAGE_SIZE;
+
+	mss->resident += PAGE_SIZE;
+	/* Accumulate the size in pages that have been accessed. */
+	if (young || PageReferenced(page))
+		mss->referenced += PAGE_SIZE;
+	mapcount = page_mapcount(page);
+	if (mapcount >= 2) {
+		if (dirty || PageDirty(page))
+			mss->shared_dirty += PAGE_SIZE;
+		else
+			mss->shared_clean += PAGE_SIZE;
+		mss->pss += (PAGE_SIZE << PSS_SHIFT) / mapcount;
+	} else {
+		if (dirty || PageDirty(page))
+			mss->private_dirty += PAGE_SIZE;
+		else
+			mss->private_clean += PAGE_SIZE;
+		mss->pss += (PAGE_SIZE << PSS_SHIFT);
+	}
+}
+
 static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 			   struct mm_walk *walk)
 {
@@ -341,7 +369,27 @@ static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 	pte_t *pte, ptent;
 	spinlock_t *ptl;
 	struct page *page;
-	int mapcount;
+
+	if (pmd_trans_huge(*pmd)) {
+		if (vma_is_huge_file(vma)) {
+			/* a page cache extent: account its pages as mapped */
+			spin_lock(&walk->mm->page_table_lock);
+			if (pmd_trans_huge(*pmd)) {
+				page = pmd_page(*pmd) +
+				       ((addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT);
+				for (; addr != end; addr += PAGE_SIZE, page++)
+					smaps_account(mss, page,
+						      pmd_young(*pmd),
+						      pmd_dirty(*pmd));
+				spin_unlock(&walk->mm->page_table_lock);
+				return 0;
+			}
+			spin_unlock(&walk->mm->page_table_lock);
+		} else
+			split_huge_page_pmd(walk->mm, addr, pmd);
+	}
+	if (pmd_none_or_clear_bad(pmd))
+		return 0;
 
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; pte++, addr += PAGE_SIZE) {
@@ -359,27 +407,7 @@ static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 		if (!page)
 			continue;
 
-		if (PageAnon(page))
-			mss->anonymous += PAGE_SIZE;
-
-		mss->resident += PAGE_SIZE;
-		/* Accumulate the size in pages that have been accessed. */
-		if (pte_young(ptent) || PageReferenced(page))
-			mss->referenced += PAGE_SIZE;
-		mapcount = page_mapcount(page);
-		if (mapcount >= 2) {
-			if (pte_dirty(ptent) || PageDirty(page))
-				mss->shared_dirty += PAGE_SIZE;
-			else
-				mss->shared_clean += PAGE_SIZE;
-			mss->pss += (PAGE_SIZE << PSS_SHIFT) / mapcount;
-		} else {
-			if (pte_dirty(ptent) || PageDirty(page))
-				mss->private_dirty += PAGE_SIZE;
-			else
-				mss->private_clean += PAGE_SIZE;
-			mss->pss += (PAGE_SIZE << PSS_SHIFT);
-		}
+		smaps_account(mss, page, pte_young(ptent), pte_dirty(ptent));
 	}
 	pte_unmap_unlock(pte - 1, ptl);
 	cond_resched();
@@ -467,6 +495,26 @@ static int clear_refs_pte_range(pmd_t *pmd, unsigned long addr,
 	spinlock_t *ptl;
 	struct page *page;
 
+	if (pmd_trans_huge(*pmd)) {
+		if (vma_is_huge_file(vma)) {
+			spin_lock(&walk->mm->page_table_lock);
+			if (pmd_trans_huge(*pmd)) {
+				pmdp_test_and_clear_young(vma,
+						addr & HPAGE_PMD_MASK, pmd);
+				page = pmd_page(*pmd) +
+				       ((addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT);
+				for (; addr != end; addr += PAGE_SIZE, page++)
+					ClearPageReferenced(page);
+				spin_unlock(&walk->mm->page_table_lock);
+				return 0;
+			}
+			spin_unlock(&walk->mm->page_table_lock);
+		} else
+			split_huge_page_pmd(walk->mm, addr, pmd);
+	}
+	if (pmd_none_or_clear_bad(pmd))
+		return 0;
+
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; pte++, addr += PAGE_SIZE) {
 		ptent = *pte;
@@ -625,6 +673,32 @@ static int pagemap_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 
 	/* find the first VMA at or above 'addr' */
 	vma = find_vma(walk->mm, addr);
+
+	if (pmd_trans_huge(*pmd)) {
+		if (vma && vma_is_huge_file(vma)) {
+			/* a page cache extent: report its small pages */
+			spin_lock(&walk->mm->page_table_lock);
+			if (pmd_trans_huge(*pmd)) {
+				unsigned long pfn = page_to_pfn(pmd_page(*pmd)) +
+					((addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT);
+
+				for (; addr != end; addr += PAGE_SIZE, pfn++) {
+					err = add_to_pagemap(addr, PM_PFRAME(pfn)
+						| PM_PSHIFT(PAGE_SHIFT)
+						| PM_PRESENT, pm);
+					if (err)
+						break;
+				}
+				spin_unlock(&walk->mm->page_table_lock);
+				return err;
+			}
+			spin_unlock(&walk->mm->page_table_lock);
+		} else
+			split_huge_page_pmd(walk->mm, addr, pmd);
+	}
+	if (pmd_none_or_clear_bad(pmd))
+		return pagemap_pte_hole(addr, end, walk);
+
 	for (; addr != end; addr += PAGE_SIZE) {
 		u64 pfn = PM_NOT_PRESENT;
 
@@ -16,9 +16,13 @@ extern struct page *follow_trans_huge_pmd(struct mm_struct *mm,
 					  unsigned long addr,
 					  pmd_t *pmd,
 					  unsigned int flags);
+extern int do_huge_pmd_file_page(struct mm_struct *mm,
+				 struct vm_area_struct *vma,
+				 unsigned long haddr, pmd_t *pmd,
+				 unsigned int flags);
 extern int zap_huge_pmd(struct mmu_gather *tlb,
 			struct vm_area_struct *vma,
-			pmd_t *pmd);
+			pmd_t *pmd, unsigned long addr);
 extern int mincore_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
 			unsigned long addr, unsigned long end,
 			unsigned char *vec);
@@ -82,13 +86,24 @@ extern int handle_pte_fault(struct mm_struct *mm,
 			    struct vm_area_struct *vma, unsigned long address,
 			    pte_t *pte, pmd_t *pmd, unsigned int flags);
 extern int split_huge_page(struct page *page);
-extern void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd);
-#define split_huge_page_pmd(__mm, __pmd)				\
+extern void __split_huge_page_pmd(struct mm_struct *mm,
+				  unsigned long address, pmd_t *pmd);
+extern void __unmap_huge_file_pmd(struct vm_area_struct *vma,
+				  unsigned long haddr, pmd_t *pmd);
+#define split_huge_page_pmd(__mm, __address, __pmd)			\
 	do {								\
 		pmd_t *____pmd = (__pmd);				\
 		if (unlikely(pmd_trans_huge(*____pmd)))			\
-			__split_huge_page_pmd(__mm, ____pmd);		\
+			__split_huge_page_pmd(__mm, __address, ____pmd); \
 	}  while (0)
+/*
+ * Shared file mappings whose ->pmd_fault may map page cache extents with
+ * huge pmds.  Such a pmd maps small pages, not a compound page, so it is
+ * "split" by unmapping it: the range is faulted back in with ptes.
+ */
+#define vma_is_huge_file(__vma)						\
+	((__vma)->vm_ops && (__vma)->vm_ops->pmd_fault &&		\
+	 !((__vma)->vm_flags & VM_HUGETLB))
 #define wait_split_huge_page(__anon_vma, __pmd)				\
 	do {								\
 		pmd_t *____pmd = (__pmd);				\
@@ -117,7 +132,8 @@ static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
 					 unsigned long end,
 					 long adjust_next)
 {
-	if (!vma->anon_vma || vma->vm_ops || vma->vm_file)
+	if (!vma_is_huge_file(vma) &&
+	    (!vma->anon_vma || vma->vm_ops || vma->vm_file))
 		return;
 	__vma_adjust_trans_huge(vma, start, end, adjust_next);
 }
@@ -158,8 +174,9 @@ static inline int split_huge_page(struct page *page)
 {
 	return 0;
 }
-#define split_huge_page_pmd(__mm, __pmd)	\
+#define split_huge_page_pmd(__mm, __address, __pmd)	\
 	do { } while (0)
+#define vma_is_huge_file(__vma) 0
 #define wait_split_huge_page(__anon_vma, __pmd)	\
 	do { } while (0)
 #define compound_trans_head(page) compound_head(page)
@@ -46,6 +46,19 @@ static inline int khugepaged_enter(struct vm_area_struct *vma)
 				return -ENOMEM;
 	return 0;
 }
+
+/*
+ * Shared shmem vmas cannot be madvised: they are registered for
+ * collapsing according to the huge= policy of their mount instead.
+ */
+static inline int khugepaged_enter_file(struct vm_area_struct *vma)
+{
+	if (!test_bit(MMF_VM_HUGEPAGE, &vma->vm_mm->flags) &&
+	    khugepaged_enabled())
+		if (__khugepaged_enter(vma->vm_mm))
+			return -ENOMEM;
+	return 0;
+}
 #else /* CONFIG_TRANSPARENT_HUGEPAGE */
 static inline int khugepaged_fork(struct mm_struct *mm, struct mm_struct *oldmm)
 {
@@ -62,6 +75,10 @@ static inline int khugepaged_enter_vma_merge(struct vm_area_struct *vma)
 {
 	return 0;
 }
+static inline int khugepaged_enter_file(struct vm_area_struct *vma)
+{
+	return 0;
+}
 #endif /* CONFIG_TRANSPARENT_HUGEPAGE */
 
 #endif /* _LINUX_KHUGEPAGED_H */
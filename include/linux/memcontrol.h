@@ -24,12 +24,36 @@ struct mem_cgroup;
 struct page_cgroup;
 struct page;
 struct mm_struct;
+struct address_space;
 
 /* Stats that can be updated by kernel. */
 enum mem_cgroup_page_stat_item {
 	MEMCG_NR_FILE_MAPPED, /* # of pages charged as file rss */
+	MEMCG_NR_FILE_DIRTY, /* # of dirty pages in page cache */
+	MEMCG_NR_FILE_WRITEBACK, /* # of pages under writeback */
+	MEMCG_NR_FILE_UNSTABLE_NFS, /* # of NFS unstable pages */
 };
 
+/*
+ * Dirty page state and limits of the current task's memory cgroup, all in
+ * pages.  Filled in by mem_cgroup_dirty_info() for balance_dirty_pages().
+ */
+struct mem_cgroup_dirty_info {
+	unsigned long dirty_thresh;
+	unsigned long background_thresh;
+	unsigned long nr_file_dirty;
+	unsigned long nr_writeback;
+	unsigned long nr_unstable_nfs;
+	unsigned short memcg_id;	/* css_id, for targeted writeback */
+};
+
+/*
+ * address_space->i_memcg records which memory cgroup dirtied an inode, so
+ * that the flusher can write back on behalf of a single cgroup.  Zero means
+ * unknown, I_MEMCG_SHARED means that more than one cgroup dirtied it.
+ */
+#define I_MEMCG_SHARED	((unsigned short)~0)
+
 extern unsigned long mem_cgroup_isolate_pages(unsigned long nr_to_scan,
 					struct list_head *dst,
 					unsigned long *scanned, int order,
@@ -82,6 +106,9 @@ int task_in_mem_cgroup(struct task_struct *task, const struct mem_cgroup *mem);
 extern struct mem_cgroup *try_get_mem_cgroup_from_page(struct page *page);
 extern struct mem_cgroup *mem_cgroup_from_task(struct task_struct *p);
 
+extern struct mem_cgroup *parent_mem_cgroup(struct mem_cgroup *mem);
+extern struct mem_cgroup *mem_cgroup_from_css(struct cgroup_subsys_state *css);
+
 static inline
 int mm_match_cgroup(const struct mm_struct *mm, const struct mem_cgroup *cgroup)
 {
@@ -142,6 +169,14 @@ static inline void mem_cgroup_dec_page_stat(struct page *page,
 	mem_cgroup_update_page_stat(page, idx, -1);
 }
 
+bool mem_cgroup_dirty_info(struct mem_cgroup_dirty_info *info);
+bool mem_cgroup_over_bground_thresh(unsigned short memcg_id);
+void mem_cgroup_mark_inode_dirty(struct address_space *mapping,
+				 struct page *page);
+void mem_cgroup_clear_inode_dirty(struct address_space *mapping);
+bool mem_cgroup_should_writeback_mapping(struct address_space *mapping,
+					 unsigned short memcg_id);
+
 unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 						gfp_t gfp_mask);
 u64 mem_cgroup_get_limit(struct mem_cgroup *mem);
@@ -326,6 +361,32 @@ static inline void mem_cgroup_dec_page_stat(struct page *page,
 {
 }
 
+static inline bool mem_cgroup_dirty_info(struct mem_cgroup_dirty_info *info)
+{
+	return false;
+}
+
+static inline bool mem_cgroup_over_bground_thresh(unsigned short memcg_id)
+{
+	return false;
+}
+
+static inline void mem_cgroup_mark_inode_dirty(struct address_space *mapping,
+					       struct page *page)
+{
+}
+
+static inline void mem_cgroup_clear_inode_dirty(struct address_space *mapping)
+{
+}
+
+static inline bool
+mem_cgroup_should_writeback_mapping(struct address_space *mapping,
+				    unsigned short memcg_id)
+{
+	return true;
+}
+
 static inline
 unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 					    gfp_t gfp_mask)
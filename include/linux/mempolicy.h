@@ -250,6 +250,12 @@ static inline int vma_migratable(struct vm_area_struct *vma)
 	return 1;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+extern int mpol_misplaced(struct page *page, struct vm_area_struct *vma,
+			  unsigned long addr);
+extern int migrate_misplaced_page(struct page *page, int node);
+#endif
+
 #else
 
 struct mempolicy {};
@@ -203,6 +203,14 @@ struct vm_operations_struct {
 	void (*close)(struct vm_area_struct * area);
 	int (*fault)(struct vm_area_struct *vma, struct vm_fault *vmf);
 
+	/*
+	 * Called when a fault hits an empty pmd: may map the whole hugepage
+	 * aligned range with a single huge pmd, or return VM_FAULT_FALLBACK
+	 * to have the fault handled with ptes through ->fault.
+	 */
+	int (*pmd_fault)(struct vm_area_struct *vma, unsigned long address,
+			 pmd_t *pmd, unsigned int flags);
+
 	/* notification that a previously read-only page is about to become
 	 * writable, if an error is returned it will cause a SIGBUS */
 	int (*page_mkwrite)(struct vm_area_struct *vma, struct vm_fault *vmf);
@@ -844,6 +852,7 @@ static inline int page_mapped(struct page *page)
 #define VM_FAULT_NOPAGE	0x0100	/* ->fault installed the pte, not return page */
 #define VM_FAULT_LOCKED	0x0200	/* ->fault locked the returned page */
 #define VM_FAULT_RETRY	0x0400	/* ->fault blocked, must retry */
+#define VM_FAULT_FALLBACK 0x0800	/* ->pmd_fault: use small pages instead */
 
 #define VM_FAULT_HWPOISON_LARGE_MASK 0xf000 /* encodes hpage index for large hwpoison */
 
@@ -907,7 +916,8 @@ unsigned long unmap_vmas(struct mmu_gather **tlb,
  * mm_walk - callbacks for walk_page_range
  * @pgd_entry: if set, called for each non-empty PGD (top-level) entry
  * @pud_entry: if set, called for each non-empty PUD (2nd-level) entry
- * @pmd_entry: if set, called for each non-empty PMD (3rd-level) entry
+ * @pmd_entry: if set, called for each non-empty PMD (3rd-level) entry,
+ *	       including huge pmds: the callback handles or splits them
  * @pte_entry: if set, called for each non-empty PTE (4th-level) entry
  * @pte_hole: if set, called for each hole at all levels
  * @hugetlb_entry: if set, called for each hugetlb entry
@@ -971,6 +981,64 @@ static inline int handle_mm_fault(struct mm_struct *mm,
 }
 #endif
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+extern int handle_speculative_fault(struct mm_struct *mm,
+			unsigned long address, unsigned int flags);
+
+/*
+ * Changes to the fields of a vma that the speculative fault path relies on
+ * (bounds, vm_flags, vm_page_prot, vm_policy) are bracketed by these, with
+ * mmap_sem held for writing.
+ */
+static inline void vma_write_begin(struct vm_area_struct *vma)
+{
+	write_seqcount_begin(&vma->vm_sequence);
+}
+
+static inline void vma_write_end(struct vm_area_struct *vma)
+{
+	write_seqcount_end(&vma->vm_sequence);
+}
+
+/*
+ * Speculative faults are disabled on the whole mm while page tables are
+ * being moved from one vma to another by mremap().
+ */
+static inline void mm_spf_disable(struct mm_struct *mm)
+{
+	atomic_inc(&mm->spf_disable);
+	smp_mb__after_atomic_inc();
+}
+
+static inline void mm_spf_enable(struct mm_struct *mm)
+{
+	smp_mb__before_atomic_dec();
+	atomic_dec(&mm->spf_disable);
+}
+#else
+static inline int handle_speculative_fault(struct mm_struct *mm,
+			unsigned long address, unsigned int flags)
+{
+	return VM_FAULT_RETRY;
+}
+
+static inline void vma_write_begin(struct vm_area_struct *vma)
+{
+}
+
+static inline void vma_write_end(struct vm_area_struct *vma)
+{
+}
+
+static inline void mm_spf_disable(struct mm_struct *mm)
+{
+}
+
+static inline void mm_spf_enable(struct mm_struct *mm)
+{
+}
+#endif
+
 extern int make_pages_present(unsigned long addr, unsigned long end);
 extern int access_process_vm(struct task_struct *tsk, unsigned long addr, void *buf, int len, int write);
 
@@ -1521,6 +1589,33 @@ static inline pgprot_t vm_get_page_prot(unsigned long vm_flags)
 }
 #endif
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * NUMA hinting: a present pte of an accessible vma is given the protection
+ * of the vma with all access taken away, so that the next access faults.
+ */
+static inline pgprot_t vma_prot_none(struct vm_area_struct *vma)
+{
+	return vm_get_page_prot(vma->vm_flags &
+				~(VM_READ | VM_WRITE | VM_EXEC));
+}
+
+static inline int pte_numa(struct vm_area_struct *vma, pte_t pte)
+{
+	if (!(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+		return 0;
+	return pte_same(pte, pte_modify(pte, vma_prot_none(vma)));
+}
+
+extern unsigned long change_prot_numa(struct vm_area_struct *vma,
+			unsigned long start, unsigned long end);
+#else
+static inline int pte_numa(struct vm_area_struct *vma, pte_t pte)
+{
+	return 0;
+}
+#endif
+
 struct vm_area_struct *find_extend_vma(struct mm_struct *, unsigned long addr);
 int remap_pfn_range(struct vm_area_struct *, unsigned long addr,
 			unsigned long pfn, unsigned long size, pgprot_t);
@@ -106,6 +106,13 @@ enum zone_stat_item {
 	NR_SHMEM,		/* shmem pages (included tmpfs/GEM pages) */
 	NR_DIRTIED,		/* page dirtyings since bootup */
 	NR_WRITTEN,		/* page writings since bootup */
+	WORKINGSET_REFAULT,	/* evicted file pages faulted back in */
+	WORKINGSET_ACTIVATE,	/* refaulted pages activated immediately */
+	WORKINGSET_NODERECLAIM,	/* shadow-only radix tree nodes reclaimed */
+#ifdef CONFIG_COMPACTION
+	KCOMPACTD_SUCCESS,	/* kcompactd runs that freed a high order page */
+	KCOMPACTD_FAIL,		/* kcompactd runs that did not */
+#endif
 #ifdef CONFIG_NUMA
 	NUMA_HIT,		/* allocated in intended node */
 	NUMA_MISS,		/* allocated in non intended node */
@@ -339,6 +346,9 @@ struct zone {
 	 */
 	unsigned int		compact_considered;
 	unsigned int		compact_defer_shift;
+	/* The same for the proactive runs of kcompactd, kept apart */
+	unsigned int		kcompactd_considered;
+	unsigned int		kcompactd_defer_shift;
 #endif
 
 	ZONE_PADDING(_pad1_)
@@ -354,6 +364,9 @@ struct zone {
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	unsigned long		flags;		   /* zone flags, see below */
 
+	/* Evictions and activations, the clock of mm/workingset.c */
+	atomic_long_t		inactive_age;
+
 	/* Zone statistics */
 	atomic_long_t		vm_stat[NR_VM_ZONE_STAT_ITEMS];
 
@@ -641,6 +654,12 @@ typedef struct pglist_data {
 	struct task_struct *kswapd;
 	int kswapd_max_order;
 	enum zone_type classzone_idx;
+#ifdef CONFIG_COMPACTION
+	wait_queue_head_t kcompactd_wait;
+	struct task_struct *kcompactd;
+	int kcompactd_max_order;
+	enum zone_type kcompactd_classzone_idx;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
@@ -456,7 +456,11 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t index, gfp_t gfp_mask);
 extern void remove_from_page_cache(struct page *page);
-extern void __remove_from_page_cache(struct page *page);
+extern void __remove_from_page_cache(struct page *page, void *shadow);
+extern int page_cache_tree_insert(struct address_space *mapping,
+				  struct page *page, void **shadowp);
+extern void page_cache_tree_delete_shadow(struct address_space *mapping,
+					  pgoff_t index);
 
 /*
  * Like add_to_page_cache_locked, but used to add newly allocated pages:
@@ -35,6 +35,10 @@ extern void rcu_note_context_switch(int cpu);
 extern int rcu_needs_cpu(int cpu);
 extern void rcu_cpu_stall_reset(void);
 
+#ifdef CONFIG_NO_HZ_FULL
+extern int rcu_needs_tick(int cpu);
+#endif
+
 #ifdef CONFIG_TREE_PREEMPT_RCU
 
 extern void exit_rcu(void);
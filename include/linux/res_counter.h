@@ -202,6 +202,25 @@ static inline bool res_counter_check_margin(struct res_counter *cnt,
 	return ret;
 }
 
+/**
+ * res_counter_margin - calculate chargeable space of a counter
+ * @cnt: the counter
+ *
+ * Returns the difference between the hard limit and the current usage
+ * of resource counter @cnt, or zero if the usage is over the limit.
+ */
+static inline unsigned long long res_counter_margin(struct res_counter *cnt)
+{
+	unsigned long long margin = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cnt->lock, flags);
+	if (cnt->limit > cnt->usage)
+		margin = cnt->limit - cnt->usage;
+	spin_unlock_irqrestore(&cnt->lock, flags);
+	return margin;
+}
+
 static inline bool res_counter_check_under_soft_limit(struct res_counter *cnt)
 {
 	bool ret;
@@ -7,6 +7,7 @@
 #define _LINUX_TICK_H
 
 #include <linux/clockchips.h>
+#include <linux/cpumask.h>
 
 #ifdef CONFIG_GENERIC_CLOCKEVENTS
 
@@ -34,8 +35,12 @@ enum tick_nohz_mode {
  *			timer is modified for idle sleeps. This is necessary
  *			to resume the tick timer operation in the timeline
  *			when the CPU returns from idle
- * @tick_stopped:	Indicator that the idle tick has been stopped
- * @idle_jiffies:	jiffies at the entry to idle for idle time accounting
+ * @tick_stopped:	Indicator that the idle tick has been stopped, or on a
+ *			nohz_full cpu the tick of its single busy task
+ * @idle_jiffies:	jiffies at the entry to idle for idle time accounting,
+ *			or at the stop of the busy tick for its task's
+ *			time accounting
+ * @busy_user:		The busy tick was stopped from user mode
  * @idle_calls:		Total number of idle calls
  * @idle_sleeps:	Number of idle calls, where the sched tick was stopped
  * @idle_entrytime:	Time when the idle call was entered
@@ -67,6 +72,7 @@ struct tick_sched {
 	unsigned long			next_jiffies;
 	ktime_t				idle_expires;
 	int				do_timer_last;
+	int				busy_user;
 };
 
 extern void __init tick_init(void);
@@ -139,4 +145,35 @@ static inline u64 get_cpu_idle_time_us(int cpu, u64 *unused) { return -1; }
 static inline u64 get_cpu_iowait_time_us(int cpu, u64 *unused) { return -1; }
 # endif /* !NO_HZ */
 
+struct task_struct;
+
+# ifdef CONFIG_NO_HZ_FULL
+extern cpumask_var_t tick_nohz_full_mask;
+extern bool tick_nohz_full_running;
+
+static inline bool tick_nohz_full_enabled(void)
+{
+	return tick_nohz_full_running;
+}
+
+static inline bool tick_nohz_full_cpu(int cpu)
+{
+	if (!tick_nohz_full_running)
+		return false;
+	return cpumask_test_cpu(cpu, tick_nohz_full_mask);
+}
+
+extern void tick_nohz_full_check(void);
+extern void tick_nohz_full_kick_cpu(int cpu);
+extern void tick_nohz_full_kick_all(void);
+extern void tick_nohz_task_switch(struct task_struct *prev);
+# else
+static inline bool tick_nohz_full_enabled(void) { return false; }
+static inline bool tick_nohz_full_cpu(int cpu) { return false; }
+static inline void tick_nohz_full_check(void) { }
+static inline void tick_nohz_full_kick_cpu(int cpu) { }
+static inline void tick_nohz_full_kick_all(void) { }
+static inline void tick_nohz_task_switch(struct task_struct *prev) { }
+# endif /* !NO_HZ_FULL */
+
 #endif
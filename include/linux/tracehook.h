@@ -593,6 +593,8 @@ static inline void set_notify_resume(struct task_struct *task)
  */
 static inline void tracehook_notify_resume(struct pt_regs *regs)
 {
+	/* task_tick_numa() may have asked for a NUMA scan of the mm */
+	task_numa_work(current);
 }
 #endif	/* TIF_NOTIFY_RESUME */
 
@@ -0,0 +1,47 @@
+#ifndef _LINUX_ZSWAP_H
+#define _LINUX_ZSWAP_H
+/*
+ * zswap: compressed cache for swap pages.
+ *
+ * Anonymous pages being swapped out are compressed into a dynamically
+ * sized in-memory pool instead of being written to the swap device;
+ * swap-in is then served by decompressing from the pool.  When the pool
+ * reaches its size limit, the oldest entries are written back to the
+ * real swap device.
+ */
+
+#include <linux/types.h>
+
+struct page;
+
+#ifdef CONFIG_ZSWAP
+extern int zswap_store(struct page *page);
+extern int zswap_load(struct page *page);
+extern void zswap_invalidate_page(unsigned type, pgoff_t offset);
+extern void zswap_init_area(unsigned type);
+extern void zswap_invalidate_area(unsigned type);
+#else
+static inline int zswap_store(struct page *page)
+{
+	return -1;
+}
+
+static inline int zswap_load(struct page *page)
+{
+	return -1;
+}
+
+static inline void zswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+}
+
+static inline void zswap_init_area(unsigned type)
+{
+}
+
+static inline void zswap_invalidate_area(unsigned type)
+{
+}
+#endif
+
+#endif /* _LINUX_ZSWAP_H */
@@ -159,6 +159,7 @@ static void account_kernel_stack(struct thread_info *ti, int account)
 void free_task(struct task_struct *tsk)
 {
 	prop_local_destroy_single(&tsk->dirties);
+	task_numa_free(tsk);
 	account_kernel_stack(tsk->stack, -1);
 	free_thread_info(tsk->stack);
 	rt_mutex_debug_task_free(tsk);
@@ -272,6 +273,8 @@ static struct task_struct *dup_task_struct(struct task_struct *orig)
 	err = prop_local_init_single(&tsk->dirties);
 	if (err)
 		goto out;
+	tsk->nr_dirtied = 0;
+	tsk->nr_dirtied_pause = 128 >> (PAGE_SHIFT - 10);
 
 	setup_thread_stack(tsk, orig);
 	clear_user_return_notifier(tsk);
@@ -290,6 +293,9 @@ static struct task_struct *dup_task_struct(struct task_struct *orig)
 	tsk->btrace_seq = 0;
 #endif
 	tsk->splice_pipe = NULL;
+#ifdef CONFIG_NUMA_BALANCING
+	tsk->numa_faults = NULL;
+#endif
 
 	account_kernel_stack(ti, 1);
 
@@ -479,6 +485,23 @@ static void mm_init_aio(struct mm_struct *mm)
 #endif
 }
 
+static void mm_init_numa(struct mm_struct *mm)
+{
+#ifdef CONFIG_NUMA_BALANCING
+	mm->numa_next_scan = jiffies;
+	mm->numa_scan_offset = 0;
+	mm->numa_scan_seq = 0;
+#endif
+}
+
+static void mm_init_spf(struct mm_struct *mm)
+{
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	rwlock_init(&mm->mm_rb_lock);
+	atomic_set(&mm->spf_disable, 0);
+#endif
+}
+
 static struct mm_struct * mm_init(struct mm_struct * mm, struct task_struct *p)
 {
 	atomic_set(&mm->mm_users, 1);
@@ -495,6 +518,8 @@ static struct mm_struct * mm_init(struct mm_struct * mm, struct task_struct *p)
 	mm->cached_hole_size = ~0UL;
 	mm_init_aio(mm);
 	mm_init_owner(mm, p);
+	mm_init_numa(mm);
+	mm_init_spf(mm);
 	atomic_set(&mm->oom_disable_count, 0);
 
 	if (likely(!mm_alloc_pgd(mm))) {
@@ -1144,6 +1169,9 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	p->memcg_batch.do_batch = 0;
 	p->memcg_batch.memcg = NULL;
 #endif
+#ifdef CONFIG_BLOCK
+	p->plug = NULL;
+#endif
 
 	/* Perform scheduler related setup. Assign this task to a CPU. */
 	sched_fork(p, clone_flags);
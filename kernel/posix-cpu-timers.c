@@ -8,6 +8,7 @@
 #include <linux/math64.h>
 #include <asm/uaccess.h>
 #include <linux/kernel_stat.h>
+#include <linux/tick.h>
 #include <trace/events/timer.h>
 
 /*
@@ -595,6 +596,9 @@ static void arm_timer(struct k_itimer *timer)
 				cputime_expires->sched_exp = exp->sched;
 			break;
 		}
+
+		/* The timer may belong to a task with a stopped tick */
+		tick_nohz_full_kick_all();
 	}
 }
 
@@ -1298,6 +1302,28 @@ static inline int fastpath_timer_check(struct task_struct *tsk)
 	return 0;
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+/**
+ * posix_cpu_timers_can_stop_tick - check if the tick is needed for timers
+ *
+ * @tsk:	The task running on a nohz_full cpu.
+ *
+ * The timers of @tsk and of its thread group only expire from the tick,
+ * so it can only be stopped if none of them is armed.
+ */
+bool posix_cpu_timers_can_stop_tick(struct task_struct *tsk)
+{
+	if (!task_cputime_zero(&tsk->cputime_expires))
+		return false;
+
+	/* Arming a timer kicks the nohz_full cpus, see arm_timer() */
+	if (tsk->signal->cputimer.running)
+		return false;
+
+	return true;
+}
+#endif
+
 /*
  * This is called from the timer interrupt handler.  The irq handler has
  * already updated our counts.  We need to check if any timers fire now.
@@ -1413,6 +1439,8 @@ void set_process_cpu_timer(struct task_struct *tsk, unsigned int clock_idx,
 			tsk->signal->cputime_expires.virt_exp = *newval;
 		break;
 	}
+
+	tick_nohz_full_kick_all();
 }
 
 static int do_cpu_nanosleep(const clockid_t which_clock, int flags,
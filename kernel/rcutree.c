@@ -47,6 +47,7 @@
 #include <linux/mutex.h>
 #include <linux/time.h>
 #include <linux/kernel_stat.h>
+#include <linux/tick.h>
 
 #include "rcutree.h"
 
@@ -54,7 +55,7 @@
 
 static struct lock_class_key rcu_node_class[NUM_RCU_LVLS];
 
-#define RCU_STATE_INITIALIZER(structname) { \
+#define RCU_STATE_INITIALIZER(structname, sabbr) { \
 	.level = { &structname.node[0] }, \
 	.levelcnt = { \
 		NUM_RCU_LVL_0,  /* root of hierarchy. */ \
@@ -71,12 +72,13 @@ static struct lock_class_key rcu_node_class[NUM_RCU_LVLS];
 	.n_force_qs = 0, \
 	.n_force_qs_ngp = 0, \
 	.name = #structname, \
+	.abbr = sabbr, \
 }
 
-struct rcu_state rcu_sched_state = RCU_STATE_INITIALIZER(rcu_sched_state);
+struct rcu_state rcu_sched_state = RCU_STATE_INITIALIZER(rcu_sched_state, 's');
 DEFINE_PER_CPU(struct rcu_data, rcu_sched_data);
 
-struct rcu_state rcu_bh_state = RCU_STATE_INITIALIZER(rcu_bh_state);
+struct rcu_state rcu_bh_state = RCU_STATE_INITIALIZER(rcu_bh_state, 'b');
 DEFINE_PER_CPU(struct rcu_data, rcu_bh_data);
 
 int rcu_scheduler_active __read_mostly;
@@ -234,8 +236,11 @@ static int rcu_implicit_offline_qs(struct rcu_data *rdp)
 		return 1;
 	}
 
-	/* If preemptable RCU, no point in sending reschedule IPI. */
-	if (rdp->preemptable)
+	/*
+	 * If preemptable RCU, no point in sending reschedule IPI, unless
+	 * the CPU stopped its tick while busy: the IPI restarts it.
+	 */
+	if (rdp->preemptable && !tick_nohz_full_cpu(rdp->cpu))
 		return 0;
 
 	/* The CPU is online, so send it a reschedule IPI. */
@@ -1224,6 +1229,8 @@ void rcu_check_callbacks(int cpu, int user)
 		rcu_bh_qs(cpu);
 	}
 	rcu_preempt_check_callbacks(cpu);
+	do_nocb_deferred_wakeup(&per_cpu(rcu_sched_data, cpu));
+	do_nocb_deferred_wakeup(&per_cpu(rcu_bh_data, cpu));
 	if (rcu_pending(cpu))
 		raise_softirq(RCU_SOFTIRQ);
 }
@@ -1414,9 +1421,14 @@ static void rcu_process_callbacks(struct softirq_action *unused)
 	rcu_needs_cpu_flush();
 }
 
+/*
+ * Queue a callback for invocation after a grace period.  If @offload is
+ * set and the current CPU is a no-CBs CPU, the callback is handed to the
+ * CPU's rcuo kthread rather than queued for the RCU softirq.
+ */
 static void
 __call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu),
-	   struct rcu_state *rsp)
+	   struct rcu_state *rsp, bool offload)
 {
 	unsigned long flags;
 	struct rcu_data *rdp;
@@ -1436,6 +1448,12 @@ __call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu),
 	local_irq_save(flags);
 	rdp = this_cpu_ptr(rsp->rda);
 
+	/* Leave the callback to the rcuo kthread, if there is one. */
+	if (offload && __call_rcu_nocb(rdp, head, flags)) {
+		local_irq_restore(flags);
+		return;
+	}
+
 	/* Add the callback to our list. */
 	*rdp->nxttail[RCU_NEXT_TAIL] = head;
 	rdp->nxttail[RCU_NEXT_TAIL] = &head->next;
@@ -1479,7 +1497,7 @@ __call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu),
  */
 void call_rcu_sched(struct rcu_head *head, void (*func)(struct rcu_head *rcu))
 {
-	__call_rcu(head, func, &rcu_sched_state);
+	__call_rcu(head, func, &rcu_sched_state, true);
 }
 EXPORT_SYMBOL_GPL(call_rcu_sched);
 
@@ -1488,7 +1506,7 @@ EXPORT_SYMBOL_GPL(call_rcu_sched);
  */
 void call_rcu_bh(struct rcu_head *head, void (*func)(struct rcu_head *rcu))
 {
-	__call_rcu(head, func, &rcu_bh_state);
+	__call_rcu(head, func, &rcu_bh_state, true);
 }
 EXPORT_SYMBOL_GPL(call_rcu_bh);
 
@@ -1650,9 +1668,25 @@ static int rcu_needs_cpu_quick_check(int cpu)
 	/* RCU callbacks either ready or pending? */
 	return per_cpu(rcu_sched_data, cpu).nxtlist ||
 	       per_cpu(rcu_bh_data, cpu).nxtlist ||
+	       rcu_nocb_need_deferred_wakeup(&per_cpu(rcu_sched_data, cpu)) ||
+	       rcu_nocb_need_deferred_wakeup(&per_cpu(rcu_bh_data, cpu)) ||
 	       rcu_preempt_needs_cpu(cpu);
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+
+/*
+ * Check to see if a busy nohz_full CPU needs its scheduling-clock
+ * interrupt, either to report a quiescent state or to invoke callbacks,
+ * returning 1 if so.
+ */
+int rcu_needs_tick(int cpu)
+{
+	return rcu_pending(cpu) || rcu_needs_cpu_quick_check(cpu);
+}
+
+#endif /* #ifdef CONFIG_NO_HZ_FULL */
+
 static DEFINE_PER_CPU(struct rcu_head, rcu_barrier_head) = {NULL};
 static atomic_t rcu_barrier_cpu_count;
 static DEFINE_MUTEX(rcu_barrier_mutex);
@@ -1698,12 +1732,15 @@ static void _rcu_barrier(struct rcu_state *rsp,
 	 * decrement rcu_barrier_cpu_count -- otherwise the first CPU
 	 * might complete its grace period before all of the other CPUs
 	 * did their increment, causing this function to return too
-	 * early.  Note that on_each_cpu() disables irqs, which prevents
-	 * any CPUs from coming online or going offline until each online
-	 * CPU has queued its RCU-barrier callback.
+	 * early.  The rcuo kthreads of offline no-CBs CPUs may still hold
+	 * callbacks, so they get an RCU-barrier callback as well; CPU
+	 * hotplug is held off until every CPU has been taken care of.
 	 */
+	get_online_cpus();
 	atomic_set(&rcu_barrier_cpu_count, 1);
 	on_each_cpu(rcu_barrier_func, (void *)call_rcu_func, 1);
+	rcu_barrier_nocb_offline(rsp);
+	put_online_cpus();
 	if (atomic_dec_and_test(&rcu_barrier_cpu_count))
 		complete(&rcu_barrier_completion);
 	wait_for_completion(&rcu_barrier_completion);
@@ -1750,6 +1787,7 @@ rcu_boot_init_percpu_data(int cpu, struct rcu_state *rsp)
 	rdp->dynticks = &per_cpu(rcu_dynticks, cpu);
 #endif /* #ifdef CONFIG_NO_HZ */
 	rdp->cpu = cpu;
+	rcu_boot_init_nocb_percpu_data(rdp, rsp);
 	raw_spin_unlock_irqrestore(&rnp->lock, flags);
 }
 
@@ -1841,6 +1879,7 @@ static int __cpuinit rcu_cpu_notify(struct notifier_block *self,
 	case CPU_DEAD_FROZEN:
 	case CPU_UP_CANCELED:
 	case CPU_UP_CANCELED_FROZEN:
+		rcu_nocb_cpu_dead(cpu);
 		rcu_offline_cpu(cpu);
 		break;
 	default:
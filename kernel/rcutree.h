@@ -27,6 +27,7 @@
 #include <linux/threads.h>
 #include <linux/cpumask.h>
 #include <linux/seqlock.h>
+#include <linux/wait.h>
 
 /*
  * Define shape of hierarchy based on NR_CPUS and CONFIG_RCU_FANOUT.
@@ -239,6 +240,22 @@ struct rcu_data {
 	unsigned long n_rp_need_fqs;
 	unsigned long n_rp_need_nothing;
 
+#ifdef CONFIG_RCU_NOCB_CPU
+	/* 6) Callback offloading to the rcuo kthread. */
+	struct rcu_head *nocb_head;	/* CBs waiting for kthread. */
+	struct rcu_head **nocb_tail;
+	atomic_long_t nocb_q_count;	/* # CBs waiting for kthread. */
+	long nocb_p_count;		/* # CBs being invoked by kthread. */
+	int nocb_defer_wakeup;		/* Wake kthread at next tick. */
+	wait_queue_head_t nocb_wq;	/* For nocb kthreads to sleep on. */
+	struct task_struct *nocb_kthread;
+	struct rcu_state *rsp;
+	unsigned long n_nocb_invoked;	/* # CBs invoked by kthread. */
+	unsigned long n_nocb_gp_waits;	/* # GPs waited for by kthread. */
+	unsigned long nocb_gp_wait_jiffies;
+					/* Total jiffies of these waits. */
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+
 	int cpu;
 };
 
@@ -332,6 +349,7 @@ struct rcu_state {
 						/*  for CPU stalls. */
 #endif /* #ifdef CONFIG_RCU_CPU_STALL_DETECTOR */
 	char *name;				/* Name of structure. */
+	char abbr;				/* Abbreviated name. */
 };
 
 /* Return values for rcu_preempt_offline_tasks(). */
@@ -390,5 +408,13 @@ static void __cpuinit rcu_preempt_init_percpu_data(int cpu);
 static void rcu_preempt_send_cbs_to_online(void);
 static void __init __rcu_init_preempt(void);
 static void rcu_needs_cpu_flush(void);
+static bool __call_rcu_nocb(struct rcu_data *rdp, struct rcu_head *rhp,
+			    unsigned long flags);
+static bool rcu_nocb_need_deferred_wakeup(struct rcu_data *rdp);
+static void do_nocb_deferred_wakeup(struct rcu_data *rdp);
+static void rcu_nocb_cpu_dead(int cpu);
+static void rcu_barrier_nocb_offline(struct rcu_state *rsp);
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp,
+						  struct rcu_state *rsp);
 
 #endif /* #ifndef RCU_TREE_NONCORE */
@@ -25,6 +25,7 @@
  */
 
 #include <linux/delay.h>
+#include <linux/kthread.h>
 #include <linux/stop_machine.h>
 
 /*
@@ -68,7 +69,7 @@ static void __init rcu_bootup_announce_oddness(void)
 
 #ifdef CONFIG_TREE_PREEMPT_RCU
 
-struct rcu_state rcu_preempt_state = RCU_STATE_INITIALIZER(rcu_preempt_state);
+struct rcu_state rcu_preempt_state = RCU_STATE_INITIALIZER(rcu_preempt_state, 'p');
 DEFINE_PER_CPU(struct rcu_data, rcu_preempt_data);
 
 static int rcu_preempted_readers_exp(struct rcu_node *rnp);
@@ -528,6 +529,7 @@ static void rcu_preempt_check_callbacks(int cpu)
 {
 	struct task_struct *t = current;
 
+	do_nocb_deferred_wakeup(&per_cpu(rcu_preempt_data, cpu));
 	if (t->rcu_read_lock_nesting == 0) {
 		rcu_preempt_qs(cpu);
 		return;
@@ -550,7 +552,7 @@ static void rcu_preempt_process_callbacks(void)
  */
 void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu))
 {
-	__call_rcu(head, func, &rcu_preempt_state);
+	__call_rcu(head, func, &rcu_preempt_state, true);
 }
 EXPORT_SYMBOL_GPL(call_rcu);
 
@@ -753,7 +755,8 @@ static int rcu_preempt_pending(int cpu)
  */
 static int rcu_preempt_needs_cpu(int cpu)
 {
-	return !!per_cpu(rcu_preempt_data, cpu).nxtlist;
+	return !!per_cpu(rcu_preempt_data, cpu).nxtlist ||
+	       rcu_nocb_need_deferred_wakeup(&per_cpu(rcu_preempt_data, cpu));
 }
 
 /**
@@ -1197,6 +1200,11 @@ int rcu_needs_cpu(int cpu)
 	int snap_nmi;
 	int thatcpu;
 
+	/* A deferred wakeup of an rcuo kthread needs the next tick. */
+	if (rcu_nocb_need_deferred_wakeup(&per_cpu(rcu_sched_data, cpu)) ||
+	    rcu_nocb_need_deferred_wakeup(&per_cpu(rcu_bh_data, cpu)))
+		return 1;
+
 	/* Check for being in the holdoff period. */
 	if (per_cpu(rcu_dyntick_holdoff, cpu) == jiffies)
 		return rcu_needs_cpu_quick_check(cpu);
@@ -1260,3 +1268,284 @@ static void rcu_needs_cpu_flush(void)
 }
 
 #endif /* #else #if !defined(CONFIG_RCU_FAST_NO_HZ) */
+
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * Offload callback processing from the CPUs listed in the rcu_nocbs=
+ * boot parameter.  Callbacks queued on such a "no-CBs" CPU go to a
+ * per-CPU lockless list instead of to the CPU's ->nxtlist, and are
+ * invoked by an rcuo kthread, one per flavor and CPU, which waits for a
+ * grace period on behalf of each batch it removes from that list.  The
+ * kthreads are not bound to any CPU, so they can be moved away from
+ * the no-CBs CPUs to housekeeping CPUs using sched_setaffinity().
+ */
+
+static cpumask_var_t rcu_nocb_mask;	/* CPUs to have callbacks offloaded. */
+static bool have_rcu_nocb_mask;		/* Was rcu_nocb_mask allocated? */
+
+/* Parse the boot-time rcu_nocbs= CPU list from the kernel parameters. */
+static int __init rcu_nocb_setup(char *str)
+{
+	alloc_bootmem_cpumask_var(&rcu_nocb_mask);
+	have_rcu_nocb_mask = true;
+	cpulist_parse(str, rcu_nocb_mask);
+	return 1;
+}
+__setup("rcu_nocbs=", rcu_nocb_setup);
+
+/*
+ * Enqueue the specified callback onto the specified CPU's list of
+ * callbacks for its rcuo kthread.  The tail pointer is exchanged first,
+ * so concurrent enqueuers each get their own predecessor, and the kthread
+ * may briefly see a ->next pointer that is not filled in yet.  Waking up
+ * the kthread with interrupts disabled could deadlock against scheduler
+ * locks held by the caller, so in that case the wakeup is left to the
+ * next scheduling-clock interrupt.  A nohz_full CPU may have stopped its
+ * tick, so it is kicked to reevaluate it once interrupts are enabled
+ * again.
+ */
+static void __call_rcu_nocb_enqueue(struct rcu_data *rdp,
+				    struct rcu_head *rhp, unsigned long flags)
+{
+	struct rcu_head **old_rhpp;
+
+	old_rhpp = xchg(&rdp->nocb_tail, &rhp->next);
+	ACCESS_ONCE(*old_rhpp) = rhp;
+	atomic_long_inc(&rdp->nocb_q_count);
+
+	/* If we are not the first to queue, the kthread has been kicked. */
+	if (old_rhpp != &rdp->nocb_head)
+		return;
+	if (irqs_disabled_flags(flags)) {
+		ACCESS_ONCE(rdp->nocb_defer_wakeup) = 1;
+		if (tick_nohz_full_cpu(rdp->cpu))
+			tick_nohz_full_kick_cpu(rdp->cpu);
+	} else {
+		wake_up(&rdp->nocb_wq);
+	}
+}
+
+/*
+ * Hand the specified callback over to the current CPU's rcuo kthread,
+ * if it has one, returning true if so.  Callbacks queued before the
+ * kthread was spawned are still invoked by the RCU softirq.
+ */
+static bool __call_rcu_nocb(struct rcu_data *rdp, struct rcu_head *rhp,
+			    unsigned long flags)
+{
+	if (!ACCESS_ONCE(rdp->nocb_kthread))
+		return false;
+	__call_rcu_nocb_enqueue(rdp, rhp, flags);
+	return true;
+}
+
+/* Does this CPU owe its rcuo kthread a wakeup? */
+static bool rcu_nocb_need_deferred_wakeup(struct rcu_data *rdp)
+{
+	return ACCESS_ONCE(rdp->nocb_defer_wakeup);
+}
+
+/*
+ * Do the wakeup that __call_rcu_nocb_enqueue() could not do.  Called
+ * from the scheduling-clock interrupt.
+ */
+static void do_nocb_deferred_wakeup(struct rcu_data *rdp)
+{
+	if (!rcu_nocb_need_deferred_wakeup(rdp))
+		return;
+	ACCESS_ONCE(rdp->nocb_defer_wakeup) = 0;
+	wake_up(&rdp->nocb_wq);
+}
+
+/*
+ * A dead CPU takes no scheduling-clock interrupt until it comes back
+ * online, so do the wakeups it still owes its rcuo kthreads, for example
+ * for callbacks queued from CPU_DYING notifiers after its last tick.
+ */
+static void rcu_nocb_cpu_dead(int cpu)
+{
+	do_nocb_deferred_wakeup(&per_cpu(rcu_sched_data, cpu));
+	do_nocb_deferred_wakeup(&per_cpu(rcu_bh_data, cpu));
+#ifdef CONFIG_TREE_PREEMPT_RCU
+	do_nocb_deferred_wakeup(&per_cpu(rcu_preempt_data, cpu));
+#endif /* #ifdef CONFIG_TREE_PREEMPT_RCU */
+}
+
+/*
+ * The rcuo kthread of an offline no-CBs CPU may still hold callbacks of
+ * the specified flavor, waiting for a grace period or being invoked, and
+ * rcu_barrier() must wait for them too.  Queue an RCU-barrier callback
+ * behind them for every such CPU.  Called with CPU hotplug held off.
+ */
+static void rcu_barrier_nocb_offline(struct rcu_state *rsp)
+{
+	struct rcu_head *head;
+	struct rcu_data *rdp;
+	unsigned long flags;
+	int cpu;
+
+	if (!have_rcu_nocb_mask)
+		return;
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		rdp = per_cpu_ptr(rsp->rda, cpu);
+		if (cpu_online(cpu) || !rdp->nocb_kthread)
+			continue;
+		head = &per_cpu(rcu_barrier_head, cpu);
+		debug_rcu_head_queue(head);
+		head->func = rcu_barrier_callback;
+		head->next = NULL;
+		atomic_inc(&rcu_barrier_cpu_count);
+		local_save_flags(flags);
+		__call_rcu_nocb_enqueue(rdp, head, flags);
+	}
+}
+
+/*
+ * Wait for a grace period of the specified flavor on behalf of an rcuo
+ * kthread.  The callback that ends the wait must not be offloaded: the
+ * kthread that would invoke it might be waiting for a grace period too.
+ */
+static void rcu_nocb_wait_gp(struct rcu_state *rsp)
+{
+	struct rcu_synchronize rcu;
+
+	init_rcu_head_on_stack(&rcu.head);
+	init_completion(&rcu.completion);
+	__call_rcu(&rcu.head, wakeme_after_rcu, rsp, false);
+	wait_for_completion(&rcu.completion);
+	destroy_rcu_head_on_stack(&rcu.head);
+}
+
+/*
+ * Per-rcu_data kthread that invokes the callbacks offloaded from its
+ * CPU.  Each pass removes all the queued callbacks, waits for a grace
+ * period, and then invokes them, with bottom halves disabled as the
+ * callbacks expect to run from softirq.
+ */
+static int rcu_nocb_kthread(void *arg)
+{
+	struct rcu_data *rdp = arg;
+	struct rcu_head *list, *next, **tail;
+	unsigned long start;
+	long c, count;
+
+	for (;;) {
+		wait_event_interruptible(rdp->nocb_wq,
+					 ACCESS_ONCE(rdp->nocb_head));
+		list = ACCESS_ONCE(rdp->nocb_head);
+		if (!list)
+			continue;
+
+		/* Extract queued callbacks, update counts. */
+		ACCESS_ONCE(rdp->nocb_head) = NULL;
+		tail = xchg(&rdp->nocb_tail, &rdp->nocb_head);
+		c = atomic_long_xchg(&rdp->nocb_q_count, 0);
+		ACCESS_ONCE(rdp->nocb_p_count) += c;
+
+		/* Wait for the grace period these callbacks need. */
+		start = jiffies;
+		rcu_nocb_wait_gp(rdp->rsp);
+		rdp->n_nocb_gp_waits++;
+		rdp->nocb_gp_wait_jiffies += jiffies - start;
+
+		/* Each pass through the following loop invokes a callback. */
+		count = 0;
+		while (list) {
+			next = list->next;
+			/* Wait for enqueuing of the last callback to complete. */
+			while (next == NULL && &list->next != tail) {
+				schedule_timeout_interruptible(1);
+				next = list->next;
+			}
+			debug_rcu_head_unqueue(list);
+			local_bh_disable();
+			list->func(list);
+			local_bh_enable();
+			list = next;
+			count++;
+			cond_resched();
+		}
+		ACCESS_ONCE(rdp->nocb_p_count) -= count;
+		rdp->n_nocb_invoked += count;
+	}
+	return 0;
+}
+
+/* Initialize the no-CBs state of the specified rcu_data structure. */
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp,
+						  struct rcu_state *rsp)
+{
+	rdp->nocb_tail = &rdp->nocb_head;
+	init_waitqueue_head(&rdp->nocb_wq);
+	rdp->rsp = rsp;
+}
+
+/* Spawn the rcuo kthread of the specified flavor for the specified CPU. */
+static void __init rcu_spawn_one_nocb_kthread(struct rcu_state *rsp, int cpu)
+{
+	struct rcu_data *rdp = per_cpu_ptr(rsp->rda, cpu);
+	struct task_struct *t;
+
+	t = kthread_run(rcu_nocb_kthread, rdp, "rcuo%c/%d", rsp->abbr, cpu);
+	if (WARN_ON_ONCE(IS_ERR(t)))
+		return;
+	ACCESS_ONCE(rdp->nocb_kthread) = t;
+}
+
+/* Spawn the rcuo kthreads of all flavors for the no-CBs CPUs. */
+static int __init rcu_spawn_nocb_kthreads(void)
+{
+	char buf[128];
+	int cpu;
+
+	if (!have_rcu_nocb_mask)
+		return 0;
+	cpumask_and(rcu_nocb_mask, rcu_nocb_mask, cpu_possible_mask);
+	if (cpumask_empty(rcu_nocb_mask))
+		return 0;
+	cpulist_scnprintf(buf, sizeof(buf), rcu_nocb_mask);
+	printk(KERN_INFO "\tOffload RCU callbacks from CPUs: %s.\n", buf);
+
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		rcu_spawn_one_nocb_kthread(&rcu_sched_state, cpu);
+		rcu_spawn_one_nocb_kthread(&rcu_bh_state, cpu);
+#ifdef CONFIG_TREE_PREEMPT_RCU
+		rcu_spawn_one_nocb_kthread(&rcu_preempt_state, cpu);
+#endif /* #ifdef CONFIG_TREE_PREEMPT_RCU */
+	}
+	return 0;
+}
+early_initcall(rcu_spawn_nocb_kthreads);
+
+#else /* #ifdef CONFIG_RCU_NOCB_CPU */
+
+static bool __call_rcu_nocb(struct rcu_data *rdp, struct rcu_head *rhp,
+			    unsigned long flags)
+{
+	return false;
+}
+
+static bool rcu_nocb_need_deferred_wakeup(struct rcu_data *rdp)
+{
+	return false;
+}
+
+static void do_nocb_deferred_wakeup(struct rcu_data *rdp)
+{
+}
+
+static void rcu_nocb_cpu_dead(int cpu)
+{
+}
+
+static void rcu_barrier_nocb_offline(struct rcu_state *rsp)
+{
+}
+
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp,
+						  struct rcu_state *rsp)
+{
+}
+
+#endif /* #else #ifdef CONFIG_RCU_NOCB_CPU */
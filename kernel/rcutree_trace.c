@@ -65,8 +65,16 @@ static void print_one_rcu_data(struct seq_file *m, struct rcu_data *rdp)
 #endif /* #ifdef CONFIG_NO_HZ */
 	seq_printf(m, " of=%lu ri=%lu", rdp->offline_fqs, rdp->resched_ipi);
 	seq_printf(m, " ql=%ld b=%ld", rdp->qlen, rdp->blimit);
-	seq_printf(m, " ci=%lu co=%lu ca=%lu\n",
+	seq_printf(m, " ci=%lu co=%lu ca=%lu",
 		   rdp->n_cbs_invoked, rdp->n_cbs_orphaned, rdp->n_cbs_adopted);
+#ifdef CONFIG_RCU_NOCB_CPU
+	if (rdp->nocb_kthread)
+		seq_printf(m, " nq=%ld np=%ld ni=%lu ngw=%lu ngwj=%lu",
+			   atomic_long_read(&rdp->nocb_q_count),
+			   rdp->nocb_p_count, rdp->n_nocb_invoked,
+			   rdp->n_nocb_gp_waits, rdp->nocb_gp_wait_jiffies);
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+	seq_puts(m, "\n");
 }
 
 #define PRINT_RCU_DATA(name, func, m) \
@@ -122,8 +130,15 @@ static void print_one_rcu_data_csv(struct seq_file *m, struct rcu_data *rdp)
 #endif /* #ifdef CONFIG_NO_HZ */
 	seq_printf(m, ",%lu,%lu", rdp->offline_fqs, rdp->resched_ipi);
 	seq_printf(m, ",%ld,%ld", rdp->qlen, rdp->blimit);
-	seq_printf(m, ",%lu,%lu,%lu\n",
+	seq_printf(m, ",%lu,%lu,%lu",
 		   rdp->n_cbs_invoked, rdp->n_cbs_orphaned, rdp->n_cbs_adopted);
+#ifdef CONFIG_RCU_NOCB_CPU
+	seq_printf(m, ",%ld,%ld,%lu,%lu,%lu",
+		   atomic_long_read(&rdp->nocb_q_count),
+		   rdp->nocb_p_count, rdp->n_nocb_invoked,
+		   rdp->n_nocb_gp_waits, rdp->nocb_gp_wait_jiffies);
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+	seq_puts(m, "\n");
 }
 
 static int show_rcudata_csv(struct seq_file *m, void *unused)
@@ -132,7 +147,11 @@ static int show_rcudata_csv(struct seq_file *m, void *unused)
 #ifdef CONFIG_NO_HZ
 	seq_puts(m, "\"dt\",\"dt nesting\",\"dn\",\"df\",");
 #endif /* #ifdef CONFIG_NO_HZ */
-	seq_puts(m, "\"of\",\"ri\",\"ql\",\"b\",\"ci\",\"co\",\"ca\"\n");
+	seq_puts(m, "\"of\",\"ri\",\"ql\",\"b\",\"ci\",\"co\",\"ca\"");
+#ifdef CONFIG_RCU_NOCB_CPU
+	seq_puts(m, ",\"nq\",\"np\",\"ni\",\"ngw\",\"ngwj\"");
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+	seq_puts(m, "\n");
 #ifdef CONFIG_TREE_PREEMPT_RCU
 	seq_puts(m, "\"rcu_preempt:\"\n");
 	PRINT_RCU_DATA(rcu_preempt_data, print_one_rcu_data_csv, m);
@@ -54,6 +54,7 @@
 #include <linux/rcupdate.h>
 #include <linux/cpu.h>
 #include <linux/cpuset.h>
+#include <linux/mempolicy.h>
 #include <linux/percpu.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
@@ -518,6 +519,11 @@ struct rq {
 	u64 age_stamp;
 	u64 idle_stamp;
 	u64 avg_idle;
+	/* cost of a newidle balance over all domains, in ns */
+	u64 max_idle_balance_cost;
+
+	/* tasks queued for wakeup by other cpus, see ttwu_queue_remote() */
+	struct task_struct *wake_list;
 #endif
 
 #ifdef CONFIG_IRQ_TIME_ACCOUNTING
@@ -1718,6 +1724,10 @@ static const struct sched_class rt_sched_class;
 static void inc_nr_running(struct rq *rq)
 {
 	rq->nr_running++;
+
+	/* A nohz_full cpu needs its tick again to preempt the running task */
+	if (rq->nr_running == 2 && tick_nohz_full_cpu(cpu_of(rq)))
+		tick_nohz_full_kick_cpu(cpu_of(rq));
 }
 
 static void dec_nr_running(struct rq *rq)
@@ -2382,7 +2392,7 @@ static inline void ttwu_post_activation(struct task_struct *p, struct rq *rq,
 
 	if (unlikely(rq->idle_stamp)) {
 		u64 delta = rq->clock - rq->idle_stamp;
-		u64 max = 2*sysctl_sched_migration_cost;
+		u64 max = 2*rq->max_idle_balance_cost;
 
 		if (delta > max)
 			rq->avg_idle = max;
@@ -2396,6 +2406,102 @@ static inline void ttwu_post_activation(struct task_struct *p, struct rq *rq,
 		wq_worker_waking_up(p, cpu_of(rq));
 }
 
+#ifdef CONFIG_SMP
+static void sched_ttwu_do_pending(struct task_struct *list)
+{
+	struct rq *rq = this_rq();
+
+	raw_spin_lock(&rq->lock);
+
+	while (list) {
+		struct task_struct *p = list;
+		unsigned long en_flags = ENQUEUE_WAKEUP;
+
+		list = list->wake_entry;
+
+		WARN_ON(task_cpu(p) != cpu_of(rq));
+		WARN_ON(p->state != TASK_WAKING);
+
+		if (p->sched_class->task_waking)
+			en_flags |= ENQUEUE_WAKING;
+
+		schedstat_inc(rq, ttwu_count);
+		ttwu_activate(p, rq, false, false, false, en_flags);
+		ttwu_post_activation(p, rq, 0, true);
+	}
+
+	raw_spin_unlock(&rq->lock);
+}
+
+#ifdef CONFIG_HOTPLUG_CPU
+static void sched_ttwu_pending(void)
+{
+	struct rq *rq = this_rq();
+	struct task_struct *list = xchg(&rq->wake_list, NULL);
+
+	if (list)
+		sched_ttwu_do_pending(list);
+}
+#endif
+
+/*
+ * Called from the reschedule IPI handler: enqueue the tasks that other
+ * cpus left on our wake_list.  The handlers of most archs do not call
+ * irq_enter() as they used to have nothing to do, so do it here, which
+ * also brings the clock up to date on a NO_HZ idle cpu.  A nohz_full
+ * cpu always goes through irq_exit(), where it reevaluates its tick.
+ */
+void scheduler_ipi(void)
+{
+	struct rq *rq = this_rq();
+	struct task_struct *list = xchg(&rq->wake_list, NULL);
+
+	if (!list && !tick_nohz_full_cpu(cpu_of(rq)))
+		return;
+
+	irq_enter();
+	if (list)
+		sched_ttwu_do_pending(list);
+	irq_exit();
+}
+
+#ifdef CONFIG_HAVE_SCHEDULER_IPI
+static bool ttwu_share_cache(int this_cpu, int that_cpu)
+{
+	struct sched_domain *sd;
+
+	for_each_domain(this_cpu, sd) {
+		if (!(sd->flags & SD_SHARE_PKG_RESOURCES))
+			break;
+		if (cpumask_test_cpu(that_cpu, sched_domain_span(sd)))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Hand the TASK_WAKING @p over to @cpu: the list is only ever emptied as
+ * a whole, so a lockless push cannot suffer from ABA.  The IPI is only
+ * needed when the list was empty, otherwise one is already on its way.
+ */
+static void ttwu_queue_remote(struct task_struct *p, int cpu)
+{
+	struct rq *rq = cpu_rq(cpu);
+	struct task_struct *old, *next = rq->wake_list;
+
+	do {
+		old = next;
+		p->wake_entry = old;
+		next = cmpxchg(&rq->wake_list, old, p);
+	} while (next != old);
+
+	if (!old)
+		smp_send_reschedule(cpu);
+}
+#endif /* CONFIG_HAVE_SCHEDULER_IPI */
+#endif /* CONFIG_SMP */
+
 /**
  * try_to_wake_up - wake up a thread
  * @p: the thread to be awakened
@@ -2460,6 +2566,35 @@ static int try_to_wake_up(struct task_struct *p, unsigned int state,
 		set_task_cpu(p, cpu);
 	__task_rq_unlock(rq);
 
+#ifdef CONFIG_HAVE_SCHEDULER_IPI
+	/*
+	 * Leave the enqueueing to the target cpu if it is in another cache
+	 * domain, instead of pulling its runqueue over here.  WF_SYNC is
+	 * meaningless that far away and is not passed on.
+	 */
+	if (sched_feat(TTWU_QUEUE) && cpu != this_cpu &&
+	    !ttwu_share_cache(this_cpu, cpu)) {
+#ifdef CONFIG_SCHEDSTATS
+		struct sched_domain *sd;
+
+		for_each_domain(this_cpu, sd) {
+			if (cpumask_test_cpu(cpu, sched_domain_span(sd))) {
+				schedstat_inc(sd, ttwu_wake_remote);
+				break;
+			}
+		}
+#endif /* CONFIG_SCHEDSTATS */
+		if (orig_cpu != cpu)
+			schedstat_inc(p, se.statistics.nr_wakeups_migrate);
+
+		ttwu_queue_remote(p, cpu);
+		local_irq_restore(flags);
+		put_cpu();
+
+		return 1;
+	}
+#endif /* CONFIG_HAVE_SCHEDULER_IPI */
+
 	rq = cpu_rq(cpu);
 	raw_spin_lock(&rq->lock);
 
@@ -2578,6 +2713,14 @@ static void __sched_fork(struct task_struct *p)
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	INIT_HLIST_HEAD(&p->preempt_notifiers);
 #endif
+
+#ifdef CONFIG_NUMA_BALANCING
+	p->node_stamp = 0ULL;
+	p->numa_scan_seq = 0;
+	p->numa_scan_period = sysctl_numa_balancing_scan_delay;
+	p->numa_work_pending = 0;
+	p->numa_preferred_nid = -1;
+#endif
 }
 
 /*
@@ -2825,6 +2968,7 @@ static void finish_task_switch(struct rq *rq, struct task_struct *prev)
 	local_irq_enable();
 #endif /* __ARCH_WANT_INTERRUPTS_ON_CTXSW */
 	finish_lock_switch(rq, prev);
+	tick_nohz_task_switch(prev);
 
 	fire_sched_in_preempt_notifiers(current);
 	if (mm)
@@ -2954,6 +3098,18 @@ context_switch(struct rq *rq, struct task_struct *prev,
 	finish_task_switch(this_rq(), prev);
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * The tick of a busy nohz_full cpu is only needed to preempt its task
+ * when there is another one to run; inc_nr_running() kicks the cpu when
+ * that becomes the case.
+ */
+bool sched_can_stop_tick(void)
+{
+	return this_rq()->nr_running <= 1;
+}
+#endif
+
 /*
  * nr_running, nr_uninterruptible and nr_context_switches:
  *
@@ -3928,6 +4084,21 @@ pick_next_task(struct rq *rq)
 	BUG(); /* the idle class will always have a runnable task */
 }
 
+/*
+ * Work a task has to get out of the door before it blocks.
+ */
+static inline void sched_submit_work(struct task_struct *tsk)
+{
+	if (!tsk->state || (preempt_count() & PREEMPT_ACTIVE))
+		return;
+	/*
+	 * If we are going to sleep and we have plugged IO queued,
+	 * make sure to submit it to avoid deadlocks.
+	 */
+	if (blk_needs_flush_plug(tsk))
+		blk_schedule_flush_plug(tsk);
+}
+
 /*
  * schedule() is the main scheduler function.
  */
@@ -3938,6 +4109,7 @@ asmlinkage void __sched schedule(void)
 	struct rq *rq;
 	int cpu;
 
+	sched_submit_work(current);
 need_resched:
 	preempt_disable();
 	cpu = smp_processor_id();
@@ -5334,6 +5506,7 @@ void __sched io_schedule(void)
 
 	delayacct_blkio_start();
 	atomic_inc(&rq->nr_iowait);
+	blk_flush_plug(current);
 	current->in_iowait = 1;
 	schedule();
 	current->in_iowait = 0;
@@ -5349,6 +5522,7 @@ long __sched io_schedule_timeout(long timeout)
 
 	delayacct_blkio_start();
 	atomic_inc(&rq->nr_iowait);
+	blk_flush_plug(current);
 	current->in_iowait = 1;
 	ret = schedule_timeout(timeout);
 	current->in_iowait = 0;
@@ -6097,6 +6271,9 @@ migration_call(struct notifier_block *nfb, unsigned long action, void *hcpu)
 
 #ifdef CONFIG_HOTPLUG_CPU
 	case CPU_DYING:
+		/* Enqueue the wakeups still queued, so they get migrated */
+		sched_ttwu_pending();
+
 		/* Update our root-domain */
 		raw_spin_lock_irqsave(&rq->lock, flags);
 		if (rq->rd) {
@@ -7000,6 +7177,7 @@ static noinline void sd_init_##type(struct sched_domain *sd)	\
 	memset(sd, 0, sizeof(*sd));				\
 	*sd = SD_##type##_INIT;					\
 	sd->level = SD_LV_##type;				\
+	sd->next_decay_max_lb_cost = jiffies;			\
 	SD_INIT_NAME(sd, type);					\
 }
 
@@ -8007,6 +8185,7 @@ void __init sched_init(void)
 		rq->online = 0;
 		rq->idle_stamp = 0;
 		rq->avg_idle = 2*sysctl_sched_migration_cost;
+		rq->max_idle_balance_cost = sysctl_sched_migration_cost;
 		rq_attach_root(rq, &def_root_domain);
 #ifdef CONFIG_NO_HZ
 		rq->nohz_balance_kick = 0;
@@ -291,6 +291,7 @@ static void print_cpu(struct seq_file *m, int cpu)
 	P(sched_goidle);
 #ifdef CONFIG_SMP
 	P64(avg_idle);
+	P64(max_idle_balance_cost);
 #endif
 
 	P(ttwu_count);
@@ -488,6 +489,21 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 	P(se.load.weight);
 	P(policy);
 	P(prio);
+#ifdef CONFIG_NUMA_BALANCING
+	P(numa_scan_seq);
+	P(numa_scan_period);
+	P(numa_preferred_nid);
+	{
+		unsigned long *faults = ACCESS_ONCE(p->numa_faults);
+		int nid;
+
+		if (faults) {
+			for_each_online_node(nid)
+				SEQ_printf(m, "numa_faults node %-18d:%21lu\n",
+					   nid, faults[nid]);
+		}
+	}
+#endif
 #undef PN
 #undef __PN
 #undef P
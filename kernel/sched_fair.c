@@ -1932,6 +1932,216 @@ static void put_prev_task_fair(struct rq *rq, struct task_struct *prev)
 	}
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Automatic NUMA balancing: every numa_scan_period msecs of its runtime a
+ * task asks, on its next return to user space, for the next
+ * numa_balancing_scan_size MB of its mm to be armed for NUMA hinting
+ * faults.  Those faults migrate misplaced pages to the node accessing
+ * them, and their per-node counts decide the node the task prefers, which
+ * the load balancer then tries to keep it on.
+ */
+unsigned int sysctl_numa_balancing = 1;
+
+/* msecs of runtime before a new task's mm is first scanned */
+unsigned int sysctl_numa_balancing_scan_delay = 1000;
+
+/* bounds, in msecs of runtime, of the period between scans */
+unsigned int sysctl_numa_balancing_scan_period_min = 1000;
+unsigned int sysctl_numa_balancing_scan_period_max = 60000;
+
+/* MB of address space armed per scan */
+unsigned int sysctl_numa_balancing_scan_size = 256;
+
+/*
+ * Called from the scheduler tick: request a scan of the mm once the task
+ * has run for its scan period.
+ */
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+	u64 period, now;
+
+	if (!sysctl_numa_balancing || nr_node_ids == 1)
+		return;
+	if (!curr->mm || (curr->flags & PF_EXITING) || curr->numa_work_pending)
+		return;
+
+	now = curr->se.sum_exec_runtime;
+	period = (u64)curr->numa_scan_period * NSEC_PER_MSEC;
+	if (now - curr->node_stamp > period) {
+		/* the first period was the initial scan delay */
+		if (!curr->node_stamp)
+			curr->numa_scan_period =
+				sysctl_numa_balancing_scan_period_min;
+		curr->node_stamp = now;
+
+		if (!time_before(jiffies, curr->mm->numa_next_scan)) {
+			curr->numa_work_pending = 1;
+			set_tsk_thread_flag(curr, TIF_NOTIFY_RESUME);
+		}
+	}
+}
+
+/**
+ * task_numa_work - arm NUMA hinting faults on the next range of the mm
+ * @p: current task, about to return to user space
+ *
+ * Of the threads sharing an mm, only the first one whose scan is due in
+ * a period does the work.
+ */
+void task_numa_work(struct task_struct *p)
+{
+	struct mm_struct *mm = p->mm;
+	struct vm_area_struct *vma;
+	unsigned long now = jiffies, next_scan, pages;
+	unsigned long start, end;
+
+	if (!p->numa_work_pending)
+		return;
+	p->numa_work_pending = 0;
+	if (!mm || (p->flags & PF_EXITING))
+		return;
+
+	next_scan = mm->numa_next_scan;
+	if (time_before(now, next_scan))
+		return;
+	if (cmpxchg(&mm->numa_next_scan, next_scan,
+		    now + msecs_to_jiffies(p->numa_scan_period)) != next_scan)
+		return;
+
+	pages = (unsigned long)sysctl_numa_balancing_scan_size <<
+		(20 - PAGE_SHIFT);
+	if (!pages)
+		return;
+
+	down_read(&mm->mmap_sem);
+	start = mm->numa_scan_offset;
+	vma = find_vma(mm, start);
+	if (!vma) {
+		mm->numa_scan_seq++;
+		start = 0;
+		vma = mm->mmap;
+	}
+	for (; vma; vma = vma->vm_next) {
+		if (!vma_migratable(vma))
+			continue;
+		start = max(start, vma->vm_start);
+		end = min(vma->vm_end, start + (pages << PAGE_SHIFT));
+		change_prot_numa(vma, start, end);
+		pages -= (end - start) >> PAGE_SHIFT;
+		start = end;
+		if (!pages)
+			break;
+	}
+	/* once the whole mm was scanned, start over at the next scan */
+	if (!vma) {
+		mm->numa_scan_seq++;
+		start = 0;
+	}
+	mm->numa_scan_offset = start;
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * After each full scan of the mm, make the node most of the task's recent
+ * faults came from its preferred node.  Older faults are decayed so that
+ * the preference follows the task around.
+ */
+static void task_numa_placement(struct task_struct *p)
+{
+	int seq = ACCESS_ONCE(p->mm->numa_scan_seq);
+	unsigned long faults, max_faults = 0;
+	int nid, max_nid = -1;
+
+	if (p->numa_scan_seq == seq)
+		return;
+	p->numa_scan_seq = seq;
+
+	for_each_online_node(nid) {
+		faults = p->numa_faults[nid];
+		p->numa_faults[nid] = faults >> 1;
+		if (faults > max_faults) {
+			max_faults = faults;
+			max_nid = nid;
+		}
+	}
+
+	if (max_nid != -1 && max_nid != p->numa_preferred_nid) {
+		p->numa_preferred_nid = max_nid;
+		/* sample the new placement quickly */
+		p->numa_scan_period = sysctl_numa_balancing_scan_period_min;
+	}
+}
+
+/**
+ * task_numa_fault - account a NUMA hinting fault to current
+ * @node: node the faulting pages are on, after any migration
+ * @pages: number of pages
+ * @migrated: whether the pages were migrated
+ */
+void task_numa_fault(int node, int pages, bool migrated)
+{
+	struct task_struct *p = current;
+
+	if (!sysctl_numa_balancing || !p->mm)
+		return;
+
+	if (unlikely(!p->numa_faults)) {
+		p->numa_faults = kzalloc(sizeof(*p->numa_faults) * nr_node_ids,
+					 GFP_KERNEL | __GFP_NOWARN);
+		if (!p->numa_faults)
+			return;
+	}
+
+	task_numa_placement(p);
+
+	/* pages found where they belong: scan less often */
+	if (!migrated)
+		p->numa_scan_period = min(p->numa_scan_period + 10,
+				sysctl_numa_balancing_scan_period_max);
+
+	p->numa_faults[node] += pages;
+}
+
+void task_numa_free(struct task_struct *p)
+{
+	kfree(p->numa_faults);
+}
+
+/*
+ * Load balancing hint: 1 if moving @p from @src_cpu to @dst_cpu takes it
+ * to its preferred node, -1 if it takes it away from there, else 0.
+ */
+static int task_numa_locality(struct task_struct *p, int src_cpu, int dst_cpu)
+{
+	int src_nid, dst_nid;
+
+	if (!sysctl_numa_balancing || !p->numa_faults ||
+	    p->numa_preferred_nid == -1)
+		return 0;
+
+	src_nid = cpu_to_node(src_cpu);
+	dst_nid = cpu_to_node(dst_cpu);
+	if (src_nid == dst_nid)
+		return 0;
+	if (dst_nid == p->numa_preferred_nid)
+		return 1;
+	if (src_nid == p->numa_preferred_nid)
+		return -1;
+	return 0;
+}
+#else
+static inline void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+}
+
+static inline int task_numa_locality(struct task_struct *p, int src_cpu,
+				     int dst_cpu)
+{
+	return 0;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 #ifdef CONFIG_SMP
 /**************************************************
  * Fair scheduling class load-balancing methods:
@@ -1983,6 +2193,20 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 	 */
 
 	tsk_cache_hot = task_hot(p, rq->clock_task, sd);
+
+	/*
+	 * Moving a task to the node its memory is on makes up for its
+	 * cache; moving it away from there costs as much as a hot cache.
+	 */
+	switch (task_numa_locality(p, cpu_of(rq), this_cpu)) {
+	case 1:
+		tsk_cache_hot = 0;
+		break;
+	case -1:
+		tsk_cache_hot = 1;
+		break;
+	}
+
 	if (!tsk_cache_hot ||
 		sd->nr_balance_failed > sd->cache_nice_tries) {
 #ifdef CONFIG_SCHEDSTATS
@@ -3421,6 +3645,7 @@ static void idle_balance(int this_cpu, struct rq *this_rq)
 	struct sched_domain *sd;
 	int pulled_task = 0;
 	unsigned long next_balance = jiffies + HZ;
+	u64 curr_cost = 0;
 
 	this_rq->idle_stamp = this_rq->clock;
 
@@ -3436,14 +3661,31 @@ static void idle_balance(int this_cpu, struct rq *this_rq)
 	for_each_domain(this_cpu, sd) {
 		unsigned long interval;
 		int balance = 1;
+		u64 t0, domain_cost;
 
 		if (!(sd->flags & SD_LOAD_BALANCE))
 			continue;
 
+		/*
+		 * Domains are walked from the smallest, cheapest one up.
+		 * Stop once balancing the next one is likely to take longer
+		 * than we are going to be idle anyway.
+		 */
+		if (this_rq->avg_idle < curr_cost + sd->max_newidle_lb_cost)
+			break;
+
 		if (sd->flags & SD_BALANCE_NEWIDLE) {
+			t0 = sched_clock_cpu(this_cpu);
+
 			/* If we've pulled tasks over stop searching: */
 			pulled_task = load_balance(this_cpu, this_rq,
 						   sd, CPU_NEWLY_IDLE, &balance);
+
+			domain_cost = sched_clock_cpu(this_cpu) - t0;
+			if (domain_cost > sd->max_newidle_lb_cost)
+				sd->max_newidle_lb_cost = domain_cost;
+
+			curr_cost += domain_cost;
 		}
 
 		interval = msecs_to_jiffies(sd->balance_interval);
@@ -3457,6 +3699,9 @@ static void idle_balance(int this_cpu, struct rq *this_rq)
 
 	raw_spin_lock(&this_rq->lock);
 
+	if (curr_cost > this_rq->max_idle_balance_cost)
+		this_rq->max_idle_balance_cost = curr_cost;
+
 	if (pulled_task || time_after(jiffies, this_rq->next_balance)) {
 		/*
 		 * We are going idle. next_balance may be set based on
@@ -3801,14 +4046,38 @@ static void rebalance_domains(int cpu, enum cpu_idle_type idle)
 	/* Earliest time when we have to do rebalance again */
 	unsigned long next_balance = jiffies + 60*HZ;
 	int update_next_balance = 0;
-	int need_serialize;
+	int need_serialize, need_decay = 0;
+	u64 max_cost = 0;
 
 	update_shares(cpu);
 
 	for_each_domain(cpu, sd) {
+		/*
+		 * Decay the newidle balance costs here, as this is a regular
+		 * visit to all the domains: ~1% per second.
+		 */
+		if (time_after(jiffies, sd->next_decay_max_lb_cost)) {
+			sd->max_newidle_lb_cost =
+				(sd->max_newidle_lb_cost * 253) / 256;
+			sd->next_decay_max_lb_cost = jiffies + HZ;
+			need_decay = 1;
+		}
+		max_cost += sd->max_newidle_lb_cost;
+
 		if (!(sd->flags & SD_LOAD_BALANCE))
 			continue;
 
+		/*
+		 * Stop the load balance at this level. There is another
+		 * CPU in our sched group which is doing load balancing more
+		 * actively.  Keep walking the domains if they need decaying.
+		 */
+		if (!balance) {
+			if (need_decay)
+				continue;
+			break;
+		}
+
 		interval = sd->balance_interval;
 		if (idle != CPU_IDLE)
 			interval *= sd->busy_factor;
@@ -3845,16 +4114,16 @@ out:
 			next_balance = sd->last_balance + interval;
 			update_next_balance = 1;
 		}
-
-		/*
-		 * Stop the load balance at this level. There is another
-		 * CPU in our sched group which is doing load balancing more
-		 * actively.
-		 */
-		if (!balance)
-			break;
 	}
 
+	/*
+	 * Decay the rq-wide cost along with the domains', but not below
+	 * the migration cost that avg_idle is compared against.
+	 */
+	if (need_decay)
+		rq->max_idle_balance_cost =
+			max((u64)sysctl_sched_migration_cost, max_cost);
+
 	/*
 	 * next_balance will be updated only when there is a need.
 	 * When the cpu is attached to null domain for ex, it will not be
@@ -4030,6 +4299,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	task_tick_numa(rq, curr);
 }
 
 /*
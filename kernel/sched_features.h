@@ -64,3 +64,10 @@ SCHED_FEAT(OWNER_SPIN, 1)
  * Decrement CPU power based on irq activity
  */
 SCHED_FEAT(NONIRQ_POWER, 1)
+
+/*
+ * Queue wakeups of tasks on cpus that do not share a cache with the
+ * waker on the target cpu and let it enqueue them from the scheduler
+ * IPI, instead of bouncing its runqueue across the interconnect.
+ */
+SCHED_FEAT(TTWU_QUEUE, 1)
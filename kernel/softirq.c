@@ -332,6 +332,10 @@ void irq_exit(void)
 	/* Make sure that timer wheel updates are propagated */
 	if (idle_cpu(smp_processor_id()) && !in_interrupt() && !need_resched())
 		tick_nohz_stop_sched_tick(0);
+	/* Let a busy nohz_full cpu stop or restart its tick */
+	else if (tick_nohz_full_cpu(smp_processor_id()) && !in_interrupt() &&
+		 !idle_cpu(smp_processor_id()))
+		tick_nohz_full_check();
 #endif
 	preempt_enable_no_resched();
 }
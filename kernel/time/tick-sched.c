@@ -15,8 +15,10 @@
 #include <linux/err.h>
 #include <linux/hrtimer.h>
 #include <linux/interrupt.h>
+#include <linux/irq_work.h>
 #include <linux/kernel_stat.h>
 #include <linux/percpu.h>
+#include <linux/posix-timers.h>
 #include <linux/profile.h>
 #include <linux/sched.h>
 #include <linux/tick.h>
@@ -304,6 +306,14 @@ void tick_nohz_stop_sched_tick(int inidle)
 	if (need_resched())
 		goto end;
 
+	/*
+	 * The nohz_full cpus rely on the cpu with the do_timer duty to
+	 * keep jiffies going while their busy tick is stopped, so that
+	 * one never stops its tick.
+	 */
+	if (tick_nohz_full_enabled() && cpu == tick_do_timer_cpu)
+		goto end;
+
 	if (unlikely(local_softirq_pending() && cpu_online(cpu))) {
 		static int ratelimit;
 
@@ -553,6 +563,281 @@ void tick_nohz_restart_sched_tick(void)
 	local_irq_enable();
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * The cpus whose tick may be stopped while they are busy, and whether
+ * there are any.
+ */
+cpumask_var_t tick_nohz_full_mask;
+bool tick_nohz_full_running;
+
+/*
+ * Longest time the busy tick is stopped for, in jiffies: the scheduler
+ * statistics, the load average and the task's cputime are only updated
+ * from the tick.
+ */
+#define TICK_NOHZ_FULL_MAX_DEFER	HZ
+
+static void tick_nohz_full_kick_func(struct irq_work *work)
+{
+	/* Nothing to do: irq_exit() reevaluates the tick */
+}
+
+static DEFINE_PER_CPU(struct irq_work, nohz_full_kick_work) = {
+	.func = tick_nohz_full_kick_func,
+};
+
+/*
+ * Parse the nohz_full= boot parameter. The boot cpu starts out with the
+ * do_timer duty and keeps its tick, so it is never part of the range.
+ */
+static int __init tick_nohz_full_setup(char *str)
+{
+	int cpu = smp_processor_id();
+
+	alloc_bootmem_cpumask_var(&tick_nohz_full_mask);
+	if (cpulist_parse(str, tick_nohz_full_mask) < 0) {
+		printk(KERN_WARNING "NOHZ: Incorrect nohz_full cpumask\n");
+		cpumask_clear(tick_nohz_full_mask);
+		return 1;
+	}
+
+	if (cpumask_test_cpu(cpu, tick_nohz_full_mask)) {
+		printk(KERN_WARNING "NOHZ: Clearing boot CPU %d from "
+		       "nohz_full range\n", cpu);
+		cpumask_clear_cpu(cpu, tick_nohz_full_mask);
+	}
+	tick_nohz_full_running = !cpumask_empty(tick_nohz_full_mask);
+	return 1;
+}
+__setup("nohz_full=", tick_nohz_full_setup);
+
+/**
+ * tick_nohz_full_kick_cpu - make a nohz_full cpu reevaluate its busy tick
+ * @cpu:	the cpu to kick
+ *
+ * Called when a second task is enqueued on @cpu. The tick is reevaluated
+ * on the next irq_exit(): a remote cpu gets a reschedule IPI, which goes
+ * through scheduler_ipi(), the local cpu raises a self IPI unless it
+ * already runs in hardirq context. The handlers of both IPIs have to
+ * set_irq_regs(), or the tick is not stopped from them.
+ */
+void tick_nohz_full_kick_cpu(int cpu)
+{
+	if (cpu != smp_processor_id())
+		smp_send_reschedule(cpu);
+	else if (!in_irq())
+		irq_work_queue(&__get_cpu_var(nohz_full_kick_work));
+}
+
+/**
+ * tick_nohz_full_kick_all - make all nohz_full cpus reevaluate their tick
+ *
+ * Called when a posix cpu timer is armed, as it may belong to any task.
+ */
+void tick_nohz_full_kick_all(void)
+{
+	int cpu;
+
+	if (!tick_nohz_full_running)
+		return;
+
+	preempt_disable();
+	for_each_cpu_and(cpu, tick_nohz_full_mask, cpu_online_mask)
+		tick_nohz_full_kick_cpu(cpu);
+	preempt_enable();
+}
+
+static bool can_stop_busy_tick(int cpu)
+{
+	/* Somebody has to preempt the single task */
+	if (!sched_can_stop_tick())
+		return false;
+
+	/* run_posix_cpu_timers() is only called from the tick */
+	if (!posix_cpu_timers_can_stop_tick(current))
+		return false;
+
+	/*
+	 * A busy cpu may be inside an RCU read-side critical section, so
+	 * unlike an idle one it cannot enter an extended quiescent state:
+	 * keep the tick as long as RCU waits for this cpu or has callbacks
+	 * queued on it. Grace periods started elsewhere kick the cpu with
+	 * a reschedule IPI from force_quiescent_state().
+	 */
+	if (rcu_needs_tick(cpu) || printk_needs_cpu(cpu) ||
+	    arch_needs_cpu(cpu))
+		return false;
+
+	return true;
+}
+
+/*
+ * Program the tick of a busy cpu for the next timer wheel event, at most
+ * TICK_NOHZ_FULL_MAX_DEFER jiffies ahead. Returns 0 if the next event is
+ * too close for the tick to be stopped.
+ */
+static int tick_nohz_stop_busy_tick(struct tick_sched *ts)
+{
+	struct clock_event_device *dev = __get_cpu_var(tick_cpu_device).evtdev;
+	unsigned long seq, last_jiffies, next_jiffies, delta_jiffies;
+	struct pt_regs *regs = get_irq_regs();
+	ktime_t last_update, expires;
+
+	/*
+	 * The skipped ticks are charged as user or system time depending
+	 * on the context the interrupt came from: don't stop the tick from
+	 * an interrupt that did not record it.
+	 */
+	if (!ts->tick_stopped && !regs)
+		return 0;
+
+	do {
+		seq = read_seqbegin(&xtime_lock);
+		last_update = last_jiffies_update;
+		last_jiffies = jiffies;
+	} while (read_seqretry(&xtime_lock, seq));
+
+	next_jiffies = get_next_timer_interrupt(last_jiffies);
+	delta_jiffies = next_jiffies - last_jiffies;
+	if ((long)delta_jiffies <= 1)
+		return 0;
+	if (delta_jiffies > TICK_NOHZ_FULL_MAX_DEFER)
+		delta_jiffies = TICK_NOHZ_FULL_MAX_DEFER;
+
+	expires = ktime_add_ns(last_update, tick_period.tv64 * delta_jiffies);
+
+	/* Skip reprogram of event if its not changed */
+	if (ts->tick_stopped && ktime_equal(expires, dev->next_event))
+		return 1;
+
+	/*
+	 * The ticks skipped from here on are charged to the task when the
+	 * deferred tick fires or the tick is restarted, as user or system
+	 * time depending on where the interrupt stopping it found the task.
+	 */
+	if (!ts->tick_stopped) {
+		ts->idle_tick = hrtimer_get_expires(&ts->sched_timer);
+		ts->tick_stopped = 1;
+		ts->idle_jiffies = last_jiffies;
+		ts->busy_user = regs && user_mode(regs);
+	}
+
+	if (ts->nohz_mode == NOHZ_MODE_HIGHRES) {
+		hrtimer_start(&ts->sched_timer, expires,
+			      HRTIMER_MODE_ABS_PINNED);
+		/* Check, if the timer was already in the past */
+		return hrtimer_active(&ts->sched_timer);
+	}
+	return !tick_program_event(expires, 0);
+}
+
+/*
+ * Charge @p the ticks skipped since idle_jiffies up to @end, which
+ * update_process_times() did not see while the busy tick was stopped.
+ */
+static void tick_nohz_account_busy_ticks(struct tick_sched *ts,
+					 struct task_struct *p,
+					 unsigned long end)
+{
+#ifndef CONFIG_VIRT_CPU_ACCOUNTING
+	unsigned long ticks = end - ts->idle_jiffies;
+	cputime_t delta;
+
+	if (ticks && ticks < LONG_MAX) {
+		delta = jiffies_to_cputime(ticks);
+		if (ts->busy_user)
+			account_user_time(p, delta, cputime_to_scaled(delta));
+		else
+			account_system_time(p, 0, delta,
+					    cputime_to_scaled(delta));
+	}
+#endif
+	ts->idle_jiffies = end;
+}
+
+/*
+ * The deferred tick of a busy cpu fired: charge the ticks skipped since
+ * the last charge now, so that a task running alone for long does not
+ * look mostly idle until the tick is restarted. The current tick is left
+ * to update_process_times().
+ */
+static void tick_nohz_busy_tick_fired(struct tick_sched *ts,
+				      struct pt_regs *regs)
+{
+	if (ts->inidle)
+		return;
+
+	tick_nohz_account_busy_ticks(ts, current, jiffies - 1);
+	ts->busy_user = user_mode(regs);
+}
+
+static void tick_nohz_restart_busy_tick(struct tick_sched *ts,
+					struct task_struct *p)
+{
+	ktime_t now = ktime_get();
+
+	tick_do_update_jiffies64(now);
+	tick_nohz_account_busy_ticks(ts, p, jiffies);
+
+	ts->tick_stopped = 0;
+	tick_nohz_restart(ts, now);
+}
+
+/**
+ * tick_nohz_full_check - stop or restart the tick of a busy nohz_full cpu
+ *
+ * Called from irq_exit() on a nohz_full cpu which is not idle. The tick is
+ * stopped while the cpu runs a single task which neither RCU nor posix
+ * cpu timers need it for, and restarted as soon as that changes.
+ */
+void tick_nohz_full_check(void)
+{
+	int cpu = smp_processor_id();
+	struct tick_sched *ts = &per_cpu(tick_cpu_sched, cpu);
+	unsigned long flags;
+
+	local_irq_save(flags);
+
+	if (unlikely(ts->nohz_mode == NOHZ_MODE_INACTIVE) || ts->inidle)
+		goto out;
+
+	if (!need_resched() && !local_softirq_pending() &&
+	    can_stop_busy_tick(cpu) && tick_nohz_stop_busy_tick(ts))
+		goto out;
+
+	if (ts->tick_stopped)
+		tick_nohz_restart_busy_tick(ts, current);
+out:
+	local_irq_restore(flags);
+}
+
+/**
+ * tick_nohz_task_switch - restart the busy tick at a context switch
+ * @prev:	the task switched away from
+ *
+ * The ticks skipped while @prev ran are charged to it, and the tick runs
+ * until the next irq_exit() has reevaluated it for the new task.
+ */
+void tick_nohz_task_switch(struct task_struct *prev)
+{
+	struct tick_sched *ts;
+	unsigned long flags;
+
+	if (!tick_nohz_full_cpu(smp_processor_id()))
+		return;
+
+	local_irq_save(flags);
+	ts = &__get_cpu_var(tick_cpu_sched);
+	if (ts->tick_stopped && !ts->inidle)
+		tick_nohz_restart_busy_tick(ts, prev);
+	local_irq_restore(flags);
+}
+#else
+static inline void tick_nohz_busy_tick_fired(struct tick_sched *ts,
+					     struct pt_regs *regs) { }
+#endif /* NO_HZ_FULL */
+
 static int tick_nohz_reprogram(struct tick_sched *ts, ktime_t now)
 {
 	hrtimer_forward(&ts->sched_timer, now, tick_period);
@@ -576,9 +861,11 @@ static void tick_nohz_handler(struct clock_event_device *dev)
 	 * concurrency: This happens only when the cpu in charge went
 	 * into a long sleep. If two cpus happen to assign themself to
 	 * this duty, then the jiffies update is still serialized by
-	 * xtime_lock.
+	 * xtime_lock. A nohz_full cpu never takes it, as its tick may
+	 * be stopped while it is busy.
 	 */
-	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE))
+	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE) &&
+	    !tick_nohz_full_cpu(cpu))
 		tick_do_timer_cpu = cpu;
 
 	/* Check, if the jiffies need an update */
@@ -595,6 +882,7 @@ static void tick_nohz_handler(struct clock_event_device *dev)
 	 */
 	if (ts->tick_stopped) {
 		touch_softlockup_watchdog();
+		tick_nohz_busy_tick_fired(ts, regs);
 		ts->idle_jiffies++;
 	}
 
@@ -696,6 +984,8 @@ static inline void tick_check_nohz(int cpu)
 
 static inline void tick_nohz_switch_to_nohz(void) { }
 static inline void tick_check_nohz(int cpu) { }
+static inline void tick_nohz_busy_tick_fired(struct tick_sched *ts,
+					     struct pt_regs *regs) { }
 
 #endif /* NO_HZ */
 
@@ -730,9 +1020,11 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 	 * concurrency: This happens only when the cpu in charge went
 	 * into a long sleep. If two cpus happen to assign themself to
 	 * this duty, then the jiffies update is still serialized by
-	 * xtime_lock.
+	 * xtime_lock. A nohz_full cpu never takes it, as its tick may
+	 * be stopped while it is busy.
 	 */
-	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE))
+	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE) &&
+	    !tick_nohz_full_cpu(cpu))
 		tick_do_timer_cpu = cpu;
 #endif
 
@@ -755,6 +1047,7 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 		 */
 		if (ts->tick_stopped) {
 			touch_softlockup_watchdog();
+			tick_nohz_busy_tick_fired(ts, regs);
 			ts->idle_jiffies++;
 		}
 		update_process_times(user_mode(regs));
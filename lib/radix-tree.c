@@ -33,26 +33,6 @@
 #include <linux/rcupdate.h>
 
 
-#ifdef __KERNEL__
-#define RADIX_TREE_MAP_SHIFT	(CONFIG_BASE_SMALL ? 4 : 6)
-#else
-#define RADIX_TREE_MAP_SHIFT	3	/* For more stressful testing */
-#endif
-
-#define RADIX_TREE_MAP_SIZE	(1UL << RADIX_TREE_MAP_SHIFT)
-#define RADIX_TREE_MAP_MASK	(RADIX_TREE_MAP_SIZE-1)
-
-#define RADIX_TREE_TAG_LONGS	\
-	((RADIX_TREE_MAP_SIZE + BITS_PER_LONG - 1) / BITS_PER_LONG)
-
-struct radix_tree_node {
-	unsigned int	height;		/* Height from the bottom */
-	unsigned int	count;
-	struct rcu_head	rcu_head;
-	void __rcu	*slots[RADIX_TREE_MAP_SIZE];
-	unsigned long	tags[RADIX_TREE_MAX_TAGS][RADIX_TREE_TAG_LONGS];
-};
-
 struct radix_tree_path {
 	struct radix_tree_node *node;
 	int offset;
@@ -276,6 +256,9 @@ static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
 
 		/* Increase the height.  */
 		node->slots[0] = indirect_to_ptr(root->rnode);
+		if (!root->height &&
+		    radix_tree_exceptional_entry(node->slots[0]))
+			node->exceptional = 1;
 
 		/* Propagate the aggregated tag info into the new root */
 		for (tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++) {
@@ -351,6 +334,8 @@ int radix_tree_insert(struct radix_tree_root *root,
 
 	if (node) {
 		node->count++;
+		if (radix_tree_exceptional_entry(item))
+			node->exceptional++;
 		rcu_assign_pointer(node->slots[offset], item);
 		BUG_ON(tag_get(node, 0, offset));
 		BUG_ON(tag_get(node, 1, offset));
@@ -424,6 +409,90 @@ void **radix_tree_lookup_slot(struct radix_tree_root *root, unsigned long index)
 }
 EXPORT_SYMBOL(radix_tree_lookup_slot);
 
+/**
+ *	__radix_tree_lookup    -    lookup an item in a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *	@nodep:		returns the bottom-level node holding the item
+ *	@slotp:		returns the slot holding the item
+ *
+ *	Like radix_tree_lookup_slot(), but also returns the node the slot
+ *	lives in, or %NULL if the item is stored directly in the root.
+ *	Either of @nodep and @slotp may be %NULL.  The caller must hold
+ *	the tree write locked.
+ *
+ *	Returns the item at @index, or %NULL if there is none.
+ */
+void *__radix_tree_lookup(struct radix_tree_root *root, unsigned long index,
+			  struct radix_tree_node **nodep, void ***slotp)
+{
+	struct radix_tree_node *node, *parent = NULL;
+	unsigned int height, shift;
+	void **slot;
+
+	node = root->rnode;
+	slot = (void **)&root->rnode;
+	if (node == NULL)
+		return NULL;
+
+	if (!radix_tree_is_indirect_ptr(node)) {
+		if (index > 0)
+			return NULL;
+		goto out;
+	}
+	node = indirect_to_ptr(node);
+
+	height = node->height;
+	if (index > radix_tree_maxindex(height))
+		return NULL;
+
+	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
+
+	do {
+		parent = node;
+		slot = parent->slots + ((index >> shift) & RADIX_TREE_MAP_MASK);
+		node = *slot;
+		if (node == NULL)
+			return NULL;
+
+		shift -= RADIX_TREE_MAP_SHIFT;
+		height--;
+	} while (height > 0);
+out:
+	if (nodep)
+		*nodep = parent;
+	if (slotp)
+		*slotp = slot;
+	return node;
+}
+EXPORT_SYMBOL(__radix_tree_lookup);
+
+/**
+ *	__radix_tree_replace    -    replace the item in a slot
+ *	@node:		node the slot lives in, as returned by __radix_tree_lookup
+ *	@slot:		slot to replace the item of
+ *	@item:		new item, must not be %NULL
+ *
+ *	Like radix_tree_replace_slot(), but keeps the count of exceptional
+ *	entries in @node up to date when an item is replaced by an
+ *	exceptional entry or the other way round.
+ */
+void __radix_tree_replace(struct radix_tree_node *node, void **slot,
+			  void *item)
+{
+	void *old = *slot;
+
+	BUG_ON(!item);
+	if (node) {
+		if (radix_tree_exceptional_entry(old))
+			node->exceptional--;
+		if (radix_tree_exceptional_entry(item))
+			node->exceptional++;
+	}
+	radix_tree_replace_slot(slot, item);
+}
+EXPORT_SYMBOL(__radix_tree_replace);
+
 /**
  *	radix_tree_lookup    -    perform lookup operation on a radix tree
  *	@root:		radix tree root
@@ -755,7 +824,7 @@ EXPORT_SYMBOL(radix_tree_range_tag_if_tagged);
  *	@max_scan:	maximum range to search
  *
  *	Search the set [index, min(index+max_scan-1, MAX_INDEX)] for the lowest
- *	indexed hole.
+ *	indexed hole.  Exceptional entries count as holes.
  *
  *	Returns: the index of the hole if found, otherwise returns an index
  *	outside of the set specified (in which case 'return - index >= max_scan'
@@ -774,7 +843,9 @@ unsigned long radix_tree_next_hole(struct radix_tree_root *root,
 	unsigned long i;
 
 	for (i = 0; i < max_scan; i++) {
-		if (!radix_tree_lookup(root, index))
+		void *item = radix_tree_lookup(root, index);
+
+		if (!item || radix_tree_exceptional_entry(item))
 			break;
 		index++;
 		if (index == 0)
@@ -792,7 +863,7 @@ EXPORT_SYMBOL(radix_tree_next_hole);
  *	@max_scan:	maximum range to search
  *
  *	Search backwards in the range [max(index-max_scan+1, 0), index]
- *	for the first hole.
+ *	for the first hole.  Exceptional entries count as holes.
  *
  *	Returns: the index of the hole if found, otherwise returns an index
  *	outside of the set specified (in which case 'index - return >= max_scan'
@@ -811,7 +882,9 @@ unsigned long radix_tree_prev_hole(struct radix_tree_root *root,
 	unsigned long i;
 
 	for (i = 0; i < max_scan; i++) {
-		if (!radix_tree_lookup(root, index))
+		void *item = radix_tree_lookup(root, index);
+
+		if (!item || radix_tree_exceptional_entry(item))
 			break;
 		index--;
 		if (index == ULONG_MAX)
@@ -823,8 +896,8 @@ unsigned long radix_tree_prev_hole(struct radix_tree_root *root,
 EXPORT_SYMBOL(radix_tree_prev_hole);
 
 static unsigned int
-__lookup(struct radix_tree_node *slot, void ***results, unsigned long index,
-	unsigned int max_items, unsigned long *next_index)
+__lookup(struct radix_tree_node *slot, void ***results, unsigned long *indices,
+	unsigned long index, unsigned int max_items, unsigned long *next_index)
 {
 	unsigned int nr_found = 0;
 	unsigned int shift, height;
@@ -859,8 +932,10 @@ __lookup(struct radix_tree_node *slot, void ***results, unsigned long index,
 	for (i = index & RADIX_TREE_MAP_MASK; i < RADIX_TREE_MAP_SIZE; i++) {
 		index++;
 		if (slot->slots[i]) {
-			results[nr_found++] = &(slot->slots[i]);
-			if (nr_found == max_items)
+			results[nr_found] = &(slot->slots[i]);
+			if (indices)
+				indices[nr_found] = index - 1;
+			if (++nr_found == max_items)
 				goto out;
 		}
 	}
@@ -918,8 +993,8 @@ radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 
 		if (cur_index > max_index)
 			break;
-		slots_found = __lookup(node, (void ***)results + ret, cur_index,
-					max_items - ret, &next_index);
+		slots_found = __lookup(node, (void ***)results + ret, NULL,
+				cur_index, max_items - ret, &next_index);
 		nr_found = 0;
 		for (i = 0; i < slots_found; i++) {
 			struct radix_tree_node *slot;
@@ -944,12 +1019,14 @@ EXPORT_SYMBOL(radix_tree_gang_lookup);
  *	radix_tree_gang_lookup_slot - perform multiple slot lookup on radix tree
  *	@root:		radix tree root
  *	@results:	where the results of the lookup are placed
+ *	@indices:	where their indices should be placed (but usually NULL)
  *	@first_index:	start the lookup from this key
  *	@max_items:	place up to this many items at *results
  *
  *	Performs an index-ascending scan of the tree for present items.  Places
  *	their slots at *@results and returns the number of items which were
- *	placed at *@results.
+ *	placed at *@results.  If @indices is not NULL, the index of each item
+ *	is stored at the same position in *@indices.
  *
  *	The implementation is naive.
  *
@@ -959,7 +1036,8 @@ EXPORT_SYMBOL(radix_tree_gang_lookup);
  */
 unsigned int
 radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
-			unsigned long first_index, unsigned int max_items)
+			unsigned long *indices, unsigned long first_index,
+			unsigned int max_items)
 {
 	unsigned long max_index;
 	struct radix_tree_node *node;
@@ -974,6 +1052,8 @@ radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
 		if (first_index > 0)
 			return 0;
 		results[0] = (void **)&root->rnode;
+		if (indices)
+			indices[0] = 0;
 		return 1;
 	}
 	node = indirect_to_ptr(node);
@@ -987,8 +1067,9 @@ radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
 
 		if (cur_index > max_index)
 			break;
-		slots_found = __lookup(node, results + ret, cur_index,
-					max_items - ret, &next_index);
+		slots_found = __lookup(node, results + ret,
+				indices ? indices + ret : NULL,
+				cur_index, max_items - ret, &next_index);
 		ret += slots_found;
 		if (next_index == 0)
 			break;
@@ -1217,6 +1298,9 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 			break;
 		if (!to_free->slots[0])
 			break;
+		/* Users may track nodes of exceptional entries: keep them */
+		if (to_free->exceptional)
+			break;
 
 		/*
 		 * We don't need rcu_assign_pointer(), since we are simply
@@ -1318,6 +1402,9 @@ void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
 			radix_tree_tag_clear(root, index, tag);
 	}
 
+	if (radix_tree_exceptional_entry(slot))
+		pathp->node->exceptional--;
+
 	to_free = NULL;
 	/* Now free the nodes we do not need anymore */
 	while (pathp->node) {
@@ -1366,7 +1453,10 @@ EXPORT_SYMBOL(radix_tree_tagged);
 static void
 radix_tree_node_ctor(void *node)
 {
-	memset(node, 0, sizeof(struct radix_tree_node));
+	struct radix_tree_node *n = node;
+
+	memset(n, 0, sizeof(struct radix_tree_node));
+	INIT_LIST_HEAD(&n->private_list);
 }
 
 static __init unsigned long __maxindex(unsigned int height)
@@ -0,0 +1,384 @@
+/*
+ * Testsuite for BPF socket filters
+ *
+ * Runs a set of classic BPF programs against crafted packets and checks
+ * the result of sk_run_filter() against the expected value, and against
+ * the result of the JIT compiled image when net.core.bpf_jit_enable is
+ * set and the architecture supports it.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/filter.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+
+#define MAX_SUBTESTS	3
+#define MAX_DATA	64
+#define MAX_INSNS	16
+
+/* Flags for struct bpf_test */
+#define SKB_NONLINEAR	1	/* put all but the first 4 bytes in a frag */
+#define SKB_WITH_DEV	2	/* attach a (fake) ingress device */
+
+#define SKB_MARK	0x1234aaaa
+#define SKB_HASH	0x1234aaab
+#define SKB_QUEUE_MAP	123
+#define SKB_DEV_IFINDEX	577
+#define SKB_DEV_TYPE	588
+
+struct bpf_test {
+	const char *descr;
+	struct sock_filter insns[MAX_INSNS];
+	int flags;
+	u8 data[MAX_DATA];
+	struct {
+		int data_size;
+		u32 result;
+	} test[MAX_SUBTESTS];
+};
+
+static struct bpf_test tests[] = {
+	{
+		"TAX",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 1),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_IMM, 2),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_NEG, 0), /* A == -3 */
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_LEN, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0), /* X == len - 3 */
+			BPF_STMT(BPF_LD | BPF_B | BPF_IND, 1),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		},
+		0,
+		{ 10, 20, 30, 40, 50 },
+		{ { 2, 10 }, { 3, 20 }, { 4, 30 } },
+	},
+	{
+		"ALU_MUL_DIV",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 0xffff),
+			BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x10001),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 0x100),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_IMM, 0xfffffff0),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		},
+		0,
+		{ },
+		{ { 0, 0x100 } },
+	},
+	{
+		"DIV_X_BY_ZERO",
+		{
+			BPF_STMT(BPF_LDX | BPF_IMM, 0),
+			BPF_STMT(BPF_LD | BPF_IMM, 42),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_K, 1)
+		},
+		0,
+		{ },
+		{ { 0, 0 } },
+	},
+	{
+		"LD_ABS_LINEAR_AND_FRAG",
+		{
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 2),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		},
+		SKB_NONLINEAR,
+		{ 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a },
+		{ { 8, 0 }, { 10, 0x03040506 + 0x0708 + 0x0a } },
+	},
+	{
+		"LD_ABS_OUT_OF_BOUNDS",
+		{
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 3),
+			BPF_STMT(BPF_RET | BPF_K, 0xffff)
+		},
+		0,
+		{ 1, 2, 3, 4 },
+		{ { 4, 0 }, { 5, 0xffff } },
+	},
+	{
+		"LDX_MSH",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 7),
+			BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 5),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		},
+		SKB_NONLINEAR,
+		{ 0x45, 0, 0, 0, 0, 0xf3 },
+		{ { 6, 7 + 20 + 12 } },
+	},
+	{
+		"LD_NET_OFF",
+		{
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_H | BPF_IND, SKF_NET_OFF),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		},
+		0,
+		{ 0x10, 0x02, 0x33, 0x44, 0x55 },
+		{ { 5, 0x4455 }, { 3, 0 } },
+	},
+	{
+		"LD_LL_OFF",
+		{
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_LL_OFF),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		},
+		0,
+		{ 0xde, 0xad, 0xbe, 0xef },
+		{ { 4, 0xdeadbeef } },
+	},
+	{
+		"MEM_SCRATCH",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 0x11),
+			BPF_STMT(BPF_ST, 0),
+			BPF_STMT(BPF_LDX | BPF_IMM, 0x22),
+			BPF_STMT(BPF_STX, 15),
+			BPF_STMT(BPF_LD | BPF_MEM, 15),
+			BPF_STMT(BPF_LDX | BPF_MEM, 0),
+			BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 8),
+			BPF_STMT(BPF_ALU | BPF_OR | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		},
+		0,
+		{ },
+		{ { 0, 0x2211 } },
+	},
+	{
+		"JUMPS",
+		{
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 1, 0, 3),
+			BPF_STMT(BPF_LDX | BPF_IMM, 2),
+			BPF_JUMP(BPF_JMP | BPF_JGT | BPF_X, 0, 7, 8),
+			BPF_STMT(BPF_JMP | BPF_JA, 0),
+			BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 3, 2, 0),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x100, 0, 0),
+			BPF_STMT(BPF_RET | BPF_K, 2),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x80, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 3),
+			BPF_STMT(BPF_RET | BPF_K, 4),
+			BPF_STMT(BPF_RET | BPF_K, 5),
+			BPF_STMT(BPF_RET | BPF_K, 6)
+		},
+		0,
+		{ 1, 0x83, 2, 3, 4 },
+		{ { 1, 6 } },
+	},
+	{
+		"JUMPS_NOT_TAKEN",
+		{
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 1),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 1, 0, 3),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+			BPF_STMT(BPF_RET | BPF_K, 2),
+			BPF_STMT(BPF_RET | BPF_K, 3),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x80, 1, 0),
+			BPF_STMT(BPF_RET | BPF_K, 4),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		},
+		0,
+		{ 1, 0x83 },
+		{ { 2, 0x83 } },
+	},
+	{
+		"ANCILLARY",
+		{
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_MARK),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_RXHASH),
+			BPF_STMT(BPF_ALU | BPF_SUB | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_QUEUE),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		},
+		0,
+		{ },
+		{ { 0, 1 + SKB_QUEUE_MAP + ETH_P_IP } },
+	},
+	{
+		"ANCILLARY_DEV",
+		{
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_HATYPE),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		},
+		SKB_WITH_DEV,
+		{ },
+		{ { 0, SKB_DEV_IFINDEX + SKB_DEV_TYPE } },
+	},
+	{
+		"ANCILLARY_NO_DEV",
+		{
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX),
+			BPF_STMT(BPF_RET | BPF_K, 1)
+		},
+		0,
+		{ },
+		{ { 0, 0 } },
+	},
+};
+
+static struct net_device dev;
+
+static struct sk_buff *populate_skb(const struct bpf_test *t, int size)
+{
+	struct sk_buff *skb;
+	struct page *page;
+	int head = size;
+
+	skb = alloc_skb(MAX_DATA, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	if ((t->flags & SKB_NONLINEAR) && size > 4)
+		head = 4;
+
+	memcpy(__skb_put(skb, head), t->data, head);
+	skb_reset_mac_header(skb);
+	skb->protocol = htons(ETH_P_IP);
+	skb->mark = SKB_MARK;
+	skb->rxhash = SKB_HASH;
+	skb->queue_mapping = SKB_QUEUE_MAP;
+	if (t->flags & SKB_WITH_DEV) {
+		dev.ifindex = SKB_DEV_IFINDEX;
+		dev.type = SKB_DEV_TYPE;
+		skb->dev = &dev;
+	}
+	/* the network header starts right after the first byte */
+	skb->network_header = skb->mac_header + 1;
+
+	if (head < size) {
+		page = alloc_page(GFP_KERNEL);
+		if (!page) {
+			kfree_skb(skb);
+			return NULL;
+		}
+		memcpy(page_address(page), t->data + head, size - head);
+		skb_fill_page_desc(skb, 0, page, 0, size - head);
+		skb->len += size - head;
+		skb->data_len += size - head;
+		skb->truesize += PAGE_SIZE;
+	}
+
+	return skb;
+}
+
+static int run_one(const struct bpf_test *t, const struct sk_filter *fp)
+{
+	int err_cnt = 0, i;
+
+	for (i = 0; i < MAX_SUBTESTS; i++) {
+		struct sk_buff *skb;
+		u32 ret, jit_ret;
+
+		if (t->test[i].data_size == 0 && t->test[i].result == 0 &&
+		    i > 0)
+			break;
+
+		skb = populate_skb(t, t->test[i].data_size);
+		if (!skb) {
+			pr_cont("skb allocation failed ");
+			return 1;
+		}
+
+		ret = sk_run_filter(skb, fp->insns);
+		jit_ret = SK_RUN_FILTER(fp, skb);
+		kfree_skb(skb);
+
+		if (ret != t->test[i].result) {
+			pr_cont("ret %u != %u ", ret, t->test[i].result);
+			err_cnt++;
+		}
+		if (jit_ret != ret) {
+			pr_cont("jit %u != %u ", jit_ret, ret);
+			err_cnt++;
+		}
+	}
+
+	return err_cnt;
+}
+
+static __init int test_bpf_init(void)
+{
+	int i, err_cnt = 0;
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		struct sock_fprog fprog;
+		struct sk_filter *fp;
+		int err;
+
+		pr_info("#%d %s ", i, tests[i].descr);
+
+		/* "ld #k" encodes as 0, so count up to the last instruction */
+		fprog.filter = tests[i].insns;
+		fprog.len = MAX_INSNS;
+		while (fprog.len > 0 && !tests[i].insns[fprog.len - 1].code)
+			fprog.len--;
+
+		err = sk_unattached_filter_create(&fp, &fprog);
+		if (err) {
+			pr_cont("FAIL to attach err=%d len=%d\n", err, fprog.len);
+			err_cnt++;
+			continue;
+		}
+
+		err = run_one(&tests[i], fp);
+		sk_unattached_filter_destroy(fp);
+
+		if (err) {
+			pr_cont("FAIL %d\n", err);
+			err_cnt++;
+		} else {
+			pr_cont("PASS\n");
+		}
+	}
+
+	if (err_cnt) {
+		pr_err("test_bpf: %d of %zu tests FAILED\n",
+		       err_cnt, ARRAY_SIZE(tests));
+		return -EINVAL;
+	}
+
+	pr_info("test_bpf: all %zu tests PASSED\n", ARRAY_SIZE(tests));
+	return 0;
+}
+
+static void __exit test_bpf_exit(void)
+{
+}
+
+module_init(test_bpf_init);
+module_exit(test_bpf_exit);
+MODULE_LICENSE("GPL");
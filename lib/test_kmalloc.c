@@ -0,0 +1,114 @@
+/*
+ * Microbenchmark for the kmalloc()/kfree() fast paths
+ *
+ * For each power of two kmalloc size up to PAGE_SIZE, times a run of
+ * allocations followed by freeing all of them, which also refills the
+ * cpu slab and hands slabs back to the partial lists, and a run of
+ * kmalloc()/kfree() pairs, which stays on the per cpu fast path.  The
+ * results are printed in cycles per operation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sched.h>
+#include <linux/math64.h>
+#include <linux/timex.h>
+
+static int nr_objects = 10000;
+module_param(nr_objects, int, 0444);
+MODULE_PARM_DESC(nr_objects, "number of objects per test run");
+
+static void **objects;
+
+static unsigned long long cycles_per_op(cycles_t start, cycles_t end)
+{
+	return div_u64((u64)(end - start), nr_objects);
+}
+
+/* Allocate nr_objects objects, then free them all */
+static int test_kmalloc_then_kfree(size_t size)
+{
+	cycles_t start, allocated, freed;
+	int i, failed = 0;
+
+	start = get_cycles();
+	for (i = 0; i < nr_objects; i++)
+		objects[i] = kmalloc(size, GFP_KERNEL);
+	allocated = get_cycles();
+	for (i = 0; i < nr_objects; i++) {
+		if (!objects[i])
+			failed++;
+		kfree(objects[i]);
+	}
+	freed = get_cycles();
+
+	if (failed) {
+		pr_err("test_kmalloc: %d of %d kmalloc(%zu) failed\n",
+		       failed, nr_objects, size);
+		return -ENOMEM;
+	}
+
+	pr_info("test_kmalloc: %d times kmalloc(%zu) %llu cycles, "
+		"kfree %llu cycles\n", nr_objects, size,
+		cycles_per_op(start, allocated),
+		cycles_per_op(allocated, freed));
+	cond_resched();
+	return 0;
+}
+
+/* Free every object right after allocating it */
+static void test_kmalloc_kfree_pairs(size_t size)
+{
+	cycles_t start, end;
+	int i;
+
+	start = get_cycles();
+	for (i = 0; i < nr_objects; i++)
+		kfree(kmalloc(size, GFP_KERNEL));
+	end = get_cycles();
+
+	pr_info("test_kmalloc: %d times kmalloc(%zu)/kfree %llu cycles\n",
+		nr_objects, size, cycles_per_op(start, end));
+	cond_resched();
+}
+
+static int __init test_kmalloc_init(void)
+{
+	size_t size;
+	int err = 0;
+
+	if (nr_objects <= 0)
+		return -EINVAL;
+
+	objects = vmalloc(nr_objects * sizeof(void *));
+	if (!objects)
+		return -ENOMEM;
+
+	pr_info("test_kmalloc: alloc then free\n");
+	for (size = 8; size <= PAGE_SIZE && !err; size <<= 1)
+		err = test_kmalloc_then_kfree(size);
+
+	if (!err) {
+		pr_info("test_kmalloc: alloc/free pairs\n");
+		for (size = 8; size <= PAGE_SIZE; size <<= 1)
+			test_kmalloc_kfree_pairs(size);
+	}
+
+	vfree(objects);
+	return err;
+}
+
+static void __exit test_kmalloc_exit(void)
+{
+}
+
+module_init(test_kmalloc_init);
+module_exit(test_kmalloc_exit);
+MODULE_LICENSE("GPL");
@@ -14,6 +14,9 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/module.h>
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
@@ -686,3 +689,249 @@ void compaction_unregister_node(struct node *node)
 	return sysdev_remove_file(&node->sysdev, &attr_compact);
 }
 #endif /* CONFIG_SYSFS && CONFIG_NUMA */
+
+/*
+ * kcompactd compacts a node in the background, so that high-order
+ * allocations find free pages instead of stalling in direct compaction.
+ * kswapd wakes it for the order it was reclaiming for once it has met
+ * the watermarks.  Between those requests it wakes up periodically and
+ * compacts zones whose fragmentation index for pageblock_order exceeds
+ * kcompactd_extfrag_threshold.
+ *
+ * It only uses asynchronous migration and stops as soon as a page of the
+ * target order is free.  A zone where that fails is deferred like after
+ * a failed direct compaction: it sits out exponentially more of the
+ * periodic passes, which themselves run at a fixed interval, so a zone
+ * is looked at again within 1 << COMPACT_MAX_DEFER_SHIFT passes.  The
+ * proactive runs keep their own deferral state: direct compaction defers
+ * a zone for every order, and must not skip an order-2 allocation
+ * because a pageblock_order pass failed in the background.
+ */
+int sysctl_kcompactd_extfrag_threshold = 800;
+
+#define KCOMPACTD_SLEEP_JIFFIES	(HZ / 2)
+
+static bool kcompactd_node_suitable(pg_data_t *pgdat, int order,
+				    int classzone_idx)
+{
+	int zoneid;
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (compaction_suitable(zone, order) == COMPACT_CONTINUE)
+			return true;
+	}
+
+	return false;
+}
+
+static bool kcompactd_deferred(struct zone *zone, bool proactive)
+{
+	unsigned long defer_limit;
+
+	if (!proactive)
+		return compaction_deferred(zone);
+
+	defer_limit = 1UL << zone->kcompactd_defer_shift;
+	/* Avoid possible overflow */
+	if (++zone->kcompactd_considered > defer_limit)
+		zone->kcompactd_considered = defer_limit;
+
+	return zone->kcompactd_considered < defer_limit;
+}
+
+static void kcompactd_defer(struct zone *zone, bool proactive)
+{
+	if (!proactive) {
+		defer_compaction(zone);
+		return;
+	}
+
+	zone->kcompactd_considered = 0;
+	if (zone->kcompactd_defer_shift < COMPACT_MAX_DEFER_SHIFT)
+		zone->kcompactd_defer_shift++;
+}
+
+static void kcompactd_reset_defer(struct zone *zone, bool proactive)
+{
+	if (proactive) {
+		zone->kcompactd_considered = 0;
+		zone->kcompactd_defer_shift = 0;
+	} else {
+		zone->compact_considered = 0;
+		zone->compact_defer_shift = 0;
+	}
+}
+
+/*
+ * Compact the zones of @pgdat up to @classzone_idx for an allocation of
+ * @order.
+ */
+static void kcompactd_do_work(pg_data_t *pgdat, int order, int classzone_idx,
+			      bool proactive)
+{
+	int zoneid;
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.order = order,
+			.migratetype = MIGRATE_MOVABLE,
+			.sync = false,
+		};
+		struct zone *zone = &pgdat->node_zones[zoneid];
+
+		if (kthread_should_stop())
+			break;
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (proactive && fragmentation_index(zone, order) <=
+				sysctl_kcompactd_extfrag_threshold)
+			continue;
+
+		if (kcompactd_deferred(zone, proactive))
+			continue;
+
+		if (compaction_suitable(zone, order) != COMPACT_CONTINUE)
+			continue;
+
+		cc.zone = zone;
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		compact_zone(zone, &cc);
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+
+		if (zone_watermark_ok(zone, order, low_wmark_pages(zone),
+				      0, 0)) {
+			kcompactd_reset_defer(zone, proactive);
+			mod_zone_page_state(zone, KCOMPACTD_SUCCESS, 1);
+		} else {
+			kcompactd_defer(zone, proactive);
+			mod_zone_page_state(zone, KCOMPACTD_FAIL, 1);
+		}
+
+		cond_resched();
+	}
+}
+
+static bool kcompactd_work_requested(pg_data_t *pgdat)
+{
+	return pgdat->kcompactd_max_order > 0 || kthread_should_stop();
+}
+
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = (pg_data_t *)p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		int order, classzone_idx;
+		bool proactive = false;
+
+		wait_event_freezable_timeout(pgdat->kcompactd_wait,
+				kcompactd_work_requested(pgdat),
+				KCOMPACTD_SLEEP_JIFFIES);
+		if (kthread_should_stop())
+			break;
+
+		order = pgdat->kcompactd_max_order;
+		classzone_idx = pgdat->kcompactd_classzone_idx;
+		pgdat->kcompactd_max_order = 0;
+		pgdat->kcompactd_classzone_idx = MAX_NR_ZONES - 1;
+
+		/* Nobody asked: check for fragmentation on our own */
+		if (!order) {
+			order = pageblock_order;
+			classzone_idx = MAX_NR_ZONES - 1;
+			proactive = true;
+		}
+
+		kcompactd_do_work(pgdat, order, classzone_idx, proactive);
+	}
+
+	return 0;
+}
+
+/**
+ * wakeup_kcompactd - ask kcompactd to compact a node
+ * @pgdat: node to compact
+ * @order: order of the allocation that could not be satisfied
+ * @classzone_idx: highest zone the allocation may use
+ */
+void wakeup_kcompactd(pg_data_t *pgdat, int order, int classzone_idx)
+{
+	if (!order)
+		return;
+
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+	if (pgdat->kcompactd_classzone_idx > classzone_idx)
+		pgdat->kcompactd_classzone_idx = classzone_idx;
+
+	if (!waitqueue_active(&pgdat->kcompactd_wait))
+		return;
+
+	if (!kcompactd_node_suitable(pgdat, order, classzone_idx))
+		return;
+
+	count_vm_event(KCOMPACTD_WAKE);
+	wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+/*
+ * This kcompactd start function will be called by init and node-hot-add.
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	int ret = 0;
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(pgdat->kcompactd)) {
+		printk(KERN_ERR "Failed to start kcompactd on node %d\n", nid);
+		pgdat->kcompactd = NULL;
+		ret = -1;
+	}
+	return ret;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.
+ */
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	return 0;
+}
+
+module_init(kcompactd_init)
@@ -107,16 +107,80 @@
  *    ->i_mmap_lock
  */
 
+static void page_cache_tree_delete(struct address_space *mapping,
+				   struct page *page, void *shadow)
+{
+	struct radix_tree_node *node;
+	void **slot;
+	int tag;
+
+	__radix_tree_lookup(&mapping->page_tree, page->index, &node, &slot);
+
+	if (!shadow) {
+		/*
+		 * A node left with shadow entries only stays around and
+		 * has to be tracked (see mm/workingset.c).
+		 */
+		bool shadows_left = node && node->count > 1 &&
+				    node->count - 1 == node->exceptional;
+
+		radix_tree_delete(&mapping->page_tree, page->index);
+		if (shadows_left)
+			workingset_update_node(mapping, node, page->index);
+		return;
+	}
+
+	/*
+	 * Leave the shadow entry in the page's slot.  A page being
+	 * reclaimed is clean and not under writeback, but make sure no
+	 * stale tag makes a tagged lookup trip over the shadow.
+	 */
+	__radix_tree_replace(node, slot, shadow);
+	for (tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++) {
+		if (radix_tree_tag_get(&mapping->page_tree, page->index, tag))
+			radix_tree_tag_clear(&mapping->page_tree,
+					     page->index, tag);
+	}
+	mapping->nrshadows++;
+	if (node)
+		workingset_update_node(mapping, node, page->index);
+}
+
+/**
+ * page_cache_tree_delete_shadow - delete a shadow entry from the page cache
+ * @mapping: the address_space to delete from
+ * @index: index of the shadow entry
+ *
+ * The caller must hold the mapping's tree_lock, and have found a shadow
+ * entry at @index.
+ */
+void page_cache_tree_delete_shadow(struct address_space *mapping,
+				   pgoff_t index)
+{
+	struct radix_tree_node *node;
+	void **slot;
+
+	__radix_tree_lookup(&mapping->page_tree, index, &node, &slot);
+	/* Deleting the last entry frees the node */
+	if (node && node->count == 1)
+		workingset_forget_node(node);
+	radix_tree_delete(&mapping->page_tree, index);
+	mapping->nrshadows--;
+}
+
 /*
  * Remove a page from the page cache and free it. Caller has to make
  * sure the page is locked and that nobody else uses it - or that usage
  * is safe.  The caller must hold the mapping's tree_lock.
+ *
+ * If @shadow is not NULL, it is left in the page's slot to remember
+ * the eviction (see mm/workingset.c).
  */
-void __remove_from_page_cache(struct page *page)
+void __remove_from_page_cache(struct page *page, void *shadow)
 {
 	struct address_space *mapping = page->mapping;
 
-	radix_tree_delete(&mapping->page_tree, page->index);
+	page_cache_tree_delete(mapping, page, shadow);
 	page->mapping = NULL;
 	mapping->nrpages--;
 	__dec_zone_page_state(page, NR_FILE_PAGES);
@@ -132,6 +196,7 @@ void __remove_from_page_cache(struct page *page)
 	 * having removed the page entirely.
 	 */
 	if (PageDirty(page) && mapping_cap_account_dirty(mapping)) {
+		mem_cgroup_dec_page_stat(page, MEMCG_NR_FILE_DIRTY);
 		dec_zone_page_state(page, NR_FILE_DIRTY);
 		dec_bdi_stat(mapping->backing_dev_info, BDI_RECLAIMABLE);
 	}
@@ -146,7 +211,7 @@ void remove_from_page_cache(struct page *page)
 
 	freepage = mapping->a_ops->freepage;
 	spin_lock_irq(&mapping->tree_lock);
-	__remove_from_page_cache(page);
+	__remove_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 
@@ -387,17 +452,52 @@ int filemap_write_and_wait_range(struct address_space *mapping,
 EXPORT_SYMBOL(filemap_write_and_wait_range);
 
 /**
- * add_to_page_cache_locked - add a locked page to the pagecache
- * @page:	page to add
- * @mapping:	the page's address_space
- * @offset:	page index
- * @gfp_mask:	page allocation mode
+ * page_cache_tree_insert - insert a page into the page cache radix tree
+ * @mapping: the address_space to insert into
+ * @page: the page, with its ->index set
+ * @shadowp: returns the shadow entry the page replaces, if not %NULL
  *
- * This function is used to add a page to the pagecache. It must be locked.
- * This function does not add the page to the LRU.  The caller must do that.
+ * The caller must hold the mapping's tree_lock.  Returns -EEXIST if
+ * there already is a page at the page's index.
  */
-int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
-		pgoff_t offset, gfp_t gfp_mask)
+int page_cache_tree_insert(struct address_space *mapping,
+			   struct page *page, void **shadowp)
+{
+	struct radix_tree_node *node;
+	void **slot;
+	void *p;
+	int error;
+
+	p = __radix_tree_lookup(&mapping->page_tree, page->index, &node, &slot);
+	if (p) {
+		if (!radix_tree_exceptional_entry(p))
+			return -EEXIST;
+		if (shadowp)
+			*shadowp = p;
+		__radix_tree_replace(node, slot, page);
+		mapping->nrshadows--;
+	} else {
+		error = radix_tree_insert(&mapping->page_tree, page->index,
+					  page);
+		if (error)
+			return error;
+		/* The page may have landed in a node of shadow entries */
+		node = NULL;
+		if (mapping->nrshadows)
+			__radix_tree_lookup(&mapping->page_tree, page->index,
+					    &node, NULL);
+	}
+	if (node)
+		workingset_update_node(mapping, node, page->index);
+	mapping->nrpages++;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(page_cache_tree_insert);
+
+static int __add_to_page_cache_locked(struct page *page,
+				      struct address_space *mapping,
+				      pgoff_t offset, gfp_t gfp_mask,
+				      void **shadowp)
 {
 	int error;
 
@@ -415,9 +515,8 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 		page->index = offset;
 
 		spin_lock_irq(&mapping->tree_lock);
-		error = radix_tree_insert(&mapping->page_tree, offset, page);
+		error = page_cache_tree_insert(mapping, page, shadowp);
 		if (likely(!error)) {
-			mapping->nrpages++;
 			__inc_zone_page_state(page, NR_FILE_PAGES);
 			if (PageSwapBacked(page))
 				__inc_zone_page_state(page, NR_SHMEM);
@@ -434,11 +533,28 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 out:
 	return error;
 }
+
+/**
+ * add_to_page_cache_locked - add a locked page to the pagecache
+ * @page:	page to add
+ * @mapping:	the page's address_space
+ * @offset:	page index
+ * @gfp_mask:	page allocation mode
+ *
+ * This function is used to add a page to the pagecache. It must be locked.
+ * This function does not add the page to the LRU.  The caller must do that.
+ */
+int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
+		pgoff_t offset, gfp_t gfp_mask)
+{
+	return __add_to_page_cache_locked(page, mapping, offset, gfp_mask, NULL);
+}
 EXPORT_SYMBOL(add_to_page_cache_locked);
 
 int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t offset, gfp_t gfp_mask)
 {
+	void *shadow = NULL;
 	int ret;
 
 	/*
@@ -450,14 +566,23 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 	if (mapping_cap_swap_backed(mapping))
 		SetPageSwapBacked(page);
 
-	ret = add_to_page_cache(page, mapping, offset, gfp_mask);
-	if (ret == 0) {
-		if (page_is_file_cache(page))
-			lru_cache_add_file(page);
-		else
-			lru_cache_add_anon(page);
+	__set_page_locked(page);
+	ret = __add_to_page_cache_locked(page, mapping, offset,
+					 gfp_mask, &shadow);
+	if (unlikely(ret)) {
+		__clear_page_locked(page);
+		return ret;
 	}
-	return ret;
+
+	if (!page_is_file_cache(page))
+		lru_cache_add_anon(page);
+	else if (shadow && workingset_refault(shadow)) {
+		/* Refaulting within the working set: activate right away */
+		workingset_activation(page);
+		lru_cache_add_lru(page, LRU_ACTIVE_FILE);
+	} else
+		lru_cache_add_file(page);
+	return 0;
 }
 EXPORT_SYMBOL_GPL(add_to_page_cache_lru);
 
@@ -650,6 +775,11 @@ repeat:
 			goto out;
 		if (radix_tree_deref_retry(page))
 			goto repeat;
+		/* A shadow entry of a recently evicted page is not a page */
+		if (radix_tree_exceptional_entry(page)) {
+			page = NULL;
+			goto out;
+		}
 
 		if (!page_cache_get_speculative(page))
 			goto repeat;
@@ -774,7 +904,7 @@ unsigned find_get_pages(struct address_space *mapping, pgoff_t start,
 	rcu_read_lock();
 restart:
 	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
-				(void ***)pages, start, nr_pages);
+				(void ***)pages, NULL, start, nr_pages);
 	ret = 0;
 	for (i = 0; i < nr_found; i++) {
 		struct page *page;
@@ -787,6 +917,9 @@ repeat:
 				start = pages[ret-1]->index;
 			goto restart;
 		}
+		/* Skip shadow entries of evicted pages */
+		if (radix_tree_exceptional_entry(page))
+			continue;
 
 		if (!page_cache_get_speculative(page))
 			goto repeat;
@@ -826,7 +959,7 @@ unsigned find_get_pages_contig(struct address_space *mapping, pgoff_t index,
 	rcu_read_lock();
 restart:
 	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
-				(void ***)pages, index, nr_pages);
+				(void ***)pages, NULL, index, nr_pages);
 	ret = 0;
 	for (i = 0; i < nr_found; i++) {
 		struct page *page;
@@ -836,6 +969,9 @@ repeat:
 			continue;
 		if (radix_tree_deref_retry(page))
 			goto restart;
+		/* A shadow entry of an evicted page ends the contiguous run */
+		if (radix_tree_exceptional_entry(page))
+			break;
 
 		if (!page_cache_get_speculative(page))
 			goto repeat;
@@ -17,6 +17,9 @@
 #include <linux/khugepaged.h>
 #include <linux/freezer.h>
 #include <linux/mman.h>
+#include <linux/pagemap.h>
+#include <linux/file.h>
+#include <linux/shmem_fs.h>
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
 #include "internal.h"
@@ -310,6 +313,9 @@ static struct kobj_attribute debug_cow_attr =
 static struct attribute *hugepage_attr[] = {
 	&enabled_attr.attr,
 	&defrag_attr.attr,
+#ifdef CONFIG_SHMEM
+	&shmem_enabled_attr.attr,
+#endif
 #ifdef CONFIG_DEBUG_VM
 	&debug_cow_attr.attr,
 #endif
@@ -709,6 +715,83 @@ out:
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+/*
+ * Map the hugepage aligned range @haddr of a shared file mapping with a
+ * single huge pmd, if the page cache pages backing it are all present,
+ * uptodate, and physically contiguous from a hugepage aligned pfn: an
+ * "extent", as shmem allocates them.  The pages stay small pages, each
+ * taking its own reference and mapcount.  Returns VM_FAULT_FALLBACK if
+ * the range must be mapped with ptes instead.
+ */
+int do_huge_pmd_file_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			  unsigned long haddr, pmd_t *pmd, unsigned int flags)
+{
+	struct address_space *mapping = vma->vm_file->f_mapping;
+	pgoff_t index = linear_page_index(vma, haddr);
+	struct page *head, *page;
+	int ret = VM_FAULT_FALLBACK;
+	int mapped = 0;
+	int i, nr;
+
+	VM_BUG_ON(haddr & ~HPAGE_PMD_MASK);
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return ret;
+
+	head = find_lock_page(mapping, index);
+	if (!head)
+		return ret;
+	nr = 1;
+	if (page_to_pfn(head) & (HPAGE_PMD_NR - 1))
+		goto out;
+	/*
+	 * Lock the pages in index order, as truncation does, and keep
+	 * them locked so that they cannot be truncated under us.
+	 */
+	for (page = head; nr < HPAGE_PMD_NR; nr++) {
+		if (!PageUptodate(page))
+			break;
+		page = find_lock_page(mapping, index + nr);
+		if (page != head + nr) {
+			if (page) {
+				unlock_page(page);
+				page_cache_release(page);
+			}
+			break;
+		}
+	}
+	if (nr < HPAGE_PMD_NR || !PageUptodate(page))
+		goto out;
+	if (index + HPAGE_PMD_NR >
+	    DIV_ROUND_UP(i_size_read(mapping->host), PAGE_CACHE_SIZE))
+		goto out;
+
+	spin_lock(&mm->page_table_lock);
+	if (likely(pmd_none(*pmd))) {
+		pmd_t entry;
+
+		entry = mk_pmd(head, vma->vm_page_prot);
+		if (flags & FAULT_FLAG_WRITE)
+			entry = pmd_mkdirty(entry);
+		entry = maybe_pmd_mkwrite(pmd_mkyoung(entry), vma);
+		entry = pmd_mkhuge(entry);
+		for (i = 0; i < HPAGE_PMD_NR; i++)
+			page_add_file_rmap(head + i);
+		set_pmd_at(mm, haddr, pmd, entry);
+		add_mm_counter(mm, MM_FILEPAGES, HPAGE_PMD_NR);
+		mapped = 1;
+	}
+	spin_unlock(&mm->page_table_lock);
+	ret = 0;
+out:
+	for (i = 0; i < nr; i++) {
+		unlock_page(head + i);
+		/* the references taken are the pmd's if it was mapped */
+		if (!mapped)
+			page_cache_release(head + i);
+	}
+	return ret;
+}
+
 int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		  pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr,
 		  struct vm_area_struct *vma)
@@ -742,6 +825,12 @@ int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		goto out;
 	}
 	src_page = pmd_page(pmd);
+	if (!PageAnon(src_page)) {
+		/* a page cache extent: the child faults it in itself */
+		pte_free(dst_mm, pgtable);
+		ret = 0;
+		goto out_unlock;
+	}
 	VM_BUG_ON(!PageHead(src_page));
 	get_page(src_page);
 	page_dup_rmap(src_page);
@@ -961,6 +1050,22 @@ struct page *follow_trans_huge_pmd(struct mm_struct *mm,
 		goto out;
 
 	page = pmd_page(*pmd);
+	if (!PageAnon(page)) {
+		/*
+		 * A page cache extent: its pages are small pages, and
+		 * rewriting the pmd could lose a dirty bit set by the
+		 * cpu, so touch the page itself as follow_page() does.
+		 */
+		page += (addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+		if (flags & FOLL_GET)
+			get_page(page);
+		if (flags & FOLL_TOUCH) {
+			if (flags & FOLL_WRITE && !PageDirty(page))
+				set_page_dirty(page);
+			mark_page_accessed(page);
+		}
+		goto out;
+	}
 	VM_BUG_ON(!PageHead(page));
 	if (flags & FOLL_TOUCH) {
 		pmd_t _pmd;
@@ -984,8 +1089,35 @@ out:
 	return page;
 }
 
+/*
+ * Clear a huge pmd mapping a page cache extent, passing its dirty and
+ * young bits on to the pages.  Returns the first page of the extent: the
+ * caller flushes the tlb before dropping the pmd's page references.
+ */
+static struct page *clear_huge_file_pmd(struct mm_struct *mm,
+					unsigned long haddr, pmd_t *pmd)
+{
+	struct page *page;
+	pmd_t orig_pmd;
+	int i;
+
+	assert_spin_locked(&mm->page_table_lock);
+	orig_pmd = pmdp_get_and_clear(mm, haddr, pmd);
+	page = pmd_page(orig_pmd);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (pmd_dirty(orig_pmd))
+			set_page_dirty(page + i);
+		if (pmd_young(orig_pmd))
+			mark_page_accessed(page + i);
+		page_remove_rmap(page + i);
+		VM_BUG_ON(page_mapcount(page + i) < 0);
+	}
+	add_mm_counter(mm, MM_FILEPAGES, -HPAGE_PMD_NR);
+	return page;
+}
+
 int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
-		 pmd_t *pmd)
+		 pmd_t *pmd, unsigned long addr)
 {
 	int ret = 0;
 
@@ -995,6 +1127,15 @@ int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 			spin_unlock(&tlb->mm->page_table_lock);
 			wait_split_huge_page(vma->anon_vma,
 					     pmd);
+		} else if (!PageAnon(pmd_page(*pmd))) {
+			struct page *page;
+			int i;
+
+			page = clear_huge_file_pmd(tlb->mm, addr, pmd);
+			spin_unlock(&tlb->mm->page_table_lock);
+			for (i = 0; i < HPAGE_PMD_NR; i++)
+				tlb_remove_page(tlb, page + i);
+			ret = 1;
 		} else {
 			struct page *page;
 			pgtable_t pgtable;
@@ -2007,6 +2148,101 @@ static void collect_mm_slot(struct mm_slot *mm_slot)
 	}
 }
 
+static pmd_t *khugepaged_file_pmd(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+
+	pmd = pmd_offset(pud, address);
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		return NULL;
+	return pmd;
+}
+
+/*
+ * Replace the page table mapping a range of a shared file vma by a huge
+ * pmd.  mmap_sem held for write keeps faults from repopulating the range;
+ * i_mmap_lock keeps rmap walkers off the page table while it goes away.
+ */
+static void collapse_file_pmd(struct mm_struct *mm, struct vm_area_struct *vma,
+			      unsigned long address, pmd_t *pmd)
+{
+	struct address_space *mapping = vma->vm_file->f_mapping;
+	pgtable_t pgtable;
+
+	zap_page_range(vma, address, HPAGE_PMD_SIZE, NULL);
+
+	spin_lock(&mapping->i_mmap_lock);
+	spin_lock(&mm->page_table_lock);
+	pgtable = pmd_pgtable(*pmd);
+	pmd_clear(pmd);
+	mm->nr_ptes--;
+	spin_unlock(&mm->page_table_lock);
+	spin_unlock(&mapping->i_mmap_lock);
+	flush_tlb_range(vma, address, address + HPAGE_PMD_SIZE);
+	pte_free(mm, pgtable);
+
+	do_huge_pmd_file_page(mm, vma, address, pmd, 0);
+}
+
+/*
+ * Collapse a range of a shared shmem vma still mapped with ptes: have
+ * shmem gather its page cache into an extent, then map that with a huge
+ * pmd.  Returns 1 as mmap_sem has been released, 0 if nothing was done.
+ */
+static int khugepaged_scan_file_pmd(struct mm_struct *mm,
+				    struct vm_area_struct *vma,
+				    unsigned long address)
+{
+	struct file *file;
+	pgoff_t index;
+	pmd_t *pmd;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+
+	index = linear_page_index(vma, address);
+	if (index & (HPAGE_PMD_NR - 1))
+		return 0;
+	if (!khugepaged_file_pmd(mm, address))
+		return 0;
+
+	file = vma->vm_file;
+	get_file(file);
+	up_read(&mm->mmap_sem);
+
+	if (shmem_collapse_extent(file->f_mapping->host, index, mm,
+				  khugepaged_max_ptes_none, khugepaged_defrag()))
+		goto out;
+
+	down_write(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		goto out_up_write;
+	vma = find_vma(mm, address);
+	if (!vma || vma->vm_file != file || !vma_is_huge_file(vma) ||
+	    !shmem_huge_enabled(vma))
+		goto out_up_write;
+	if (address < vma->vm_start || address + HPAGE_PMD_SIZE > vma->vm_end ||
+	    linear_page_index(vma, address) != index)
+		goto out_up_write;
+	pmd = khugepaged_file_pmd(mm, address);
+	if (pmd)
+		collapse_file_pmd(mm, vma, address, pmd);
+out_up_write:
+	up_write(&mm->mmap_sem);
+out:
+	fput(file);
+	return 1;
+}
+
 static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 					    struct page **hpage)
 {
@@ -2045,15 +2281,20 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			break;
 		}
 
-		if ((!(vma->vm_flags & VM_HUGEPAGE) &&
-		     !khugepaged_always()) ||
-		    (vma->vm_flags & VM_NOHUGEPAGE)) {
+		if (vma_is_huge_file(vma)) {
+			/* shmem follows the huge= policy of its mount */
+			if (!shmem_huge_enabled(vma))
+				goto skip;
+		} else if ((!(vma->vm_flags & VM_HUGEPAGE) &&
+			    !khugepaged_always()) ||
+			   (vma->vm_flags & VM_NOHUGEPAGE)) {
 		skip:
 			progress++;
 			continue;
 		}
 		/* VM_PFNMAP vmas may have vm_ops null but vm_file set */
-		if (!vma->anon_vma || vma->vm_ops || vma->vm_file)
+		if (!vma_is_huge_file(vma) &&
+		    (!vma->anon_vma || vma->vm_ops || vma->vm_file))
 			goto skip;
 		if (is_vma_temporary_stack(vma))
 			goto skip;
@@ -2079,9 +2320,13 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			VM_BUG_ON(khugepaged_scan.address < hstart ||
 				  khugepaged_scan.address + HPAGE_PMD_SIZE >
 				  hend);
-			ret = khugepaged_scan_pmd(mm, vma,
-						  khugepaged_scan.address,
-						  hpage);
+			if (vma_is_huge_file(vma))
+				ret = khugepaged_scan_file_pmd(mm, vma,
+						khugepaged_scan.address);
+			else
+				ret = khugepaged_scan_pmd(mm, vma,
+						khugepaged_scan.address,
+						hpage);
 			/* move to next address */
 			khugepaged_scan.address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
@@ -2276,7 +2521,51 @@ static int khugepaged(void *none)
 	return 0;
 }
 
-void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
+/*
+ * A huge pmd mapping a page cache extent is "split" by unmapping it: the
+ * pages stay in the page cache and are faulted back in with ptes.
+ */
+static void unmap_huge_file_pmd(struct mm_struct *mm, unsigned long haddr,
+				pmd_t *pmd)
+{
+	struct page *page = NULL;
+	int i;
+
+	mmu_notifier_invalidate_range_start(mm, haddr, haddr + HPAGE_PMD_SIZE);
+	spin_lock(&mm->page_table_lock);
+	if (likely(pmd_trans_huge(*pmd)))
+		page = clear_huge_file_pmd(mm, haddr, pmd);
+	spin_unlock(&mm->page_table_lock);
+	if (page) {
+		flush_tlb_mm(mm);
+		for (i = 0; i < HPAGE_PMD_NR; i++)
+			page_cache_release(page + i);
+	}
+	mmu_notifier_invalidate_range_end(mm, haddr, haddr + HPAGE_PMD_SIZE);
+}
+
+/*
+ * Unmap a huge page cache pmd with mm->page_table_lock held, for rmap
+ * walks under i_mmap_lock: secondary MMUs are told through the
+ * invalidate_page notifier, which must not sleep, one page at a time.
+ */
+void __unmap_huge_file_pmd(struct vm_area_struct *vma, unsigned long haddr,
+			   pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *page;
+	int i;
+
+	page = clear_huge_file_pmd(mm, haddr, pmd);
+	flush_tlb_range(vma, haddr, haddr + HPAGE_PMD_SIZE);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		mmu_notifier_invalidate_page(mm, haddr + i * PAGE_SIZE);
+		page_cache_release(page + i);
+	}
+}
+
+void __split_huge_page_pmd(struct mm_struct *mm, unsigned long address,
+			   pmd_t *pmd)
 {
 	struct page *page;
 
@@ -2286,6 +2575,11 @@ void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
 		return;
 	}
 	page = pmd_page(*pmd);
+	if (!PageAnon(page)) {
+		spin_unlock(&mm->page_table_lock);
+		unmap_huge_file_pmd(mm, address & HPAGE_PMD_MASK, pmd);
+		return;
+	}
 	VM_BUG_ON(!page_count(page));
 	get_page(page);
 	spin_unlock(&mm->page_table_lock);
@@ -2320,7 +2614,7 @@ static void split_huge_page_address(struct mm_struct *mm,
 	 * Caller holds the mmap_sem write mode, so a huge pmd cannot
 	 * materialize from under us.
 	 */
-	split_huge_page_pmd(mm, pmd);
+	split_huge_page_pmd(mm, address, pmd);
 }
 
 void __vma_adjust_trans_huge(struct vm_area_struct *vma,
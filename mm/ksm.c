@@ -26,6 +26,7 @@
 #include <linux/jhash.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
+#include <linux/completion.h>
 #include <linux/wait.h>
 #include <linux/slab.h>
 #include <linux/rbtree.h>
@@ -35,6 +36,7 @@
 #include <linux/ksm.h>
 #include <linux/hash.h>
 #include <linux/freezer.h>
+#include <linux/math64.h>
 
 #include <asm/tlbflush.h>
 #include "internal.h"
@@ -112,13 +114,25 @@ struct ksm_scan {
 /**
  * struct stable_node - node of the stable rbtree
  * @node: rb node of this ksm page in the stable tree
+ * @head: (overlaying parent) &migrate_nodes indicates temporarily on that list
+ * @list: linked into migrate_nodes, pending placement in the proper node tree
  * @hlist: hlist head of rmap_items using this ksm page
  * @kpfn: page frame number of this ksm page
+ * @nid: NUMA node id of stable tree in which linked (may not match kpfn)
  */
 struct stable_node {
-	struct rb_node node;
+	union {
+		struct rb_node node;	/* when node of stable tree */
+		struct {		/* when listed for migration */
+			struct list_head *head;
+			struct list_head list;
+		};
+	};
 	struct hlist_head hlist;
 	unsigned long kpfn;
+#ifdef CONFIG_NUMA
+	int nid;
+#endif
 };
 
 /**
@@ -128,16 +142,26 @@ struct stable_node {
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
+ * @stable_seqnr: ksm_stable_seqnr when page last failed to match stable tree
+ * @nid: NUMA node id of unstable tree in which linked (may not match page)
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
  */
 struct rmap_item {
 	struct rmap_item *rmap_list;
-	struct anon_vma *anon_vma;	/* when stable */
+	union {
+		struct anon_vma *anon_vma;	/* when stable */
+		struct {			/* when unstable */
+			unsigned int oldchecksum;
+			unsigned int stable_seqnr;
+		};
+	};
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
-	unsigned int oldchecksum;	/* when unstable */
+#ifdef CONFIG_NUMA
+	int nid;
+#endif
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -151,9 +175,15 @@ struct rmap_item {
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
 
-/* The stable and unstable tree heads */
-static struct rb_root root_stable_tree = RB_ROOT;
-static struct rb_root root_unstable_tree = RB_ROOT;
+/*
+ * The stable and unstable tree heads: one of each per NUMA node, though
+ * only the first is used while ksm_merge_across_nodes is set.
+ */
+static struct rb_root root_stable_tree[MAX_NUMNODES];
+static struct rb_root root_unstable_tree[MAX_NUMNODES];
+
+/* Stable nodes whose ksm page has moved to another node's tree */
+static LIST_HEAD(migrate_nodes);
 
 #define MM_SLOTS_HASH_SHIFT 10
 #define MM_SLOTS_HASH_HEADS (1 << MM_SLOTS_HASH_SHIFT)
@@ -182,12 +212,35 @@ static unsigned long ksm_pages_unshared;
 /* The number of rmap_items in use: to calculate pages_volatile */
 static unsigned long ksm_rmap_items;
 
+/* The number of pages passed through cmp_and_merge_page() */
+static unsigned long ksm_pages_scanned;
+
+/* The number of those whose stable tree lookup was skipped by checksum */
+static unsigned long ksm_pages_skipped;
+
+/* Bumped whenever a node is added to a stable tree: see cmp_and_merge_page */
+static unsigned int ksm_stable_seqnr = 1;
+
+/* Pages per second over the last full scan, and when this scan started */
+static unsigned long ksm_scan_rate;
+static unsigned long ksm_scan_start_jiffies;
+static unsigned long ksm_scan_start_pages;
+
 /* Number of pages ksmd should scan in one batch */
 static unsigned int ksm_thread_pages_to_scan = 100;
 
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+#ifdef CONFIG_NUMA
+/* Zeroed when merging across nodes is not allowed */
+static unsigned int ksm_merge_across_nodes = 1;
+static int ksm_nr_node_ids = 1;
+#else
+#define ksm_merge_across_nodes	1U
+#define ksm_nr_node_ids		1
+#endif
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
@@ -197,6 +250,49 @@ static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
 static DEFINE_MUTEX(ksm_thread_mutex);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
 
+static struct task_struct *ksm_thread;
+
+/*
+ * ksmd hands the checksumming of each batch of pages it has gathered
+ * out to (ksm_scan_threads - 1) helper threads, while it checksums its
+ * own share; the tree lookups and merging which follow remain serialized
+ * in ksmd under ksm_thread_mutex.
+ */
+#define KSM_SCAN_BATCH		512
+#define KSM_MAX_SCAN_THREADS	32
+
+struct ksm_scan_entry {
+	struct rmap_item *rmap_item;
+	struct page *page;
+	unsigned int checksum;
+};
+
+struct ksm_scan_worker {
+	struct task_struct *task;
+	unsigned int start;		/* slice of ksm_batch to checksum */
+	unsigned int end;
+	unsigned long seqnr;		/* last ksm_batch_seqnr handled */
+};
+
+static struct ksm_scan_entry ksm_batch[KSM_SCAN_BATCH];
+static struct ksm_scan_worker ksm_workers[KSM_MAX_SCAN_THREADS - 1];
+static unsigned int ksm_scan_threads = 1;
+static unsigned long ksm_batch_seqnr;
+static atomic_t ksm_batch_remaining;
+static DECLARE_COMPLETION(ksm_batch_done);
+static DECLARE_WAIT_QUEUE_HEAD(ksm_worker_wait);
+
+/* Runtime of helper threads since stopped, in nanoseconds */
+static u64 ksm_exited_runtime;
+
+#ifdef CONFIG_NUMA
+#define NUMA(x)		(x)
+#define DO_NUMA(x)	do { (x); } while (0)
+#else
+#define NUMA(x)		(0)
+#define DO_NUMA(x)	do { } while (0)
+#endif
+
 #define KSM_KMEM_CACHE(__struct, __flags) kmem_cache_create("ksm_"#__struct,\
 		sizeof(struct __struct), __alignof__(struct __struct),\
 		(__flags), NULL)
@@ -233,6 +329,15 @@ static void __init ksm_slab_free(void)
 	mm_slot_cache = NULL;
 }
 
+/*
+ * The node of the tree a ksm page belongs in: always the first tree
+ * when merging across nodes, otherwise the node the page resides on.
+ */
+static inline int get_kpfn_nid(unsigned long kpfn)
+{
+	return ksm_merge_across_nodes ? 0 : pfn_to_nid(kpfn);
+}
+
 static inline struct rmap_item *alloc_rmap_item(void)
 {
 	struct rmap_item *rmap_item;
@@ -312,7 +417,12 @@ static void ksm_drop_anon_vma(struct rmap_item *rmap_item)
 {
 	struct anon_vma *anon_vma = rmap_item->anon_vma;
 
+	rmap_item->anon_vma = NULL;
 	drop_anon_vma(anon_vma);
+
+	/* Back to unstable: anon_vma does not cover both of these on 32-bit */
+	rmap_item->oldchecksum = 0;
+	rmap_item->stable_seqnr = 0;
 }
 
 /*
@@ -471,7 +581,11 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 		cond_resched();
 	}
 
-	rb_erase(&stable_node->node, &root_stable_tree);
+	if (stable_node->head == &migrate_nodes)
+		list_del(&stable_node->list);
+	else
+		rb_erase(&stable_node->node,
+			 root_stable_tree + NUMA(stable_node->nid));
 	free_stable_node(stable_node);
 }
 
@@ -569,7 +683,8 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
-			rb_erase(&rmap_item->node, &root_unstable_tree);
+			rb_erase(&rmap_item->node,
+				 root_unstable_tree + NUMA(rmap_item->nid));
 
 		ksm_pages_unshared--;
 		rmap_item->address &= PAGE_MASK;
@@ -997,38 +1112,94 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
  */
 static struct page *stable_tree_search(struct page *page)
 {
-	struct rb_node *node = root_stable_tree.rb_node;
+	int nid;
+	struct rb_root *root;
+	struct rb_node **new;
+	struct rb_node *parent;
 	struct stable_node *stable_node;
+	struct stable_node *page_node;
 
-	stable_node = page_stable_node(page);
-	if (stable_node) {			/* ksm page forked */
+	page_node = page_stable_node(page);
+	if (page_node && page_node->head != &migrate_nodes) {
+		/* ksm page forked */
 		get_page(page);
 		return page;
 	}
 
-	while (node) {
+	nid = get_kpfn_nid(page_to_pfn(page));
+	root = root_stable_tree + nid;
+again:
+	new = &root->rb_node;
+	parent = NULL;
+
+	while (*new) {
 		struct page *tree_page;
 		int ret;
 
 		cond_resched();
-		stable_node = rb_entry(node, struct stable_node, node);
+		stable_node = rb_entry(*new, struct stable_node, node);
 		tree_page = get_ksm_page(stable_node);
-		if (!tree_page)
+		if (!tree_page) {
+			/*
+			 * get_ksm_page() has just rb_erased a stale node,
+			 * which may have rebalanced the tree: if we have a
+			 * migrated page_node to place, search again.
+			 */
+			if (page_node)
+				goto again;
 			return NULL;
+		}
 
 		ret = memcmp_pages(page, tree_page);
 
+		parent = *new;
 		if (ret < 0) {
 			put_page(tree_page);
-			node = node->rb_left;
+			new = &parent->rb_left;
 		} else if (ret > 0) {
 			put_page(tree_page);
-			node = node->rb_right;
-		} else
+			new = &parent->rb_right;
+		} else {
+			/*
+			 * If the tree page itself has since been migrated
+			 * to another node, it no longer belongs in this tree:
+			 * let page_node take its place, and move it aside.
+			 */
+			if (get_kpfn_nid(stable_node->kpfn) !=
+						NUMA(stable_node->nid)) {
+				put_page(tree_page);
+				goto replace;
+			}
 			return tree_page;
+		}
 	}
 
-	return NULL;
+	if (!page_node)
+		return NULL;
+
+	/* A migrated ksm page with no match: move it into this tree */
+	list_del(&page_node->list);
+	DO_NUMA(page_node->nid = nid);
+	rb_link_node(&page_node->node, parent, new);
+	rb_insert_color(&page_node->node, root);
+	ksm_stable_seqnr++;
+	get_page(page);
+	return page;
+
+replace:
+	if (page_node) {
+		list_del(&page_node->list);
+		DO_NUMA(page_node->nid = nid);
+		rb_replace_node(&stable_node->node, &page_node->node, root);
+		ksm_stable_seqnr++;
+		get_page(page);
+	} else {
+		rb_erase(&stable_node->node, root);
+		page = NULL;
+	}
+	stable_node->head = &migrate_nodes;
+	list_add(&stable_node->list, stable_node->head);
+	return page;
 }
 
 /*
@@ -1040,10 +1211,18 @@ static struct page *stable_tree_search(struct page *page)
  */
 static struct stable_node *stable_tree_insert(struct page *kpage)
 {
-	struct rb_node **new = &root_stable_tree.rb_node;
+	int nid;
+	unsigned long kpfn;
+	struct rb_root *root;
+	struct rb_node **new;
 	struct rb_node *parent = NULL;
 	struct stable_node *stable_node;
 
+	kpfn = page_to_pfn(kpage);
+	nid = get_kpfn_nid(kpfn);
+	root = root_stable_tree + nid;
+	new = &root->rb_node;
+
 	while (*new) {
 		struct page *tree_page;
 		int ret;
@@ -1077,11 +1256,13 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 		return NULL;
 
 	rb_link_node(&stable_node->node, parent, new);
-	rb_insert_color(&stable_node->node, &root_stable_tree);
+	rb_insert_color(&stable_node->node, root);
+	ksm_stable_seqnr++;
 
 	INIT_HLIST_HEAD(&stable_node->hlist);
 
-	stable_node->kpfn = page_to_pfn(kpage);
+	stable_node->kpfn = kpfn;
+	DO_NUMA(stable_node->nid = nid);
 	set_page_stable_node(kpage, stable_node);
 
 	return stable_node;
@@ -1107,8 +1288,14 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 					      struct page **tree_pagep)
 
 {
-	struct rb_node **new = &root_unstable_tree.rb_node;
+	struct rb_root *root;
+	struct rb_node **new;
 	struct rb_node *parent = NULL;
+	int nid;
+
+	nid = get_kpfn_nid(page_to_pfn(page));
+	root = root_unstable_tree + nid;
+	new = &root->rb_node;
 
 	while (*new) {
 		struct rmap_item *tree_rmap_item;
@@ -1138,6 +1325,15 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 		} else if (ret > 0) {
 			put_page(tree_page);
 			new = &parent->rb_right;
+		} else if (!ksm_merge_across_nodes &&
+			   page_to_nid(tree_page) != nid) {
+			/*
+			 * If tree_page has been migrated to another NUMA node,
+			 * it will be flushed out and put in the right unstable
+			 * tree next time: only merge with it when across_nodes.
+			 */
+			put_page(tree_page);
+			return NULL;
 		} else {
 			*tree_pagep = tree_page;
 			return tree_rmap_item;
@@ -1146,8 +1342,9 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 
 	rmap_item->address |= UNSTABLE_FLAG;
 	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	DO_NUMA(rmap_item->nid = nid);
 	rb_link_node(&rmap_item->node, parent, new);
-	rb_insert_color(&rmap_item->node, &root_unstable_tree);
+	rb_insert_color(&rmap_item->node, root);
 
 	ksm_pages_unshared++;
 	return NULL;
@@ -1171,6 +1368,24 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 		ksm_pages_shared++;
 }
 
+/*
+ * stable_lookup_skippable - whether cmp_and_merge_page() can omit searching
+ * the stable tree for a page which is not yet a ksm page: either because its
+ * checksum shows it to be volatile, or because it is unchanged since it last
+ * failed to find a match there, and the tree has gained no node since then.
+ */
+static inline bool stable_lookup_skippable(struct rmap_item *rmap_item,
+					   struct page *page,
+					   unsigned int checksum)
+{
+	if (!rmap_item->stable_seqnr)		/* never looked up */
+		return false;
+	if (rmap_item->oldchecksum != checksum)
+		return true;
+	return rmap_item->stable_seqnr == ksm_stable_seqnr &&
+	       NUMA(rmap_item->nid) == get_kpfn_nid(page_to_pfn(page));
+}
+
 /*
  * cmp_and_merge_page - first see if page can be merged into the stable tree;
  * if not, compare checksum to previous and if it's the same, see if page can
@@ -1179,20 +1394,55 @@ static void stable_tree_append(struct rmap_item *rmap_item,
  *
  * @page: the page that we are searching identical page to.
  * @rmap_item: the reverse mapping into the virtual address of this page
+ * @checksum: the current checksum of the page, from ksm_checksum_batch()
  */
-static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item,
+			       unsigned int checksum)
 {
 	struct rmap_item *tree_rmap_item;
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
-	struct page *kpage;
-	unsigned int checksum;
+	struct page *kpage = NULL;
+	unsigned int stable_seqnr = 0;
 	int err;
 
-	remove_rmap_item_from_tree(rmap_item);
+	ksm_pages_scanned++;
+
+	stable_node = page_stable_node(page);
+	if (stable_node) {
+		/*
+		 * A ksm page migrated to another node no longer belongs in
+		 * the tree it was linked into: move it aside until it can be
+		 * placed in (or merged with a match in) its new node's tree.
+		 */
+		if (stable_node->head != &migrate_nodes &&
+		    get_kpfn_nid(stable_node->kpfn) != NUMA(stable_node->nid)) {
+			rb_erase(&stable_node->node,
+				 root_stable_tree + NUMA(stable_node->nid));
+			stable_node->head = &migrate_nodes;
+			list_add(&stable_node->list, stable_node->head);
+		}
+		if (stable_node->head != &migrate_nodes &&
+		    in_stable_tree(rmap_item) && rmap_item->head == stable_node)
+			return;
+	}
 
 	/* We first start with searching the page inside the stable tree */
-	kpage = stable_tree_search(page);
+	if (!stable_node && !in_stable_tree(rmap_item) &&
+	    stable_lookup_skippable(rmap_item, page, checksum))
+		ksm_pages_skipped++;
+	else {
+		stable_seqnr = ksm_stable_seqnr;
+		kpage = stable_tree_search(page);
+		if (kpage == page && in_stable_tree(rmap_item) &&
+		    rmap_item->head == stable_node) {
+			put_page(kpage);
+			return;
+		}
+	}
+
+	remove_rmap_item_from_tree(rmap_item);
+
 	if (kpage) {
 		err = try_to_merge_with_ksm_page(rmap_item, page, kpage);
 		if (!err) {
@@ -1208,13 +1458,18 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		return;
 	}
 
+	/* Note the miss, so an unchanged page need not look again soon */
+	if (stable_seqnr) {
+		rmap_item->stable_seqnr = stable_seqnr;
+		DO_NUMA(rmap_item->nid = get_kpfn_nid(page_to_pfn(page)));
+	}
+
 	/*
 	 * If the hash value of the page has changed from the last time
 	 * we calculated it, this page is changing frequently: therefore we
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
 	 */
-	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
 		return;
@@ -1284,12 +1539,21 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+/*
+ * scan_get_next_rmap_item - advance the scanning cursor to the next page.
+ * When @hold_mm is set, the caller still has rmap_items of the current mm
+ * in hand: so return NULL at the end of that mm rather than moving on, since
+ * moving on from an exiting mm frees all its rmap_items.
+ */
+static struct rmap_item *scan_get_next_rmap_item(struct page **page,
+						 bool hold_mm)
 {
 	struct mm_struct *mm;
 	struct mm_slot *slot;
 	struct vm_area_struct *vma;
 	struct rmap_item *rmap_item;
+	u64 rate;
+	int nid;
 
 	if (list_empty(&ksm_mm_head.mm_list))
 		return NULL;
@@ -1308,7 +1572,30 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		 */
 		lru_add_drain_all();
 
-		root_unstable_tree = RB_ROOT;
+		/*
+		 * Whereas stale stable_nodes on the stable_tree itself
+		 * get pruned in the regular course of stable_tree_search(),
+		 * those moved out to the migrate_nodes list can accumulate:
+		 * so prune them once before each full scan.
+		 */
+		if (!ksm_merge_across_nodes) {
+			struct stable_node *stable_node, *next;
+			struct page *page;
+
+			list_for_each_entry_safe(stable_node, next,
+						 &migrate_nodes, list) {
+				page = get_ksm_page(stable_node);
+				if (page)
+					put_page(page);
+				cond_resched();
+			}
+		}
+
+		for (nid = 0; nid < nr_node_ids; nid++)
+			root_unstable_tree[nid] = RB_ROOT;
+
+		ksm_scan_start_jiffies = jiffies;
+		ksm_scan_start_pages = ksm_pages_scanned;
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
@@ -1364,6 +1651,11 @@ next_mm:
 		}
 	}
 
+	if (hold_mm) {
+		up_read(&mm->mmap_sem);
+		return NULL;
+	}
+
 	if (ksm_test_exit(mm)) {
 		ksm_scan.address = 0;
 		ksm_scan.rmap_list = &slot->rmap_list;
@@ -1406,27 +1698,123 @@ next_mm:
 		goto next_mm;
 
 	ksm_scan.seqnr++;
+	rate = (u64)(ksm_pages_scanned - ksm_scan_start_pages) * HZ;
+	ksm_scan_rate = div64_u64(rate,
+				  max(jiffies - ksm_scan_start_jiffies, 1UL));
 	return NULL;
 }
 
+static void ksm_checksum_slice(unsigned int start, unsigned int end)
+{
+	struct ksm_scan_entry *entry;
+
+	for (entry = ksm_batch + start; entry < ksm_batch + end; entry++) {
+		/* Pages already merged are write-protected: no need to check */
+		if (PageKsm(entry->page) && in_stable_tree(entry->rmap_item))
+			continue;
+		entry->checksum = calc_checksum(entry->page);
+	}
+}
+
+static int ksm_scan_worker_thread(void *data)
+{
+	struct ksm_scan_worker *worker = data;
+
+	set_user_nice(current, 5);
+
+	for (;;) {
+		wait_event_interruptible(ksm_worker_wait,
+			   ACCESS_ONCE(ksm_batch_seqnr) != worker->seqnr ||
+			   kthread_should_stop());
+		if (kthread_should_stop())
+			break;
+		worker->seqnr = ksm_batch_seqnr;
+		smp_rmb();	/* see slice assigned before seqnr bumped */
+
+		ksm_checksum_slice(worker->start, worker->end);
+		if (atomic_dec_and_test(&ksm_batch_remaining))
+			complete(&ksm_batch_done);
+	}
+	return 0;
+}
+
+/*
+ * ksm_checksum_batch - checksum the first @nr pages of ksm_batch, sharing
+ * the work out between ksmd and its helper threads.
+ */
+static void ksm_checksum_batch(unsigned int nr)
+{
+	unsigned int nr_helpers = ksm_scan_threads - 1;
+	unsigned int slice, i;
+
+	if (!nr_helpers) {
+		ksm_checksum_slice(0, nr);
+		return;
+	}
+
+	slice = DIV_ROUND_UP(nr, nr_helpers + 1);
+	for (i = 0; i < nr_helpers; i++) {
+		ksm_workers[i].start = min(nr, (i + 1) * slice);
+		ksm_workers[i].end = min(nr, (i + 2) * slice);
+	}
+	atomic_set(&ksm_batch_remaining, nr_helpers);
+	INIT_COMPLETION(ksm_batch_done);
+	smp_wmb();	/* assign slices before bumping seqnr */
+	ksm_batch_seqnr++;
+	wake_up_all(&ksm_worker_wait);
+
+	ksm_checksum_slice(0, min(nr, slice));
+	wait_for_completion(&ksm_batch_done);
+}
+
+static void ksm_process_batch(unsigned int nr)
+{
+	struct ksm_scan_entry *entry;
+
+	ksm_checksum_batch(nr);
+
+	for (entry = ksm_batch; entry < ksm_batch + nr; entry++) {
+		cond_resched();
+		cmp_and_merge_page(entry->page, entry->rmap_item,
+				   entry->checksum);
+		put_page(entry->page);
+	}
+}
+
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
  * @scan_npages - number of pages we want to scan before we return.
+ *
+ * Pages are gathered into batches, each from a single mm, for checksumming
+ * in parallel before being compared and merged one by one.
  */
 static void ksm_do_scan(unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
+	unsigned int nr = 0;
 
-	while (scan_npages-- && likely(!freezing(current))) {
+	while (scan_npages && likely(!freezing(current))) {
 		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
-		if (!rmap_item)
-			return;
-		if (!PageKsm(page) || !in_stable_tree(rmap_item))
-			cmp_and_merge_page(page, rmap_item);
-		put_page(page);
+		rmap_item = scan_get_next_rmap_item(&page, nr != 0);
+		if (!rmap_item) {
+			if (!nr)
+				return;
+			/* End of this mm: finish its batch before moving on */
+			ksm_process_batch(nr);
+			nr = 0;
+			continue;
+		}
+		scan_npages--;
+		ksm_batch[nr].rmap_item = rmap_item;
+		ksm_batch[nr].page = page;
+		if (++nr == KSM_SCAN_BATCH) {
+			ksm_process_batch(nr);
+			nr = 0;
+		}
 	}
+	if (nr)
+		ksm_process_batch(nr);
 }
 
 static int ksmd_should_run(void)
@@ -1769,12 +2157,20 @@ void ksm_migrate_page(struct page *newpage, struct page *oldpage)
 static struct stable_node *ksm_check_stable_tree(unsigned long start_pfn,
 						 unsigned long end_pfn)
 {
+	struct stable_node *stable_node;
 	struct rb_node *node;
-
-	for (node = rb_first(&root_stable_tree); node; node = rb_next(node)) {
-		struct stable_node *stable_node;
-
-		stable_node = rb_entry(node, struct stable_node, node);
+	int nid;
+
+	for (nid = 0; nid < ksm_nr_node_ids; nid++) {
+		for (node = rb_first(root_stable_tree + nid); node;
+						node = rb_next(node)) {
+			stable_node = rb_entry(node, struct stable_node, node);
+			if (stable_node->kpfn >= start_pfn &&
+			    stable_node->kpfn < end_pfn)
+				return stable_node;
+		}
+	}
+	list_for_each_entry(stable_node, &migrate_nodes, list) {
 		if (stable_node->kpfn >= start_pfn &&
 		    stable_node->kpfn < end_pfn)
 			return stable_node;
@@ -1925,6 +2321,203 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 }
 KSM_ATTR(run);
 
+static ssize_t scan_threads_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_scan_threads);
+}
+
+static ssize_t scan_threads_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct ksm_scan_worker *worker;
+	struct task_struct *task;
+	unsigned long nr;
+	int err;
+
+	err = strict_strtoul(buf, 10, &nr);
+	if (err || nr < 1 || nr > KSM_MAX_SCAN_THREADS)
+		return -EINVAL;
+
+	/* Holding ksm_thread_mutex, no batch can be in flight */
+	mutex_lock(&ksm_thread_mutex);
+	while (ksm_scan_threads < nr) {
+		worker = &ksm_workers[ksm_scan_threads - 1];
+		worker->seqnr = ksm_batch_seqnr;
+		task = kthread_run(ksm_scan_worker_thread, worker,
+				   "ksmd/%u", ksm_scan_threads);
+		if (IS_ERR(task)) {
+			err = PTR_ERR(task);
+			break;
+		}
+		worker->task = task;
+		ksm_scan_threads++;
+	}
+	while (ksm_scan_threads > nr) {
+		worker = &ksm_workers[--ksm_scan_threads - 1];
+		ksm_exited_runtime += worker->task->se.sum_exec_runtime;
+		kthread_stop(worker->task);
+		worker->task = NULL;
+	}
+	mutex_unlock(&ksm_thread_mutex);
+
+	return err ? err : count;
+}
+KSM_ATTR(scan_threads);
+
+#ifdef CONFIG_NUMA
+/*
+ * Remove a stable node which no rmap_item refers to any more.  Its ksm
+ * page may not have been freed yet, being in the swap cache or on its
+ * way out: it is then left as an ordinary anonymous page.
+ */
+static int remove_stable_node(struct stable_node *stable_node)
+{
+	struct page *page;
+	int err = 0;
+
+	page = get_ksm_page(stable_node);
+	if (!page)
+		return 0;	/* get_ksm_page() removed the stale node */
+
+	lock_page(page);
+	if (page_mapped(page))
+		err = -EBUSY;
+	else {
+		set_page_stable_node(page, NULL);
+		remove_node_from_stable_tree(stable_node);
+	}
+	unlock_page(page);
+	put_page(page);
+	return err;
+}
+
+/*
+ * Empty the stable trees and migrate_nodes of the nodes left over once
+ * nothing is shared, so that none survives into a different tree layout.
+ */
+static int remove_all_stable_nodes(void)
+{
+	struct stable_node *stable_node, *next;
+	struct rb_node *node;
+	int nid;
+
+	for (nid = 0; nid < ksm_nr_node_ids; nid++) {
+		while ((node = root_stable_tree[nid].rb_node)) {
+			stable_node = rb_entry(node, struct stable_node, node);
+			if (remove_stable_node(stable_node))
+				return -EBUSY;
+			cond_resched();
+		}
+	}
+	list_for_each_entry_safe(stable_node, next, &migrate_nodes, list) {
+		if (remove_stable_node(stable_node))
+			return -EBUSY;
+		cond_resched();
+	}
+	return 0;
+}
+
+static ssize_t merge_across_nodes_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_merge_across_nodes);
+}
+
+static ssize_t merge_across_nodes_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int err;
+	unsigned long knob;
+
+	err = strict_strtoul(buf, 10, &knob);
+	if (err)
+		return err;
+	if (knob > 1)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	if (ksm_merge_across_nodes != knob) {
+		/*
+		 * The stable trees are keyed by node only while merging
+		 * is restricted to within nodes: their layout cannot be
+		 * switched while any ksm pages remain in them, and the
+		 * stale nodes still linked into them must go first.
+		 */
+		if (ksm_pages_shared || remove_all_stable_nodes())
+			err = -EBUSY;
+		else {
+			ksm_merge_across_nodes = knob;
+			ksm_nr_node_ids = knob ? 1 : nr_node_ids;
+			ksm_stable_seqnr++;
+		}
+	}
+	mutex_unlock(&ksm_thread_mutex);
+
+	return err ? err : count;
+}
+KSM_ATTR(merge_across_nodes);
+
+/*
+ * Per-node breakdown of pages_shared and pages_sharing, by the node on
+ * which each ksm page currently resides.
+ */
+static ssize_t pages_per_node_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	unsigned long *shared, *sharing;
+	struct stable_node *stable_node;
+	struct rmap_item *rmap_item;
+	struct hlist_node *hlist;
+	struct rb_node *node;
+	ssize_t len = 0;
+	int nid, knid;
+
+	shared = kcalloc(2 * nr_node_ids, sizeof(unsigned long), GFP_KERNEL);
+	if (!shared)
+		return -ENOMEM;
+	sharing = shared + nr_node_ids;
+
+	mutex_lock(&ksm_thread_mutex);
+	for (nid = 0; nid < ksm_nr_node_ids; nid++) {
+		for (node = rb_first(root_stable_tree + nid); node;
+						node = rb_next(node)) {
+			stable_node = rb_entry(node, struct stable_node, node);
+			knid = pfn_to_nid(stable_node->kpfn);
+			hlist_for_each_entry(rmap_item, hlist,
+					     &stable_node->hlist, hlist) {
+				if (rmap_item->hlist.next)
+					sharing[knid]++;
+				else
+					shared[knid]++;
+			}
+		}
+	}
+	list_for_each_entry(stable_node, &migrate_nodes, list) {
+		knid = pfn_to_nid(stable_node->kpfn);
+		hlist_for_each_entry(rmap_item, hlist,
+				     &stable_node->hlist, hlist) {
+			if (rmap_item->hlist.next)
+				sharing[knid]++;
+			else
+				shared[knid]++;
+		}
+	}
+	mutex_unlock(&ksm_thread_mutex);
+
+	for_each_online_node(nid)
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "node %d shared %lu sharing %lu\n",
+				 nid, shared[nid], sharing[nid]);
+
+	kfree(shared);
+	return len;
+}
+KSM_ATTR_RO(pages_per_node);
+#endif
+
 static ssize_t pages_shared_show(struct kobject *kobj,
 				 struct kobj_attribute *attr, char *buf)
 {
@@ -1970,6 +2563,44 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_scanned_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_scanned);
+}
+KSM_ATTR_RO(pages_scanned);
+
+static ssize_t pages_skipped_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_skipped);
+}
+KSM_ATTR_RO(pages_skipped);
+
+static ssize_t scan_rate_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_scan_rate);
+}
+KSM_ATTR_RO(scan_rate);
+
+static ssize_t scan_cpu_msecs_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	u64 runtime;
+	int i;
+
+	mutex_lock(&ksm_thread_mutex);
+	runtime = ksm_exited_runtime + ksm_thread->se.sum_exec_runtime;
+	for (i = 0; i < ksm_scan_threads - 1; i++)
+		runtime += ksm_workers[i].task->se.sum_exec_runtime;
+	mutex_unlock(&ksm_thread_mutex);
+
+	do_div(runtime, NSEC_PER_MSEC);
+	return sprintf(buf, "%llu\n", (unsigned long long)runtime);
+}
+KSM_ATTR_RO(scan_cpu_msecs);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -1979,6 +2610,15 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&scan_threads_attr.attr,
+	&pages_scanned_attr.attr,
+	&pages_skipped_attr.attr,
+	&scan_rate_attr.attr,
+	&scan_cpu_msecs_attr.attr,
+#ifdef CONFIG_NUMA
+	&merge_across_nodes_attr.attr,
+	&pages_per_node_attr.attr,
+#endif
 	NULL,
 };
 
@@ -1990,8 +2630,13 @@ static struct attribute_group ksm_attr_group = {
 
 static int __init ksm_init(void)
 {
-	struct task_struct *ksm_thread;
 	int err;
+	int nid;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		root_stable_tree[nid] = RB_ROOT;
+		root_unstable_tree[nid] = RB_ROOT;
+	}
 
 	err = ksm_slab_init();
 	if (err)
@@ -48,6 +48,8 @@
 #include <linux/page_cgroup.h>
 #include <linux/cpu.h>
 #include <linux/oom.h>
+#include <linux/writeback.h>
+#include <linux/vmpressure.h>
 #include "internal.h"
 
 #include <asm/uaccess.h>
@@ -93,6 +95,9 @@ enum mem_cgroup_stat_index {
 	MEM_CGROUP_STAT_CACHE, 	   /* # of pages charged as cache */
 	MEM_CGROUP_STAT_RSS,	   /* # of pages charged as anon rss */
 	MEM_CGROUP_STAT_FILE_MAPPED,  /* # of pages charged as file rss */
+	MEM_CGROUP_STAT_FILE_DIRTY,	/* # of dirty pages in page cache */
+	MEM_CGROUP_STAT_FILE_WRITEBACK,	/* # of pages under writeback */
+	MEM_CGROUP_STAT_FILE_UNSTABLE_NFS, /* # of NFS unstable pages */
 	MEM_CGROUP_STAT_PGPGIN_COUNT,	/* # of pages paged in */
 	MEM_CGROUP_STAT_PGPGOUT_COUNT,	/* # of pages paged out */
 	MEM_CGROUP_STAT_SWAPOUT, /* # of pages, swapped out */
@@ -192,6 +197,17 @@ struct mem_cgroup_eventfd_list {
 static void mem_cgroup_threshold(struct mem_cgroup *mem);
 static void mem_cgroup_oom_notify(struct mem_cgroup *mem);
 
+/*
+ * Per-cgroup dirty page limits, with the same meaning as the vm.dirty_*
+ * sysctls: of each ratio/bytes pair, only one is non-zero at a time.
+ */
+struct vm_dirty_param {
+	int dirty_ratio;
+	int dirty_background_ratio;
+	unsigned long dirty_bytes;
+	unsigned long dirty_background_bytes;
+};
+
 /*
  * The memory controller data structure. The memory controller controls both
  * page cache and RSS per cgroup. We would eventually like to provide
@@ -237,6 +253,8 @@ struct mem_cgroup {
 	atomic_t	refcnt;
 
 	unsigned int	swappiness;
+	/* dirty page limits, protected by reclaim_param_lock */
+	struct vm_dirty_param dirty_param;
 	/* OOM-Killer disable */
 	int		oom_kill_disable;
 
@@ -255,6 +273,9 @@ struct mem_cgroup {
 	/* For oom notifier event fd */
 	struct list_head oom_notify;
 
+	/* For memory pressure notifier event fd */
+	struct vmpressure vmpressure;
+
 	/*
 	 * Should we move charges of a task when a task is moved into this
 	 * mem_cgroup ? And what type of charges should we move ?
@@ -356,7 +377,6 @@ enum charge_type {
 
 static void mem_cgroup_get(struct mem_cgroup *mem);
 static void mem_cgroup_put(struct mem_cgroup *mem);
-static struct mem_cgroup *parent_mem_cgroup(struct mem_cgroup *mem);
 static void drain_all_stock_async(void);
 
 static struct mem_cgroup_per_zone *
@@ -660,6 +680,31 @@ static void memcg_check_events(struct mem_cgroup *mem, struct page *page)
 	}
 }
 
+struct mem_cgroup *mem_cgroup_from_css(struct cgroup_subsys_state *css)
+{
+	return container_of(css, struct mem_cgroup, css);
+}
+
+/* Some nice accessors for the vmpressure. */
+struct vmpressure *memcg_to_vmpressure(struct mem_cgroup *mem)
+{
+	if (!mem)
+		mem = root_mem_cgroup;
+	if (!mem)
+		return NULL;
+	return &mem->vmpressure;
+}
+
+struct cgroup_subsys_state *vmpressure_to_css(struct vmpressure *vmpr)
+{
+	return &container_of(vmpr, struct mem_cgroup, vmpressure)->css;
+}
+
+struct vmpressure *css_to_vmpressure(struct cgroup_subsys_state *css)
+{
+	return &mem_cgroup_from_css(css)->vmpressure;
+}
+
 static struct mem_cgroup *mem_cgroup_from_cont(struct cgroup *cont)
 {
 	return container_of(cgroup_subsys_state(cont,
@@ -1643,6 +1688,28 @@ void mem_cgroup_update_page_stat(struct page *page,
 			ClearPageCgroupFileMapped(pc);
 		idx = MEM_CGROUP_STAT_FILE_MAPPED;
 		break;
+	/*
+	 * The dirty, writeback and unstable states are accounted once per
+	 * page, however many times the caller reports them.
+	 */
+	case MEMCG_NR_FILE_DIRTY:
+		if (val > 0 ? TestSetPageCgroupFileDirty(pc) :
+			      !TestClearPageCgroupFileDirty(pc))
+			goto out;
+		idx = MEM_CGROUP_STAT_FILE_DIRTY;
+		break;
+	case MEMCG_NR_FILE_WRITEBACK:
+		if (val > 0 ? TestSetPageCgroupFileWriteback(pc) :
+			      !TestClearPageCgroupFileWriteback(pc))
+			goto out;
+		idx = MEM_CGROUP_STAT_FILE_WRITEBACK;
+		break;
+	case MEMCG_NR_FILE_UNSTABLE_NFS:
+		if (val > 0 ? TestSetPageCgroupFileUnstableNFS(pc) :
+			      !TestClearPageCgroupFileUnstableNFS(pc))
+			goto out;
+		idx = MEM_CGROUP_STAT_FILE_UNSTABLE_NFS;
+		break;
 	default:
 		BUG();
 	}
@@ -2203,6 +2270,15 @@ void mem_cgroup_split_huge_fixup(struct page *head, struct page *tail)
 }
 #endif
 
+static void mem_cgroup_move_page_stat(struct mem_cgroup *from,
+	struct mem_cgroup *to, enum mem_cgroup_stat_index idx)
+{
+	preempt_disable();
+	__this_cpu_dec(from->stat->count[idx]);
+	__this_cpu_inc(to->stat->count[idx]);
+	preempt_enable();
+}
+
 /**
  * __mem_cgroup_move_account - move account of the page
  * @pc:	page_cgroup of the page.
@@ -2232,13 +2308,19 @@ static void __mem_cgroup_move_account(struct page_cgroup *pc,
 	VM_BUG_ON(!PageCgroupUsed(pc));
 	VM_BUG_ON(pc->mem_cgroup != from);
 
-	if (PageCgroupFileMapped(pc)) {
-		/* Update mapped_file data for mem_cgroup */
-		preempt_disable();
-		__this_cpu_dec(from->stat->count[MEM_CGROUP_STAT_FILE_MAPPED]);
-		__this_cpu_inc(to->stat->count[MEM_CGROUP_STAT_FILE_MAPPED]);
-		preempt_enable();
-	}
+	/* Update file I/O stats for mem_cgroup */
+	if (PageCgroupFileMapped(pc))
+		mem_cgroup_move_page_stat(from, to,
+					  MEM_CGROUP_STAT_FILE_MAPPED);
+	if (PageCgroupFileDirty(pc))
+		mem_cgroup_move_page_stat(from, to,
+					  MEM_CGROUP_STAT_FILE_DIRTY);
+	if (PageCgroupFileWriteback(pc))
+		mem_cgroup_move_page_stat(from, to,
+					  MEM_CGROUP_STAT_FILE_WRITEBACK);
+	if (PageCgroupFileUnstableNFS(pc))
+		mem_cgroup_move_page_stat(from, to,
+					  MEM_CGROUP_STAT_FILE_UNSTABLE_NFS);
 	mem_cgroup_charge_statistics(from, PageCgroupCache(pc), -nr_pages);
 	if (uncharge)
 		/* This is not "cancel", but cancel_charge does all we need. */
@@ -3657,6 +3739,9 @@ enum {
 	MCS_CACHE,
 	MCS_RSS,
 	MCS_FILE_MAPPED,
+	MCS_FILE_DIRTY,
+	MCS_WRITEBACK,
+	MCS_UNSTABLE_NFS,
 	MCS_PGPGIN,
 	MCS_PGPGOUT,
 	MCS_SWAP,
@@ -3679,6 +3764,9 @@ struct {
 	{"cache", "total_cache"},
 	{"rss", "total_rss"},
 	{"mapped_file", "total_mapped_file"},
+	{"dirty", "total_dirty"},
+	{"writeback", "total_writeback"},
+	{"nfs_unstable", "total_nfs_unstable"},
 	{"pgpgin", "total_pgpgin"},
 	{"pgpgout", "total_pgpgout"},
 	{"swap", "total_swap"},
@@ -3702,6 +3790,12 @@ mem_cgroup_get_local_stat(struct mem_cgroup *mem, struct mcs_total_stat *s)
 	s->stat[MCS_RSS] += val * PAGE_SIZE;
 	val = mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_FILE_MAPPED);
 	s->stat[MCS_FILE_MAPPED] += val * PAGE_SIZE;
+	val = mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_FILE_DIRTY);
+	s->stat[MCS_FILE_DIRTY] += val * PAGE_SIZE;
+	val = mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_FILE_WRITEBACK);
+	s->stat[MCS_WRITEBACK] += val * PAGE_SIZE;
+	val = mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_FILE_UNSTABLE_NFS);
+	s->stat[MCS_UNSTABLE_NFS] += val * PAGE_SIZE;
 	val = mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_PGPGIN_COUNT);
 	s->stat[MCS_PGPGIN] += val;
 	val = mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_PGPGOUT_COUNT);
@@ -3837,6 +3931,303 @@ static int mem_cgroup_swappiness_write(struct cgroup *cgrp, struct cftype *cft,
 	return 0;
 }
 
+/*
+ * The root cgroup has no limits of its own: it follows the vm.dirty_*
+ * sysctls, and so do the defaults of its children.
+ */
+static void get_vm_dirty_param(struct mem_cgroup *memcg,
+			       struct vm_dirty_param *param)
+{
+	if (mem_cgroup_is_root(memcg)) {
+		param->dirty_ratio = vm_dirty_ratio;
+		param->dirty_bytes = vm_dirty_bytes;
+		param->dirty_background_ratio = dirty_background_ratio;
+		param->dirty_background_bytes = dirty_background_bytes;
+		return;
+	}
+
+	spin_lock(&memcg->reclaim_param_lock);
+	*param = memcg->dirty_param;
+	spin_unlock(&memcg->reclaim_param_lock);
+}
+
+enum {
+	MEM_CGROUP_DIRTY_RATIO,
+	MEM_CGROUP_DIRTY_BYTES,
+	MEM_CGROUP_DIRTY_BACKGROUND_RATIO,
+	MEM_CGROUP_DIRTY_BACKGROUND_BYTES,
+};
+
+static u64 mem_cgroup_dirty_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+	struct vm_dirty_param param;
+
+	get_vm_dirty_param(memcg, &param);
+
+	switch (cft->private) {
+	case MEM_CGROUP_DIRTY_RATIO:
+		return param.dirty_ratio;
+	case MEM_CGROUP_DIRTY_BYTES:
+		return param.dirty_bytes;
+	case MEM_CGROUP_DIRTY_BACKGROUND_RATIO:
+		return param.dirty_background_ratio;
+	case MEM_CGROUP_DIRTY_BACKGROUND_BYTES:
+		return param.dirty_background_bytes;
+	default:
+		BUG();
+	}
+}
+
+static int mem_cgroup_dirty_write(struct cgroup *cgrp, struct cftype *cft,
+				  u64 val)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+	struct vm_dirty_param *param = &memcg->dirty_param;
+	int type = cft->private;
+
+	/* the root cgroup is controlled by the vm.dirty_* sysctls */
+	if (cgrp->parent == NULL)
+		return -EINVAL;
+
+	switch (type) {
+	case MEM_CGROUP_DIRTY_RATIO:
+	case MEM_CGROUP_DIRTY_BACKGROUND_RATIO:
+		if (val > 100)
+			return -EINVAL;
+		break;
+	case MEM_CGROUP_DIRTY_BYTES:
+		/* same lower bound as vm.dirty_bytes */
+		if (val < 2 * PAGE_SIZE)
+			return -EINVAL;
+		break;
+	}
+
+	/* setting one of a ratio/bytes pair clears the other one */
+	spin_lock(&memcg->reclaim_param_lock);
+	switch (type) {
+	case MEM_CGROUP_DIRTY_RATIO:
+		param->dirty_ratio = val;
+		param->dirty_bytes = 0;
+		break;
+	case MEM_CGROUP_DIRTY_BYTES:
+		param->dirty_bytes = val;
+		param->dirty_ratio = 0;
+		break;
+	case MEM_CGROUP_DIRTY_BACKGROUND_RATIO:
+		param->dirty_background_ratio = val;
+		param->dirty_background_bytes = 0;
+		break;
+	case MEM_CGROUP_DIRTY_BACKGROUND_BYTES:
+		param->dirty_background_bytes = val;
+		param->dirty_background_ratio = 0;
+		break;
+	default:
+		BUG();
+	}
+	spin_unlock(&memcg->reclaim_param_lock);
+
+	return 0;
+}
+
+static unsigned long mem_cgroup_page_stat(struct mem_cgroup *mem,
+					  enum mem_cgroup_stat_index idx)
+{
+	s64 val;
+
+	if (mem->use_hierarchy)
+		return mem_cgroup_get_recursive_idx_stat(mem, idx);
+
+	val = mem_cgroup_read_stat(mem, idx);
+	return val < 0 ? 0 : val;
+}
+
+/*
+ * The memory a cgroup can fill with dirty page cache: its file LRU pages
+ * plus what it may still charge before hitting its (hierarchical) limit.
+ */
+static unsigned long mem_cgroup_dirtyable_memory(struct mem_cgroup *mem)
+{
+	struct mem_cgroup *iter;
+	struct res_counter *res;
+	unsigned long long margin = RESOURCE_MAX;
+	unsigned long nr_pages = 0;
+
+	for_each_mem_cgroup_tree(iter, mem) {
+		nr_pages += mem_cgroup_get_local_zonestat(iter,
+							  LRU_INACTIVE_FILE);
+		nr_pages += mem_cgroup_get_local_zonestat(iter,
+							  LRU_ACTIVE_FILE);
+	}
+
+	for (res = &mem->res; res; res = res->parent)
+		margin = min(margin, res_counter_margin(res));
+	margin >>= PAGE_SHIFT;
+
+	return nr_pages + (unsigned long)min_t(unsigned long long, margin,
+					       ULONG_MAX - nr_pages);
+}
+
+static void __mem_cgroup_dirty_info(struct mem_cgroup *mem,
+				    struct mem_cgroup_dirty_info *info)
+{
+	struct vm_dirty_param param;
+	unsigned long available_mem;
+
+	get_vm_dirty_param(mem, &param);
+
+	available_mem = min(mem_cgroup_dirtyable_memory(mem),
+			    determine_dirtyable_memory());
+
+	if (param.dirty_bytes)
+		info->dirty_thresh = DIV_ROUND_UP(param.dirty_bytes, PAGE_SIZE);
+	else
+		info->dirty_thresh = (param.dirty_ratio * available_mem) / 100;
+
+	if (param.dirty_background_bytes)
+		info->background_thresh =
+			DIV_ROUND_UP(param.dirty_background_bytes, PAGE_SIZE);
+	else
+		info->background_thresh =
+			(param.dirty_background_ratio * available_mem) / 100;
+
+	if (info->background_thresh >= info->dirty_thresh)
+		info->background_thresh = info->dirty_thresh / 2;
+
+	info->nr_file_dirty = mem_cgroup_page_stat(mem,
+					MEM_CGROUP_STAT_FILE_DIRTY);
+	info->nr_writeback = mem_cgroup_page_stat(mem,
+					MEM_CGROUP_STAT_FILE_WRITEBACK);
+	info->nr_unstable_nfs = mem_cgroup_page_stat(mem,
+					MEM_CGROUP_STAT_FILE_UNSTABLE_NFS);
+	info->memcg_id = css_id(&mem->css);
+}
+
+/**
+ * mem_cgroup_dirty_info - dirty limits and state of current's memory cgroup
+ * @info: filled in with the cgroup's thresholds and dirty page counts
+ *
+ * Returns false if the task is in the root cgroup or the memory controller
+ * is disabled: only the global dirty limits apply then.  As for the global
+ * limits, PF_LESS_THROTTLE and real-time tasks get a quarter more.
+ */
+bool mem_cgroup_dirty_info(struct mem_cgroup_dirty_info *info)
+{
+	struct task_struct *tsk = current;
+	struct mem_cgroup *mem;
+
+	if (mem_cgroup_disabled())
+		return false;
+
+	rcu_read_lock();
+	mem = mem_cgroup_from_task(tsk);
+	if (!mem || mem_cgroup_is_root(mem) || !css_tryget(&mem->css)) {
+		rcu_read_unlock();
+		return false;
+	}
+	rcu_read_unlock();
+
+	__mem_cgroup_dirty_info(mem, info);
+	css_put(&mem->css);
+
+	if (tsk->flags & PF_LESS_THROTTLE || rt_task(tsk)) {
+		info->background_thresh += info->background_thresh / 4;
+		info->dirty_thresh += info->dirty_thresh / 4;
+	}
+	return true;
+}
+
+/*
+ * Called by the flusher doing background writeback on behalf of the
+ * memory cgroup @memcg_id, to tell when to stop.
+ */
+bool mem_cgroup_over_bground_thresh(unsigned short memcg_id)
+{
+	struct mem_cgroup_dirty_info info;
+	struct mem_cgroup *mem;
+
+	rcu_read_lock();
+	mem = mem_cgroup_lookup(memcg_id);
+	if (!mem || !css_tryget(&mem->css)) {
+		rcu_read_unlock();
+		return false;
+	}
+	rcu_read_unlock();
+
+	__mem_cgroup_dirty_info(mem, &info);
+	css_put(&mem->css);
+
+	return info.nr_file_dirty + info.nr_unstable_nfs >
+		info.background_thresh;
+}
+
+/*
+ * Record the memory cgroup of @page, which is being dirtied, in its
+ * mapping.  Called under mapping->tree_lock.
+ */
+void mem_cgroup_mark_inode_dirty(struct address_space *mapping,
+				 struct page *page)
+{
+	struct page_cgroup *pc;
+	struct mem_cgroup *mem;
+	unsigned short id;
+
+	if (mem_cgroup_disabled())
+		return;
+
+	pc = lookup_page_cgroup(page);
+	if (unlikely(!pc))
+		return;
+
+	rcu_read_lock();
+	mem = pc->mem_cgroup;
+	if (likely(mem && PageCgroupUsed(pc))) {
+		id = css_id(&mem->css);
+		if (!mapping->i_memcg)
+			mapping->i_memcg = id;
+		else if (mapping->i_memcg != id)
+			mapping->i_memcg = I_MEMCG_SHARED;
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * The inode has been written back and is clean: forget who dirtied it.
+ * Called under inode_lock.
+ */
+void mem_cgroup_clear_inode_dirty(struct address_space *mapping)
+{
+	mapping->i_memcg = 0;
+}
+
+/*
+ * Should the flusher write @mapping when doing writeback on behalf of the
+ * memory cgroup @memcg_id?  Yes if @memcg_id (or, with use_hierarchy, one
+ * of its descendants) dirtied it, and also whenever we cannot tell.
+ */
+bool mem_cgroup_should_writeback_mapping(struct address_space *mapping,
+					 unsigned short memcg_id)
+{
+	unsigned short id = mapping->i_memcg;
+	struct mem_cgroup *mem, *root;
+	bool ret;
+
+	if (!memcg_id || !id || id == I_MEMCG_SHARED || id == memcg_id)
+		return true;
+
+	rcu_read_lock();
+	mem = mem_cgroup_lookup(id);
+	root = mem_cgroup_lookup(memcg_id);
+	if (!mem || !root)
+		ret = true;
+	else
+		ret = root->use_hierarchy &&
+			css_is_ancestor(&mem->css, &root->css);
+	rcu_read_unlock();
+
+	return ret;
+}
+
 static void __mem_cgroup_threshold(struct mem_cgroup *memcg, bool swap)
 {
 	struct mem_cgroup_threshold_ary *t;
@@ -4218,6 +4609,35 @@ static struct cftype mem_cgroup_files[] = {
 		.read_u64 = mem_cgroup_swappiness_read,
 		.write_u64 = mem_cgroup_swappiness_write,
 	},
+	{
+		.name = "pressure_level",
+		.register_event = vmpressure_register_event,
+		.unregister_event = vmpressure_unregister_event,
+	},
+	{
+		.name = "dirty_ratio",
+		.read_u64 = mem_cgroup_dirty_read,
+		.write_u64 = mem_cgroup_dirty_write,
+		.private = MEM_CGROUP_DIRTY_RATIO,
+	},
+	{
+		.name = "dirty_bytes",
+		.read_u64 = mem_cgroup_dirty_read,
+		.write_u64 = mem_cgroup_dirty_write,
+		.private = MEM_CGROUP_DIRTY_BYTES,
+	},
+	{
+		.name = "dirty_background_ratio",
+		.read_u64 = mem_cgroup_dirty_read,
+		.write_u64 = mem_cgroup_dirty_write,
+		.private = MEM_CGROUP_DIRTY_BACKGROUND_RATIO,
+	},
+	{
+		.name = "dirty_background_bytes",
+		.read_u64 = mem_cgroup_dirty_read,
+		.write_u64 = mem_cgroup_dirty_write,
+		.private = MEM_CGROUP_DIRTY_BACKGROUND_BYTES,
+	},
 	{
 		.name = "move_charge_at_immigrate",
 		.read_u64 = mem_cgroup_move_charge_read,
@@ -4392,7 +4812,7 @@ static void mem_cgroup_put(struct mem_cgroup *mem)
 /*
  * Returns the parent mem_cgroup in memcgroup hierarchy with hierarchy enabled.
  */
-static struct mem_cgroup *parent_mem_cgroup(struct mem_cgroup *mem)
+struct mem_cgroup *parent_mem_cgroup(struct mem_cgroup *mem)
 {
 	if (!mem->res.parent)
 		return NULL;
@@ -4488,9 +4908,12 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 	mem->last_scanned_child = 0;
 	spin_lock_init(&mem->reclaim_param_lock);
 	INIT_LIST_HEAD(&mem->oom_notify);
+	vmpressure_init(&mem->vmpressure);
 
-	if (parent)
+	if (parent) {
 		mem->swappiness = get_swappiness(parent);
+		get_vm_dirty_param(parent, &mem->dirty_param);
+	}
 	atomic_set(&mem->refcnt, 1);
 	mem->move_charge_at_immigrate = 0;
 	mutex_init(&mem->thresholds_lock);
@@ -4514,6 +4937,7 @@ static void mem_cgroup_destroy(struct cgroup_subsys *ss,
 {
 	struct mem_cgroup *mem = mem_cgroup_from_cont(cont);
 
+	vmpressure_cleanup(&mem->vmpressure);
 	mem_cgroup_put(mem);
 }
 
@@ -4737,6 +5161,9 @@ static int mem_cgroup_count_precharge_pte_range(pmd_t *pmd,
 	pte_t *pte;
 	spinlock_t *ptl;
 
+	split_huge_page_pmd(walk->mm, addr, pmd);
+	if (pmd_none_or_clear_bad(pmd))
+		return 0;
 	VM_BUG_ON(pmd_trans_huge(*pmd));
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; pte++, addr += PAGE_SIZE)
@@ -4899,6 +5326,9 @@ static int mem_cgroup_move_charge_pte_range(pmd_t *pmd,
 	pte_t *pte;
 	spinlock_t *ptl;
 
+	split_huge_page_pmd(walk->mm, addr, pmd);
+	if (pmd_none_or_clear_bad(pmd))
+		return 0;
 retry:
 	VM_BUG_ON(pmd_trans_huge(*pmd));
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
@@ -57,6 +57,7 @@
 #include <linux/swapops.h>
 #include <linux/elf.h>
 #include <linux/gfp.h>
+#include <linux/mempolicy.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -1017,9 +1018,10 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		next = pmd_addr_end(addr, end);
 		if (pmd_trans_huge(*pmd)) {
 			if (next-addr != HPAGE_PMD_SIZE) {
-				VM_BUG_ON(!rwsem_is_locked(&tlb->mm->mmap_sem));
-				split_huge_page_pmd(vma->vm_mm, pmd);
-			} else if (zap_huge_pmd(tlb, vma, pmd)) {
+				VM_BUG_ON(!vma_is_huge_file(vma) &&
+					  !rwsem_is_locked(&tlb->mm->mmap_sem));
+				split_huge_page_pmd(vma->vm_mm, addr, pmd);
+			} else if (zap_huge_pmd(tlb, vma, pmd, addr)) {
 				(*zap_work)--;
 				continue;
 			}
@@ -1307,8 +1309,14 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 		goto out;
 	}
 	if (pmd_trans_huge(*pmd)) {
-		if (flags & FOLL_SPLIT) {
-			split_huge_page_pmd(mm, pmd);
+		/*
+		 * A huge pmd of a file mapping maps small pages, nothing to
+		 * split for FOLL_SPLIT; but mlock wants the range in ptes.
+		 */
+		if (vma_is_huge_file(vma) ?
+		    (flags & FOLL_MLOCK && vma->vm_flags & VM_LOCKED) :
+		    (flags & FOLL_SPLIT)) {
+			split_huge_page_pmd(mm, address, pmd);
 			goto split_fallthrough;
 		}
 		spin_lock(&mm->page_table_lock);
@@ -1327,7 +1335,7 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 		/* fall through */
 	}
 split_fallthrough:
-	if (unlikely(pmd_bad(*pmd)))
+	if (unlikely(pmd_none(*pmd) || pmd_bad(*pmd)))
 		goto no_page_table;
 
 	ptep = pte_offset_map_lock(mm, pmd, address, &ptl);
@@ -3206,6 +3214,70 @@ static int do_nonlinear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * The pte was made inaccessible by change_prot_numa() to sample which
+ * node the page is accessed from: give the access back, account the
+ * fault to the task and move the page to this node if it is misplaced.
+ *
+ * We enter with non-exclusive mmap_sem, and pte mapped but not yet locked.
+ * We return with mmap_sem still held, but pte unmapped and unlocked.
+ */
+static int do_numa_page(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, pte_t *page_table, pmd_t *pmd,
+		pte_t orig_pte)
+{
+	struct page *page;
+	spinlock_t *ptl;
+	pte_t entry;
+	int page_nid, target_nid;
+	bool migrated = false;
+
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (unlikely(!pte_same(*page_table, orig_pte))) {
+		pte_unmap_unlock(page_table, ptl);
+		return 0;
+	}
+	/* access is only being given back: no tlb flush is needed */
+	entry = pte_mkyoung(pte_modify(orig_pte, vma->vm_page_prot));
+	set_pte_at(mm, address, page_table, entry);
+	update_mmu_cache(vma, address, page_table);
+
+	page = vm_normal_page(vma, address, entry);
+	if (!page) {
+		pte_unmap_unlock(page_table, ptl);
+		return 0;
+	}
+	get_page(page);
+	pte_unmap_unlock(page_table, ptl);
+
+	count_vm_event(NUMA_HINT_FAULTS);
+	page_nid = page_to_nid(page);
+	if (page_nid == numa_node_id())
+		count_vm_event(NUMA_HINT_FAULTS_LOCAL);
+
+	target_nid = mpol_misplaced(page, vma, address);
+	if (target_nid == -1)
+		put_page(page);
+	else if (!migrate_misplaced_page(page, target_nid)) {
+		page_nid = target_nid;
+		migrated = true;
+	}
+
+	task_numa_fault(page_nid, 1, migrated);
+	return 0;
+}
+#else
+static inline int do_numa_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		pte_t *page_table, pmd_t *pmd, pte_t orig_pte)
+{
+	BUG();
+	return 0;
+}
+#endif
+
 /*
  * These routines also need to handle stuff like marking pages dirty
  * and/or accessed for architectures that don't do it in hardware (most
@@ -3244,6 +3316,9 @@ int handle_pte_fault(struct mm_struct *mm,
 					pte, pmd, flags, entry);
 	}
 
+	if (pte_numa(vma, entry))
+		return do_numa_page(mm, vma, address, pte, pmd, entry);
+
 	ptl = pte_lockptr(mm, pmd);
 	spin_lock(ptl);
 	if (unlikely(!pte_same(*pte, entry)))
@@ -3300,7 +3375,11 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
+	if (pmd_none(*pmd) && vma_is_huge_file(vma)) {
+		int ret = vma->vm_ops->pmd_fault(vma, address, pmd, flags);
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	} else if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
 		if (!vma->vm_ops)
 			return do_huge_pmd_anonymous_page(mm, vma, address,
 							  pmd, flags);
@@ -3310,10 +3389,14 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 		if (pmd_trans_huge(orig_pmd)) {
 			if (flags & FAULT_FLAG_WRITE &&
 			    !pmd_write(orig_pmd) &&
-			    !pmd_trans_splitting(orig_pmd))
-				return do_huge_pmd_wp_page(mm, vma, address,
-							   pmd, orig_pmd);
-			return 0;
+			    !pmd_trans_splitting(orig_pmd)) {
+				if (!vma_is_huge_file(vma))
+					return do_huge_pmd_wp_page(mm, vma,
+							address, pmd, orig_pmd);
+				/* let the pte path sort out the write */
+				split_huge_page_pmd(mm, address, pmd);
+			} else
+				return 0;
 		}
 	}
 
@@ -3338,6 +3421,182 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Can a fault at @address in @vma be handled speculatively?  Only the
+ * first touch of private anonymous memory is: such a fault needs nothing
+ * but the vma and the page tables, and it is the fault that threads
+ * touching freshly mmap()ed memory take all the time.
+ */
+static bool vma_can_speculate(struct vm_area_struct *vma,
+			      unsigned long address, unsigned int flags)
+{
+	if (!vma)
+		return false;
+	/*
+	 * find_vma_speculative() checked vm_end before vm_sequence was
+	 * sampled: vma_adjust() may have shrunk the vma since.
+	 */
+	if (address < vma->vm_start || address >= vma->vm_end)
+		return false;
+	if (vma->vm_ops || vma->vm_file)
+		return false;
+	if (vma->vm_flags & (VM_SHARED | VM_LOCKED | VM_GROWSDOWN |
+			     VM_GROWSUP | VM_HUGETLB | VM_PFNMAP | VM_MIXEDMAP))
+		return false;
+	/* the page has to be allocated without looking at the vma */
+	if (vma_policy(vma))
+		return false;
+	if (flags & FAULT_FLAG_WRITE)
+		return (vma->vm_flags & VM_WRITE) && vma->anon_vma;
+	return vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE);
+}
+
+/*
+ * Handle a page fault without mmap_sem.
+ *
+ * The vma is looked up under mm->mm_rb_lock, which keeps it in the tree,
+ * and thus the page tables covering it in place, until we are done.  Its
+ * fields are validated against vma->vm_sequence, which writers holding
+ * mmap_sem bump around any change to them, once the pte lock is held:
+ * anyone changing the vma after that point takes the pte lock to fix up
+ * the ptes, and sees ours.  Interrupts are disabled while walking the
+ * page tables, so that khugepaged cannot take a page table away from
+ * under us: it waits for the TLB flush IPI first.  For the same reason
+ * the pte lock is only trylocked.
+ *
+ * Returns 0 if the fault was handled, or VM_FAULT_RETRY if it has to be
+ * handled the regular way, with mmap_sem held.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_area_struct *vma;
+	struct page *page = NULL;
+	unsigned long irqflags;
+	unsigned int seq;
+	spinlock_t *ptl;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, pmdval;
+	pte_t *pte, entry;
+	int ret = VM_FAULT_RETRY;
+
+	if (atomic_read(&mm->spf_disable))
+		return VM_FAULT_RETRY;
+
+	/* Don't allocate a page for a fault we cannot handle anyway */
+	read_lock(&mm->mm_rb_lock);
+	vma = find_vma_speculative(mm, address);
+	if (!vma_can_speculate(vma, address, flags)) {
+		read_unlock(&mm->mm_rb_lock);
+		return VM_FAULT_RETRY;
+	}
+	read_unlock(&mm->mm_rb_lock);
+
+	if (flags & FAULT_FLAG_WRITE) {
+		page = alloc_zeroed_user_highpage_movable(NULL, address);
+		if (!page)
+			return VM_FAULT_RETRY;
+		__SetPageUptodate(page);
+		if (mem_cgroup_newpage_charge(page, mm, GFP_KERNEL)) {
+			page_cache_release(page);
+			return VM_FAULT_RETRY;
+		}
+	}
+
+	/* The vma may have changed or gone away meanwhile: look again */
+	read_lock(&mm->mm_rb_lock);
+	vma = find_vma_speculative(mm, address);
+	if (!vma)
+		goto out_unlock;
+	seq = ACCESS_ONCE(vma->vm_sequence.sequence);
+	smp_rmb();
+	if ((seq & 1) || !vma_can_speculate(vma, address, flags))
+		goto out_unlock;
+
+	if (page) {
+		entry = mk_pte(page, vma->vm_page_prot);
+		entry = pte_mkwrite(pte_mkdirty(entry));
+	} else
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+						vma->vm_page_prot));
+
+	local_irq_save(irqflags);
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto out_irq;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		goto out_irq;
+	pmd = pmd_offset(pud, address);
+	pmdval = *pmd;
+	barrier();
+	/* Page table allocation and huge pmds are left to the regular path */
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval) ||
+	    unlikely(pmd_bad(pmdval)))
+		goto out_irq;
+
+	ptl = pte_lockptr(mm, &pmdval);
+	pte = pte_offset_map(&pmdval, address);
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		goto out_irq;
+	}
+	/*
+	 * With the pte lock held and the pmd unchanged, the page table
+	 * stays: khugepaged takes the lock before it isolates the ptes.
+	 */
+	if (!pmd_same(*pmd, pmdval)) {
+		pte_unmap_unlock(pte, ptl);
+		goto out_irq;
+	}
+	local_irq_restore(irqflags);
+
+	if (!pte_none(*pte))
+		goto out_pte;
+	if (read_seqcount_retry(&vma->vm_sequence, seq) ||
+	    atomic_read(&mm->spf_disable))
+		goto out_pte;
+	/* Still inside the vma whose vm_page_prot the entry was built from? */
+	if (address < ACCESS_ONCE(vma->vm_start) ||
+	    address >= ACCESS_ONCE(vma->vm_end))
+		goto out_pte;
+
+	if (page) {
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(page, vma, address);
+		page = NULL;
+	}
+	set_pte_at(mm, address, pte, entry);
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, address, pte);
+	ret = 0;
+out_pte:
+	pte_unmap_unlock(pte, ptl);
+	goto out_unlock;
+out_irq:
+	local_irq_restore(irqflags);
+out_unlock:
+	read_unlock(&mm->mm_rb_lock);
+
+	if (page) {
+		mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+	}
+	if (ret) {
+		count_vm_event(SPECULATIVE_PGFAULT_ABORT);
+		return ret;
+	}
+
+	__set_current_state(TASK_RUNNING);
+	count_vm_event(PGFAULT);
+	count_vm_event(SPECULATIVE_PGFAULT);
+	check_sync_rss_stat(current);
+	return 0;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -514,7 +514,7 @@ static inline int check_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		split_huge_page_pmd(vma->vm_mm, pmd);
+		split_huge_page_pmd(vma->vm_mm, addr, pmd);
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		if (check_pte_range(vma, pmd, addr, next, nodes,
@@ -625,7 +625,9 @@ static int policy_vma(struct vm_area_struct *vma, struct mempolicy *new)
 		err = vma->vm_ops->set_policy(vma, new);
 	if (!err) {
 		mpol_get(new);
+		vma_write_begin(vma);
 		vma->vm_policy = new;
+		vma_write_end(vma);
 		mpol_put(old);
 	}
 	return err;
@@ -1898,6 +1900,202 @@ struct page *alloc_pages_current(gfp_t gfp, unsigned order)
 }
 EXPORT_SYMBOL(alloc_pages_current);
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Automatic NUMA balancing: task_numa_work() periodically passes ranges
+ * of a task's address space to change_prot_numa(), which takes away the
+ * access rights of their ptes.  The next access to such a page raises a
+ * NUMA hinting fault (do_numa_page), telling which node the page is used
+ * from: mpol_misplaced() decides whether the page belongs there instead,
+ * and migrate_misplaced_page() moves it.
+ */
+static unsigned long change_prot_numa_pte_range(struct vm_area_struct *vma,
+			pmd_t *pmd, unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pgprot_t prot_none = vma_prot_none(vma);
+	unsigned long pages = 0;
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	arch_enter_lazy_mmu_mode();
+	do {
+		pte_t ptent = *pte;
+		struct page *page;
+
+		if (!pte_present(ptent) || pte_numa(vma, ptent))
+			continue;
+		/* only pages mpol_misplaced() might move are worth a fault */
+		page = vm_normal_page(vma, addr, ptent);
+		if (!page || PageKsm(page) || page_mapcount(page) != 1)
+			continue;
+		ptent = ptep_modify_prot_start(mm, addr, pte);
+		ptent = pte_modify(ptent, prot_none);
+		ptep_modify_prot_commit(mm, addr, pte, ptent);
+		pages++;
+	} while (pte++, addr += PAGE_SIZE, addr != end);
+	arch_leave_lazy_mmu_mode();
+	pte_unmap_unlock(pte - 1, ptl);
+
+	return pages;
+}
+
+static unsigned long change_prot_numa_pmd_range(struct vm_area_struct *vma,
+			pud_t *pud, unsigned long addr, unsigned long end)
+{
+	unsigned long next, pages = 0;
+	pmd_t *pmd;
+
+	pmd = pmd_offset(pud, addr);
+	do {
+		pmd_t pmdval;
+
+		next = pmd_addr_end(addr, end);
+		/*
+		 * With mmap_sem only held for read, a none pmd may be filled
+		 * under us, even by a huge pmd: look at it only once.  Huge
+		 * pmds are left alone.
+		 */
+		pmdval = *pmd;
+		barrier();
+		if (pmd_none(pmdval) || pmd_trans_huge(pmdval) ||
+		    unlikely(pmd_bad(pmdval)))
+			continue;
+		pages += change_prot_numa_pte_range(vma, pmd, addr, next);
+	} while (pmd++, addr = next, addr != end);
+
+	return pages;
+}
+
+static unsigned long change_prot_numa_pud_range(struct vm_area_struct *vma,
+			pgd_t *pgd, unsigned long addr, unsigned long end)
+{
+	unsigned long next, pages = 0;
+	pud_t *pud;
+
+	pud = pud_offset(pgd, addr);
+	do {
+		next = pud_addr_end(addr, end);
+		if (pud_none_or_clear_bad(pud))
+			continue;
+		pages += change_prot_numa_pmd_range(vma, pud, addr, next);
+	} while (pud++, addr = next, addr != end);
+
+	return pages;
+}
+
+/**
+ * change_prot_numa - arm NUMA hinting faults on a range of a vma
+ * @vma: the vma, of current->mm
+ * @start: start of the range
+ * @end: end of the range
+ *
+ * Called with mmap_sem held for read.  Returns the number of ptes changed.
+ */
+unsigned long change_prot_numa(struct vm_area_struct *vma,
+			unsigned long start, unsigned long end)
+{
+	unsigned long addr = start, next, pages = 0;
+	pgd_t *pgd;
+
+	if (!(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+		return 0;
+
+	pgd = pgd_offset(vma->vm_mm, addr);
+	flush_cache_range(vma, start, end);
+	do {
+		next = pgd_addr_end(addr, end);
+		if (pgd_none_or_clear_bad(pgd))
+			continue;
+		pages += change_prot_numa_pud_range(vma, pgd, addr, next);
+	} while (pgd++, addr = next, addr != end);
+
+	if (pages) {
+		flush_tlb_range(vma, start, end);
+		count_vm_events(NUMA_PTE_UPDATES, pages);
+	}
+	return pages;
+}
+
+/**
+ * mpol_misplaced - check whether a page should move to the faulting node
+ * @page: the page, which took a NUMA hinting fault
+ * @vma: vma of current->mm mapping the page
+ * @addr: virtual address it is mapped at
+ *
+ * Only pages under the default, local allocation policy are balanced:
+ * explicit policies are left to place pages as they were asked to.  To
+ * avoid bouncing pages between the nodes of threads sharing them, a page
+ * is only pulled to the node the task was found to prefer, once it has one.
+ *
+ * Returns the node to migrate the page to, or -1 if it is fine where it is.
+ */
+int mpol_misplaced(struct page *page, struct vm_area_struct *vma,
+		   unsigned long addr)
+{
+	int thisnid = numa_node_id();
+	struct mempolicy *pol;
+	int target = -1;
+
+	if (page_to_nid(page) == thisnid)
+		return -1;
+	if (PageKsm(page) || page_mapcount(page) != 1)
+		return -1;
+	if (current->numa_preferred_nid != -1 &&
+	    current->numa_preferred_nid != thisnid)
+		return -1;
+	if (!node_isset(thisnid, cpuset_current_mems_allowed))
+		return -1;
+
+	pol = get_vma_policy(current, vma, addr);
+	if (pol->mode == MPOL_PREFERRED && (pol->flags & MPOL_F_LOCAL))
+		target = thisnid;
+	mpol_cond_put(pol);
+
+	return target;
+}
+
+static struct page *alloc_misplaced_dst_page(struct page *page,
+			unsigned long node, int **result)
+{
+	return alloc_pages_exact_node(node, GFP_HIGHUSER_MOVABLE |
+				      __GFP_THISNODE | __GFP_NOMEMALLOC |
+				      __GFP_NORETRY | __GFP_NOWARN, 0);
+}
+
+/**
+ * migrate_misplaced_page - move a page to the node accessing it
+ * @page: the page, on which the caller holds a reference
+ * @node: the node to move it to
+ *
+ * The caller's reference is dropped.  Migration is not retried if the
+ * page is busy or the node is short of memory: the next hinting fault on
+ * the page will try again.  Returns 0 if the page was moved.
+ */
+int migrate_misplaced_page(struct page *page, int node)
+{
+	LIST_HEAD(pagelist);
+	int isolated;
+
+	isolated = !isolate_lru_page(page);
+	/* isolation holds a reference of its own, which migration expects */
+	put_page(page);
+	if (!isolated)
+		return -EBUSY;
+
+	list_add(&page->lru, &pagelist);
+	inc_zone_page_state(page, NR_ISOLATED_ANON + page_is_file_cache(page));
+	if (migrate_pages(&pagelist, alloc_misplaced_dst_page, node,
+			  false, false)) {
+		putback_lru_pages(&pagelist);
+		return -EAGAIN;
+	}
+	count_vm_event(NUMA_PAGE_MIGRATE);
+	return 0;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /*
  * If mpol_dup() sees current->cpuset == cpuset_being_rebound, then it
  * rebinds the mempolicy its copying by calling mpol_rebind_policy()
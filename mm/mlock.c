@@ -370,9 +370,11 @@ success:
 	 * set VM_LOCKED, __mlock_vma_pages_range will bring it back.
 	 */
 
-	if (lock)
+	if (lock) {
+		vma_write_begin(vma);
 		vma->vm_flags = newflags;
-	else
+		vma_write_end(vma);
+	} else
 		munlock_vma_pages_range(vma, start, end);
 
 out:
@@ -460,6 +460,42 @@ check:
 	return NULL;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Check that page cache @page is mapped at @address in @mm by a huge pmd
+ * covering its whole extent (see do_huge_pmd_file_page), which
+ * page_check_address() does not look at.  On success returns with
+ * mm->page_table_lock held.
+ */
+static pmd_t *page_check_address_file_pmd(struct page *page,
+					  struct mm_struct *mm,
+					  unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+
+	pmd = pmd_offset(pud, address);
+	if (!pmd_trans_huge(*pmd))
+		return NULL;
+
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) && pmd_page(*pmd) +
+	    ((address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT) == page)
+		return pmd;
+	spin_unlock(&mm->page_table_lock);
+	return NULL;
+}
+#endif
+
 /**
  * page_mapped_in_vma - check whether a page is really mapped in a VMA
  * @page: the page to test
@@ -496,10 +532,9 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 {
 	struct mm_struct *mm = vma->vm_mm;
 	int referenced = 0;
+	pmd_t *pmd;
 
 	if (unlikely(PageTransHuge(page))) {
-		pmd_t *pmd;
-
 		spin_lock(&mm->page_table_lock);
 		/*
 		 * rmap might return false positives; we must filter
@@ -523,6 +558,29 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 		if (pmdp_clear_flush_young_notify(vma, address, pmd))
 			referenced++;
 		spin_unlock(&mm->page_table_lock);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	} else if (vma_is_huge_file(vma) &&
+		   (pmd = page_check_address_file_pmd(page, mm, address))) {
+		if (vma->vm_flags & VM_LOCKED) {
+			spin_unlock(&mm->page_table_lock);
+			*mapcount = 0;	/* break early from loop */
+			*vm_flags |= VM_LOCKED;
+			goto out;
+		}
+
+		/*
+		 * The young bit of the pmd stands for all pages of the
+		 * extent: let only the first page clear it, so that the
+		 * others still see the reference.
+		 */
+		if (page == pmd_page(*pmd)) {
+			if (pmdp_clear_flush_young_notify(vma,
+					address & HPAGE_PMD_MASK, pmd))
+				referenced++;
+		} else if (pmd_young(*pmd))
+			referenced++;
+		spin_unlock(&mm->page_table_lock);
+#endif
 	} else {
 		pte_t *pte;
 		spinlock_t *ptl;
@@ -1012,6 +1070,52 @@ void page_remove_rmap(struct page *page)
  * Subfunctions of try_to_unmap: try_to_unmap_one called
  * repeatedly from either try_to_unmap_anon or try_to_unmap_file.
  */
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Unmapping a page cache page mapped by a huge pmd unmaps its extent from
+ * the vma: the other pages are faulted back in with ptes when used.
+ */
+static int try_to_unmap_file_pmd(struct page *page,
+				 struct vm_area_struct *vma,
+				 unsigned long address, enum ttu_flags flags)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pmd_t *pmd;
+
+	pmd = page_check_address_file_pmd(page, mm, address);
+	if (!pmd)
+		return SWAP_AGAIN;
+
+	if (!(flags & TTU_IGNORE_MLOCK) && (vma->vm_flags & VM_LOCKED)) {
+		spin_unlock(&mm->page_table_lock);
+		return SWAP_MLOCK;
+	}
+	if (TTU_ACTION(flags) == TTU_MUNLOCK) {
+		spin_unlock(&mm->page_table_lock);
+		return SWAP_AGAIN;
+	}
+	if (!(flags & TTU_IGNORE_ACCESS) &&
+	    pmdp_clear_flush_young_notify(vma, address & HPAGE_PMD_MASK,
+					  pmd)) {
+		spin_unlock(&mm->page_table_lock);
+		return SWAP_FAIL;
+	}
+
+	/* i_mmap_lock is held: unmap_huge_file_pmd() could sleep */
+	__unmap_huge_file_pmd(vma, address & HPAGE_PMD_MASK, pmd);
+	spin_unlock(&mm->page_table_lock);
+	return SWAP_AGAIN;
+}
+#else
+static inline int try_to_unmap_file_pmd(struct page *page,
+					struct vm_area_struct *vma,
+					unsigned long address,
+					enum ttu_flags flags)
+{
+	return SWAP_AGAIN;
+}
+#endif
+
 int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 		     unsigned long address, enum ttu_flags flags)
 {
@@ -1022,8 +1126,11 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	int ret = SWAP_AGAIN;
 
 	pte = page_check_address(page, mm, address, &ptl, 0);
-	if (!pte)
+	if (!pte) {
+		if (vma_is_huge_file(vma))
+			ret = try_to_unmap_file_pmd(page, vma, address, flags);
 		goto out;
+	}
 
 	/*
 	 * If the page is mlock()d, we cannot swap it out.
@@ -57,6 +57,9 @@ static struct vfsmount *shm_mnt;
 #include <linux/namei.h>
 #include <linux/ctype.h>
 #include <linux/migrate.h>
+#include <linux/pagevec.h>
+#include <linux/mm_inline.h>
+#include <linux/khugepaged.h>
 #include <linux/highmem.h>
 #include <linux/seq_file.h>
 #include <linux/magic.h>
@@ -65,6 +68,8 @@ static struct vfsmount *shm_mnt;
 #include <asm/div64.h>
 #include <asm/pgtable.h>
 
+#include "internal.h"
+
 /*
  * The maximum size of a shmem/tmpfs file is limited by the maximum size of
  * its triple-indirect swap vector - see illustration at shmem_swp_entry().
@@ -99,6 +104,55 @@ static struct vfsmount *shm_mnt;
 /* Pretend that each entry is of this size in directory's i_size */
 #define BOGO_DIRENT_SIZE 20
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/* Values for sbinfo->huge, as set by the huge= mount option */
+#define SHMEM_HUGE_NEVER	0
+#define SHMEM_HUGE_ALWAYS	1
+#define SHMEM_HUGE_WITHIN_SIZE	2
+/* Values for shmem_huge only, overriding the option of every mount */
+#define SHMEM_HUGE_DENY		(-1)
+#define SHMEM_HUGE_FORCE	(-2)
+
+/* Policy of the internal mount (SysV shm, shared anonymous memory) */
+static int shmem_huge __read_mostly;
+
+#if defined(CONFIG_TMPFS) || defined(CONFIG_SYSFS)
+static int shmem_parse_huge(const char *str)
+{
+	if (!strcmp(str, "never"))
+		return SHMEM_HUGE_NEVER;
+	if (!strcmp(str, "always"))
+		return SHMEM_HUGE_ALWAYS;
+	if (!strcmp(str, "within_size"))
+		return SHMEM_HUGE_WITHIN_SIZE;
+	if (!strcmp(str, "deny"))
+		return SHMEM_HUGE_DENY;
+	if (!strcmp(str, "force"))
+		return SHMEM_HUGE_FORCE;
+	return -EINVAL;
+}
+
+static const char *shmem_format_huge(int huge)
+{
+	switch (huge) {
+	case SHMEM_HUGE_NEVER:
+		return "never";
+	case SHMEM_HUGE_ALWAYS:
+		return "always";
+	case SHMEM_HUGE_WITHIN_SIZE:
+		return "within_size";
+	case SHMEM_HUGE_DENY:
+		return "deny";
+	case SHMEM_HUGE_FORCE:
+		return "force";
+	default:
+		VM_BUG_ON(1);
+		return "bad_val";
+	}
+}
+#endif
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 /* Flag allocation requirements to shmem_getpage and shmem_swp_alloc */
 enum sgp_type {
 	SGP_READ,	/* don't exceed i_size, don't allocate page */
@@ -1181,6 +1235,23 @@ static struct page *shmem_alloc_page(gfp_t gfp,
 	 */
 	return alloc_page_vma(gfp, &pvma, 0);
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, unsigned long idx)
+{
+	struct vm_area_struct pvma;
+
+	/* Create a pseudo vma that just contains the policy */
+	pvma.vm_start = 0;
+	pvma.vm_pgoff = idx;
+	pvma.vm_ops = NULL;
+	pvma.vm_policy = mpol_shared_policy_lookup(&info->policy, idx);
+
+	return alloc_pages_vma(gfp, HPAGE_PMD_ORDER, &pvma, 0,
+			       numa_node_id());
+}
+#endif
 #else /* !CONFIG_NUMA */
 #ifdef CONFIG_TMPFS
 static inline void shmem_show_mpol(struct seq_file *seq, struct mempolicy *p)
@@ -1199,6 +1270,14 @@ static inline struct page *shmem_alloc_page(gfp_t gfp,
 {
 	return alloc_page(gfp);
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static inline struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, unsigned long idx)
+{
+	return alloc_pages(gfp, HPAGE_PMD_ORDER);
+}
+#endif
 #endif /* CONFIG_NUMA */
 
 #if !defined(CONFIG_NUMA) || !defined(CONFIG_TMPFS)
@@ -1214,23 +1293,28 @@ static inline struct mempolicy *shmem_get_sbmpol(struct shmem_sb_info *sbinfo)
  * If we allocate a new one we do not mark it dirty. That's up to the
  * vm. If we swap it in we mark it dirty since we also free the swap
  * entry since a page cannot live in both the swap and page cache
+ *
+ * __shmem_getpage may be given a page, already charged to the memcg, to
+ * use if one has to be allocated: it is freed if not used.
  */
-static int shmem_getpage(struct inode *inode, unsigned long idx,
-			struct page **pagep, enum sgp_type sgp, int *type)
+static int __shmem_getpage(struct inode *inode, unsigned long idx,
+			struct page **pagep, enum sgp_type sgp, int *type,
+			struct page *prealloc_page)
 {
 	struct address_space *mapping = inode->i_mapping;
 	struct shmem_inode_info *info = SHMEM_I(inode);
 	struct shmem_sb_info *sbinfo;
 	struct page *filepage = *pagep;
 	struct page *swappage;
-	struct page *prealloc_page = NULL;
 	swp_entry_t *entry;
 	swp_entry_t swap;
 	gfp_t gfp;
 	int error;
 
-	if (idx >= SHMEM_MAX_INDEX)
-		return -EFBIG;
+	if (idx >= SHMEM_MAX_INDEX) {
+		error = -EFBIG;
+		goto out;
+	}
 
 	if (type)
 		*type = 0;
@@ -1506,6 +1590,318 @@ out:
 	return error;
 }
 
+static int shmem_getpage(struct inode *inode, unsigned long idx,
+			struct page **pagep, enum sgp_type sgp, int *type)
+{
+	return __shmem_getpage(inode, idx, pagep, sgp, type, NULL);
+}
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Huge pages for shmem: an extent of HPAGE_PMD_NR pages, allocated as one
+ * hugepage aligned block and split into small pages, backs a hugepage
+ * aligned range of the file.  The pages go through the page cache, swap,
+ * truncation and migration like any other shmem page; when all of them
+ * are in place, a shared mapping of the range maps them with one huge
+ * pmd (do_huge_pmd_file_page), which is simply unmapped whenever the
+ * range has to be handled page by page.
+ */
+struct shmem_extent {
+	struct page *pages;		/* first page of the split extent */
+	pgoff_t index;			/* hugepage aligned index it backs */
+	DECLARE_BITMAP(used, HPAGE_PMD_NR);	/* pages handed out */
+};
+
+/*
+ * Whether the range of @inode at hugepage aligned @index may be backed by
+ * an extent, according to the huge= mount option and shmem_enabled.
+ */
+static bool shmem_huge_allowed(struct inode *inode, pgoff_t index)
+{
+	pgoff_t size;
+
+	if (shmem_huge == SHMEM_HUGE_FORCE)
+		return true;
+	if (shmem_huge == SHMEM_HUGE_DENY)
+		return false;
+	switch (SHMEM_SB(inode->i_sb)->huge) {
+	case SHMEM_HUGE_ALWAYS:
+		return true;
+	case SHMEM_HUGE_WITHIN_SIZE:
+		size = DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE);
+		return index + HPAGE_PMD_NR <= size;
+	default:
+		return false;
+	}
+}
+
+bool shmem_huge_enabled(struct vm_area_struct *vma)
+{
+	struct inode *inode = vma->vm_file->f_mapping->host;
+
+	if (inode->i_mapping->a_ops != &shmem_aops)
+		return false;
+	if (!(vma->vm_flags & VM_SHARED) ||
+	    (vma->vm_flags & (VM_LOCKED | VM_NONLINEAR)))
+		return false;
+	if (shmem_huge == SHMEM_HUGE_FORCE)
+		return true;
+	if (shmem_huge == SHMEM_HUGE_DENY)
+		return false;
+	return SHMEM_SB(inode->i_sb)->huge != SHMEM_HUGE_NEVER;
+}
+
+static int shmem_alloc_extent(struct shmem_extent *extent,
+			struct inode *inode, pgoff_t index, bool defrag)
+{
+	gfp_t gfp = GFP_TRANSHUGE & ~__GFP_COMP;
+
+	if (!defrag)
+		gfp &= ~__GFP_WAIT;
+	extent->pages = shmem_alloc_hugepage(gfp, SHMEM_I(inode), index);
+	if (!extent->pages)
+		return -ENOMEM;
+	split_page(extent->pages, HPAGE_PMD_ORDER);
+	extent->index = index;
+	bitmap_zero(extent->used, HPAGE_PMD_NR);
+	return 0;
+}
+
+/*
+ * Insert the pages of @extent not yet handed out into the page cache, at
+ * the indices they back; any index found already populated keeps its page.
+ */
+static int shmem_fill_extent(struct inode *inode, struct shmem_extent *extent,
+			enum sgp_type sgp, struct mm_struct *mm)
+{
+	struct page *page, *filepage;
+	int error = 0;
+	int i, err;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (test_bit(i, extent->used))
+			continue;
+		page = extent->pages + i;
+		if (error || mem_cgroup_cache_charge(page, mm, GFP_KERNEL)) {
+			page_cache_release(page);
+			error = error ? error : -ENOMEM;
+			continue;
+		}
+		filepage = NULL;
+		err = __shmem_getpage(inode, extent->index + i, &filepage,
+				      sgp, NULL, page);
+		if (err) {
+			error = err;
+			continue;
+		}
+		unlock_page(filepage);
+		page_cache_release(filepage);
+	}
+	return error;
+}
+
+/*
+ * Back the empty range at hugepage aligned @index with a new extent.
+ */
+static void shmem_get_extent(struct inode *inode, pgoff_t index,
+			enum sgp_type sgp, struct mm_struct *mm, bool defrag)
+{
+	struct shmem_extent extent;
+	struct page *page;
+
+	/* pages on swap would be read back in without the extent */
+	if (SHMEM_I(inode)->swapped)
+		return;
+	if (find_get_pages(inode->i_mapping, index, 1, &page)) {
+		bool populated = page->index < index + HPAGE_PMD_NR;
+
+		page_cache_release(page);
+		if (populated)
+			return;
+	}
+	if (!shmem_alloc_extent(&extent, inode, index, defrag))
+		shmem_fill_extent(inode, &extent, sgp, mm);
+}
+
+static struct page *shmem_extent_page(struct page *page, unsigned long private,
+			int **result)
+{
+	struct shmem_extent *extent = (struct shmem_extent *)private;
+	unsigned long i = page->index - extent->index;
+
+	if (i >= HPAGE_PMD_NR || test_and_set_bit(i, extent->used))
+		return NULL;
+	return extent->pages + i;
+}
+
+/**
+ * shmem_collapse_extent - gather a range of shmem into an extent
+ * @inode: the shmem inode
+ * @index: hugepage aligned index of the range
+ * @mm: mm to charge newly allocated pages to
+ * @max_holes: how many missing pages may be filled in
+ * @defrag: whether the allocation may compact and reclaim
+ *
+ * Used by khugepaged to collapse ranges faulted in with small pages: the
+ * pages present are migrated into a newly allocated extent and the holes
+ * filled from it.  Returns 0 once the range is backed by an extent,
+ * -EAGAIN if a page went away while being migrated into it.
+ */
+int shmem_collapse_extent(struct inode *inode, pgoff_t index,
+			struct mm_struct *mm, int max_holes, bool defrag)
+{
+	struct address_space *mapping = inode->i_mapping;
+	pgoff_t end = index + HPAGE_PMD_NR;
+	unsigned long base_pfn = 0;
+	struct shmem_extent extent;
+	struct pagevec pvec;
+	LIST_HEAD(pagelist);
+	pgoff_t next;
+	int nr = 0, contiguous = 1, busy = 0;
+	int i, error;
+
+	if ((index & (HPAGE_PMD_NR - 1)) || !shmem_huge_allowed(inode, index))
+		return -EINVAL;
+	if (end > DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE))
+		return -EINVAL;
+	if (SHMEM_I(inode)->swapped)
+		return -EBUSY;
+
+	/* Count the pages present, and see if they already form an extent */
+	pagevec_init(&pvec, 0);
+	next = index;
+	while (next < end && pagevec_lookup(&pvec, mapping, next,
+			min(end - next, (pgoff_t)PAGEVEC_SIZE))) {
+		for (i = 0; i < pagevec_count(&pvec); i++) {
+			struct page *page = pvec.pages[i];
+
+			if (page->index >= end) {
+				next = end;
+				break;
+			}
+			next = page->index + 1;
+			if (!nr++)
+				base_pfn = page_to_pfn(page) -
+					   (page->index - index);
+			if (page_to_pfn(page) !=
+			    base_pfn + (page->index - index))
+				contiguous = 0;
+		}
+		pagevec_release(&pvec);
+		cond_resched();
+	}
+	if (nr == HPAGE_PMD_NR && contiguous &&
+	    !(base_pfn & (HPAGE_PMD_NR - 1)))
+		return 0;
+	if (HPAGE_PMD_NR - nr > max_holes)
+		return -EBUSY;
+
+	error = shmem_alloc_extent(&extent, inode, index, defrag);
+	if (error)
+		return error;
+
+	/* Isolate the pages present to migrate them into the extent */
+	migrate_prep();
+	next = index;
+	while (next < end && pagevec_lookup(&pvec, mapping, next,
+			min(end - next, (pgoff_t)PAGEVEC_SIZE))) {
+		for (i = 0; i < pagevec_count(&pvec); i++) {
+			struct page *page = pvec.pages[i];
+
+			if (page->index >= end) {
+				next = end;
+				break;
+			}
+			next = page->index + 1;
+			if (isolate_lru_page(page)) {
+				busy = 1;
+				continue;
+			}
+			list_add_tail(&page->lru, &pagelist);
+			inc_zone_page_state(page, NR_ISOLATED_ANON +
+					    page_is_file_cache(page));
+		}
+		pagevec_release(&pvec);
+		cond_resched();
+	}
+	error = 0;
+	if (!busy && !list_empty(&pagelist) &&
+	    migrate_pages(&pagelist, shmem_extent_page,
+			  (unsigned long)&extent, false, true))
+		busy = 1;
+	if (!list_empty(&pagelist))
+		putback_lru_pages(&pagelist);
+	if (busy)
+		error = -EBUSY;
+
+	/*
+	 * A page freed or truncated under migration counts as migrated,
+	 * but its extent page never made it into the page cache: the
+	 * extent would have a hole, so leave the range alone.
+	 */
+	for_each_set_bit(i, extent.used, HPAGE_PMD_NR) {
+		struct page *page;
+
+		if (error)
+			break;
+		page = find_get_page(mapping, index + i);
+		if (page)
+			page_cache_release(page);
+		if (page != extent.pages + i)
+			error = -EAGAIN;
+	}
+
+	if (error) {
+		/* give back the pages of the extent not migrated into */
+		for (i = 0; i < HPAGE_PMD_NR; i++)
+			if (!test_bit(i, extent.used))
+				__free_page(extent.pages + i);
+		return error;
+	}
+	return shmem_fill_extent(inode, &extent, SGP_CACHE, mm);
+}
+
+static int shmem_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+			pmd_t *pmd, unsigned int flags)
+{
+	struct inode *inode = vma->vm_file->f_mapping->host;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgoff_t index;
+
+	if (!shmem_huge_enabled(vma))
+		return VM_FAULT_FALLBACK;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	index = linear_page_index(vma, haddr);
+	if ((index & (HPAGE_PMD_NR - 1)) || !shmem_huge_allowed(inode, index))
+		return VM_FAULT_FALLBACK;
+	if (index + HPAGE_PMD_NR >
+	    DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE))
+		return VM_FAULT_FALLBACK;
+
+	shmem_get_extent(inode, index, SGP_CACHE, vma->vm_mm,
+			 transparent_hugepage_defrag(vma));
+	return do_huge_pmd_file_page(vma->vm_mm, vma, haddr, pmd, flags);
+}
+
+/*
+ * A write starting a hugepage aligned range gets it an extent, so that
+ * files filled by write(2) can be mapped with huge pmds too.
+ */
+static void shmem_write_extent(struct inode *inode, pgoff_t index)
+{
+	if ((index & (HPAGE_PMD_NR - 1)) || !shmem_huge_allowed(inode, index))
+		return;
+	shmem_get_extent(inode, index, SGP_WRITE, current->mm,
+			 transparent_hugepage_flags &
+			 (1 << TRANSPARENT_HUGEPAGE_DEFRAG_FLAG));
+}
+#else
+static inline void shmem_write_extent(struct inode *inode, pgoff_t index)
+{
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 {
 	struct inode *inode = vma->vm_file->f_path.dentry->d_inode;
@@ -1571,6 +1967,12 @@ static int shmem_mmap(struct file *file, struct vm_area_struct *vma)
 	file_accessed(file);
 	vma->vm_ops = &shmem_vm_ops;
 	vma->vm_flags |= VM_CAN_NONLINEAR;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (shmem_huge_enabled(vma) &&
+	    ((vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK) <
+	    (vma->vm_end & HPAGE_PMD_MASK))
+		khugepaged_enter_file(vma);
+#endif
 	return 0;
 }
 
@@ -1656,6 +2058,7 @@ shmem_write_begin(struct file *file, struct address_space *mapping,
 	struct inode *inode = mapping->host;
 	pgoff_t index = pos >> PAGE_CACHE_SHIFT;
 	*pagep = NULL;
+	shmem_write_extent(inode, index);
 	return shmem_getpage(inode, index, pagep, SGP_WRITE, NULL);
 }
 
@@ -2250,6 +2653,14 @@ static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 		} else if (!strcmp(this_char,"mpol")) {
 			if (mpol_parse_str(value, &sbinfo->mpol, 1))
 				goto bad_val;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		} else if (!strcmp(this_char,"huge")) {
+			int huge = shmem_parse_huge(value);
+			/* deny and force are for shmem_enabled only */
+			if (huge < 0)
+				goto bad_val;
+			sbinfo->huge = huge;
+#endif
 		} else {
 			printk(KERN_ERR "tmpfs: Bad mount option %s\n",
 			       this_char);
@@ -2296,6 +2707,7 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 	sbinfo->max_blocks  = config.max_blocks;
 	sbinfo->max_inodes  = config.max_inodes;
 	sbinfo->free_inodes = config.max_inodes - inodes;
+	sbinfo->huge        = config.huge;
 
 	mpol_put(sbinfo->mpol);
 	sbinfo->mpol        = config.mpol;	/* transfers initial ref */
@@ -2319,6 +2731,10 @@ static int shmem_show_options(struct seq_file *seq, struct vfsmount *vfs)
 		seq_printf(seq, ",uid=%u", sbinfo->uid);
 	if (sbinfo->gid != 0)
 		seq_printf(seq, ",gid=%u", sbinfo->gid);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (sbinfo->huge)
+		seq_printf(seq, ",huge=%s", shmem_format_huge(sbinfo->huge));
+#endif
 	shmem_show_mpol(seq, sbinfo->mpol);
 	return 0;
 }
@@ -2538,6 +2954,9 @@ static const struct super_operations shmem_ops = {
 
 static const struct vm_operations_struct shmem_vm_ops = {
 	.fault		= shmem_fault,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.pmd_fault	= shmem_pmd_fault,
+#endif
 #ifdef CONFIG_NUMA
 	.set_policy     = shmem_set_policy,
 	.get_policy     = shmem_get_policy,
@@ -2583,6 +3002,10 @@ int __init init_tmpfs(void)
 		printk(KERN_ERR "Could not kern_mount tmpfs\n");
 		goto out1;
 	}
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (shmem_huge > SHMEM_HUGE_DENY)
+		SHMEM_SB(shm_mnt->mnt_sb)->huge = shmem_huge;
+#endif
 	return 0;
 
 out1:
@@ -2596,6 +3019,57 @@ out4:
 	return error;
 }
 
+#if defined(CONFIG_TRANSPARENT_HUGEPAGE) && defined(CONFIG_SYSFS)
+static ssize_t shmem_enabled_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	int values[] = {
+		SHMEM_HUGE_ALWAYS,
+		SHMEM_HUGE_WITHIN_SIZE,
+		SHMEM_HUGE_NEVER,
+		SHMEM_HUGE_DENY,
+		SHMEM_HUGE_FORCE,
+	};
+	int i, count;
+
+	for (i = 0, count = 0; i < ARRAY_SIZE(values); i++) {
+		const char *fmt = shmem_huge == values[i] ? "[%s] " : "%s ";
+
+		count += sprintf(buf + count, fmt,
+				 shmem_format_huge(values[i]));
+	}
+	buf[count - 1] = '\n';
+	return count;
+}
+
+static ssize_t shmem_enabled_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	char tmp[16];
+	int huge;
+
+	if (count + 1 > sizeof(tmp))
+		return -EINVAL;
+	memcpy(tmp, buf, count);
+	tmp[count] = '\0';
+	if (count && tmp[count - 1] == '\n')
+		tmp[count - 1] = '\0';
+
+	huge = shmem_parse_huge(tmp);
+	if (huge == -EINVAL)
+		return -EINVAL;
+
+	shmem_huge = huge;
+	if (shmem_huge > SHMEM_HUGE_DENY && !IS_ERR_OR_NULL(shm_mnt))
+		SHMEM_SB(shm_mnt->mnt_sb)->huge = shmem_huge;
+	return count;
+}
+
+struct kobj_attribute shmem_enabled_attr =
+	__ATTR(shmem_enabled, 0644, shmem_enabled_show, shmem_enabled_store);
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE && CONFIG_SYSFS */
+
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR
 /**
  * mem_cgroup_get_shmem_target - find a page or entry assigned to the shmem file
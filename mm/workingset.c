@@ -0,0 +1,279 @@
+/*
+ * workingset.c - working set detection for the page cache
+ *
+ * Page reclaim keeps file pages on two lists: new pages start out on the
+ * inactive list and are promoted to the active list when they are
+ * referenced a second time while still inactive.  The inactive list has
+ * to be big enough for the pages of the working set to get that second
+ * reference; when the working set grows beyond what the inactive list
+ * can hold, its pages are evicted before they are ever promoted, and a
+ * streaming read that is larger than memory cycles through the inactive
+ * list without leaving any trace of the thrashing it causes.
+ *
+ * To notice this, every eviction of a file page leaves a shadow entry in
+ * the page's slot of the page cache radix tree.  The shadow records the
+ * value of a per-zone counter, zone->inactive_age, that ticks once for
+ * every eviction and every activation from the inactive list, i.e. for
+ * every page that leaves the inactive list.
+ *
+ * When the page is faulted back in, the difference between the current
+ * value of the counter and the one in the shadow, the refault distance,
+ * is the number of pages that left the inactive list while this one was
+ * out of memory.  Had the inactive list been larger by that many pages,
+ * the page would have been activated instead of evicted.  The inactive
+ * list can only grow at the expense of the active list, so if the
+ * refault distance is not larger than the active list, the page gets
+ * activated right away: it then competes with the active pages for
+ * memory, and the active list ends up protecting the pages that are
+ * actually used rather than those that merely were used first.
+ *
+ * Shadow entries are removed when a page is added back to their slot,
+ * when the file is truncated, and when the inode is evicted.  That does
+ * not bound them by memory, though: their number grows with the size of
+ * the files that were streamed through the page cache, and the radix
+ * tree nodes holding them stay allocated for as long as the inode does.
+ * So the nodes that hold nothing but shadow entries go on a list, and a
+ * shrinker frees the oldest of them once there are more than the
+ * shadows can make good use of.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/mm.h>
+#include <linux/init.h>
+#include <linux/mmzone.h>
+#include <linux/fs.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+#include <linux/radix-tree.h>
+
+/*
+ * A shadow entry holds the eviction counter together with the node and
+ * zone the page was evicted from, above the bits the radix tree uses to
+ * mark exceptional entries.  The counter is truncated to what is left,
+ * which on 32 bit is still enough to tell refault distances of several
+ * gigabytes apart.
+ */
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + \
+			 NODES_SHIFT + ZONES_SHIFT)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
+	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
+
+	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static void unpack_shadow(void *shadow, struct zone **zone,
+			  unsigned long *distance)
+{
+	unsigned long entry = (unsigned long)shadow;
+	unsigned long eviction;
+	unsigned long refault;
+	int zid, nid;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	nid = entry & ((1UL << NODES_SHIFT) - 1);
+	entry >>= NODES_SHIFT;
+	eviction = entry;
+
+	*zone = NODE_DATA(nid)->node_zones + zid;
+
+	refault = atomic_long_read(&(*zone)->inactive_age);
+	/*
+	 * The counter may have wrapped around since the eviction: the
+	 * distance is computed modulo the bits stored in the shadow.
+	 */
+	*distance = (refault - eviction) & EVICTION_MASK;
+}
+
+/**
+ * workingset_eviction - note the eviction of a page from memory
+ * @mapping: address space the page was backing
+ * @page: the page being evicted
+ *
+ * Returns a shadow entry to be stored in @page->index's slot of
+ * @mapping->page_tree.  Called with the mapping's tree_lock held.
+ */
+void *workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: shadow entry of the evicted page
+ *
+ * Counts the refault in the zone the page was evicted from, and returns
+ * %true if the page should be activated right away because its refault
+ * distance shows it belongs to the working set.
+ */
+bool workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &refault_distance);
+	mod_zone_page_state(zone, WORKINGSET_REFAULT, 1);
+
+	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		mod_zone_page_state(zone, WORKINGSET_ACTIVATE, 1);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/*
+ * Page cache radix tree nodes that hold only shadow entries, oldest first.
+ *
+ * Lock order is mapping->tree_lock, then shadow_nodes_lock.  The shrinker
+ * takes them the other way round and only trylocks the tree_lock: a node
+ * on the list keeps its mapping alive, since the inode cannot be freed
+ * before all its shadow entries, and with them its nodes, are gone.
+ */
+static LIST_HEAD(shadow_nodes);
+static DEFINE_SPINLOCK(shadow_nodes_lock);
+static unsigned long nr_shadow_nodes;
+
+/**
+ * workingset_update_node - track a page cache node of shadow entries
+ * @mapping: address space the node belongs to
+ * @node: bottom-level radix tree node that was just modified
+ * @index: index of any entry in @node
+ *
+ * Puts @node on the shadow node list when it holds nothing but shadow
+ * entries, and takes it off again when it holds pages.  Called with the
+ * mapping's tree_lock held.
+ */
+void workingset_update_node(struct address_space *mapping,
+			    struct radix_tree_node *node, pgoff_t index)
+{
+	if (!node->count || node->count != node->exceptional) {
+		workingset_forget_node(node);
+		return;
+	}
+	if (!list_empty(&node->private_list))
+		return;
+
+	node->private_data = mapping;
+	node->private_index = index & ~RADIX_TREE_MAP_MASK;
+	spin_lock(&shadow_nodes_lock);
+	list_add_tail(&node->private_list, &shadow_nodes);
+	nr_shadow_nodes++;
+	spin_unlock(&shadow_nodes_lock);
+}
+
+/**
+ * workingset_forget_node - stop tracking a page cache node
+ * @node: bottom-level radix tree node
+ *
+ * Takes @node off the shadow node list.  Has to be called before the
+ * last entry of the node is deleted, which frees it.  Called with the
+ * mapping's tree_lock held.
+ */
+void workingset_forget_node(struct radix_tree_node *node)
+{
+	if (list_empty(&node->private_list))
+		return;
+
+	spin_lock(&shadow_nodes_lock);
+	list_del_init(&node->private_list);
+	nr_shadow_nodes--;
+	spin_unlock(&shadow_nodes_lock);
+}
+
+/*
+ * A shadow entry is only useful while its refault distance can still be
+ * smaller than the active list, i.e. for about as many evictions as there
+ * are pages in memory.  Allow that many shadows in nodes that are only
+ * 1/8th populated before reclaiming any node.
+ */
+static unsigned long max_shadow_nodes(void)
+{
+	return totalram_pages >> (RADIX_TREE_MAP_SHIFT - 3);
+}
+
+/*
+ * Delete all shadow entries of @node, which frees it.  Called with
+ * shadow_nodes_lock held and interrupts disabled.
+ */
+static bool shadow_node_reclaim(struct radix_tree_node *node)
+{
+	struct address_space *mapping = node->private_data;
+	struct zone *zone = page_zone(virt_to_page(node));
+	unsigned int i;
+
+	if (!spin_trylock(&mapping->tree_lock))
+		return false;
+
+	list_del_init(&node->private_list);
+	nr_shadow_nodes--;
+
+	for (i = 0; i < RADIX_TREE_MAP_SIZE; i++) {
+		bool last;
+
+		if (!node->slots[i])
+			continue;
+		BUG_ON(!radix_tree_exceptional_entry(node->slots[i]));
+		/* Deleting the last entry frees the node */
+		last = node->count == 1;
+		radix_tree_delete(&mapping->page_tree, node->private_index + i);
+		mapping->nrshadows--;
+		if (last)
+			break;
+	}
+	spin_unlock(&mapping->tree_lock);
+
+	mod_zone_page_state(zone, WORKINGSET_NODERECLAIM, 1);
+	return true;
+}
+
+static int shrink_shadow_nodes(struct shrinker *shrink, int nr_to_scan,
+			       gfp_t gfp_mask)
+{
+	unsigned long max = max_shadow_nodes();
+	struct radix_tree_node *node;
+	unsigned long nr;
+
+	spin_lock_irq(&shadow_nodes_lock);
+	while (nr_to_scan-- > 0 && nr_shadow_nodes > max) {
+		node = list_first_entry(&shadow_nodes, struct radix_tree_node,
+					private_list);
+		if (!shadow_node_reclaim(node))
+			list_move_tail(&node->private_list, &shadow_nodes);
+	}
+	nr = nr_shadow_nodes > max ? nr_shadow_nodes - max : 0;
+	spin_unlock_irq(&shadow_nodes_lock);
+
+	return min_t(unsigned long, nr, INT_MAX);
+}
+
+static struct shrinker shadow_nodes_shrinker = {
+	.shrink = shrink_shadow_nodes,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int __init workingset_init(void)
+{
+	register_shrinker(&shadow_nodes_shrinker);
+	return 0;
+}
+module_init(workingset_init)
@@ -0,0 +1,885 @@
+/*
+ * zswap.c - compressed cache for swap pages
+ *
+ * Pages that are being swapped out are LZO compressed and kept in a
+ * dynamically sized pool of kmalloc'ed buffers, indexed per swap area
+ * by swap offset.  A later swap-in of the same slot decompresses the
+ * data straight into the new swap cache page, so the swap device is
+ * never touched.  Once the pool reaches max_pool_percent of RAM, the
+ * oldest compressed pages of the swap area being stored to are
+ * decompressed into the swap cache and written back to the real swap
+ * device to make room.  A shrinker also has the oldest pages written
+ * back under memory pressure, so that a full pool does not stay full
+ * when nothing is being swapped out anymore.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/rbtree.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/pagemap.h>
+#include <linux/writeback.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
+#include <linux/lzo.h>
+#include <linux/debugfs.h>
+#include <linux/zswap.h>
+
+/*********************************
+* statistics
+**********************************/
+/* Number of bytes the pool takes, slab rounding included */
+static atomic_long_t zswap_pool_bytes = ATOMIC_LONG_INIT(0);
+/* The number of compressed pages currently stored in zswap */
+static atomic_t zswap_stored_pages = ATOMIC_INIT(0);
+
+/*
+ * The statistics below are not protected from concurrent access for
+ * performance reasons so they may not be a 100% accurate.  However,
+ * they do provide useful information on roughly how many times a
+ * certain event is occurring.
+ */
+static u64 zswap_pool_limit_hit;
+static u64 zswap_written_back_pages;
+static u64 zswap_reject_reclaim_fail;
+static u64 zswap_reject_alloc_fail;
+static u64 zswap_reject_compress_poor;
+static u64 zswap_duplicate_entry;
+
+/*********************************
+* tunables
+**********************************/
+/* Enable/disable zswap (disabled by default, fixed at boot for now) */
+static bool zswap_enabled __read_mostly;
+module_param_named(enabled, zswap_enabled, bool, 0);
+
+/* The maximum percentage of memory that the compressed pool can occupy */
+static unsigned int zswap_max_pool_percent = 20;
+module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
+
+/* Entries written back in one go when the pool limit is hit */
+#define ZSWAP_WRITEBACK_BATCH	8
+
+/*********************************
+* data structures
+**********************************/
+/*
+ * struct zswap_entry
+ *
+ * This structure contains the metadata for tracking a single compressed
+ * page within zswap.
+ *
+ * rbnode - links the entry into red-black tree for the appropriate swap type
+ * lru - links the entry into the per swap type writeback list, oldest first
+ * refcount - the number of outstanding references to the entry.  The tree
+ *            holds one; load and writeback take temporary ones so that the
+ *            entry is not freed by invalidation while they use it.
+ * offset - the swap offset for the entry.  Index into the red-black tree.
+ * length - the length in bytes of the compressed page data.
+ * data - the compressed page data.  The pool is charged ksize(data).
+ */
+struct zswap_entry {
+	struct rb_node rbnode;
+	struct list_head lru;
+	int refcount;
+	pgoff_t offset;
+	unsigned int length;
+	void *data;
+};
+
+/*
+ * The tree lock in the zswap_tree struct protects a few things:
+ * - the rbtree
+ * - the lru list
+ * - the refcount field of each entry in the tree
+ */
+struct zswap_tree {
+	struct rb_root rbroot;
+	struct list_head lru;
+	spinlock_t lock;
+};
+
+static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
+
+/* Keeps the trees around while the shrink work writes back from them */
+static DEFINE_MUTEX(zswap_trees_mutex);
+
+/*********************************
+* compression buffers
+**********************************/
+static DEFINE_PER_CPU(u8 *, zswap_dstmem);
+static DEFINE_PER_CPU(void *, zswap_wrkmem);
+
+static int __zswap_cpu_notifier(unsigned long action, unsigned long cpu)
+{
+	u8 *dst;
+	void *wrk;
+
+	switch (action) {
+	case CPU_UP_PREPARE:
+		dst = kmalloc(lzo1x_worst_compress(PAGE_SIZE), GFP_KERNEL);
+		wrk = kmalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+		if (!dst || !wrk) {
+			kfree(dst);
+			kfree(wrk);
+			pr_err("zswap: can't allocate compressor buffers\n");
+			return NOTIFY_BAD;
+		}
+		per_cpu(zswap_dstmem, cpu) = dst;
+		per_cpu(zswap_wrkmem, cpu) = wrk;
+		break;
+	case CPU_DEAD:
+	case CPU_UP_CANCELED:
+		kfree(per_cpu(zswap_dstmem, cpu));
+		per_cpu(zswap_dstmem, cpu) = NULL;
+		kfree(per_cpu(zswap_wrkmem, cpu));
+		per_cpu(zswap_wrkmem, cpu) = NULL;
+		break;
+	default:
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static int zswap_cpu_notifier(struct notifier_block *nb,
+			      unsigned long action, void *pcpu)
+{
+	unsigned long cpu = (unsigned long)pcpu;
+
+	return __zswap_cpu_notifier(action & ~CPU_TASKS_FROZEN, cpu);
+}
+
+static struct notifier_block zswap_cpu_notifier_block = {
+	.notifier_call = zswap_cpu_notifier
+};
+
+static int zswap_cpu_init(void)
+{
+	unsigned long cpu;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu)
+		if (__zswap_cpu_notifier(CPU_UP_PREPARE, cpu) != NOTIFY_OK)
+			goto cleanup;
+	register_cpu_notifier(&zswap_cpu_notifier_block);
+	put_online_cpus();
+	return 0;
+
+cleanup:
+	for_each_online_cpu(cpu)
+		__zswap_cpu_notifier(CPU_UP_CANCELED, cpu);
+	put_online_cpus();
+	return -ENOMEM;
+}
+
+/*********************************
+* zswap entry functions
+**********************************/
+static struct kmem_cache *zswap_entry_cache;
+
+static struct zswap_entry *zswap_entry_cache_alloc(gfp_t gfp)
+{
+	struct zswap_entry *entry;
+
+	entry = kmem_cache_alloc(zswap_entry_cache, gfp);
+	if (!entry)
+		return NULL;
+	entry->refcount = 1;
+	entry->data = NULL;
+	INIT_LIST_HEAD(&entry->lru);
+	return entry;
+}
+
+static void zswap_free_entry(struct zswap_entry *entry)
+{
+	atomic_long_sub(ksize(entry->data), &zswap_pool_bytes);
+	atomic_dec(&zswap_stored_pages);
+	kfree(entry->data);
+	kmem_cache_free(zswap_entry_cache, entry);
+}
+
+/* caller must hold the tree lock */
+static void zswap_entry_get(struct zswap_entry *entry)
+{
+	entry->refcount++;
+}
+
+/*
+ * caller must hold the tree lock.  Returns the remaining refcount; the
+ * caller frees the entry (outside the lock) when it drops to zero.
+ */
+static int zswap_entry_put(struct zswap_entry *entry)
+{
+	entry->refcount--;
+	return entry->refcount;
+}
+
+/*********************************
+* rbtree functions
+**********************************/
+static struct zswap_entry *zswap_rb_search(struct rb_root *root, pgoff_t offset)
+{
+	struct rb_node *node = root->rb_node;
+	struct zswap_entry *entry;
+
+	while (node) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		if (entry->offset > offset)
+			node = node->rb_left;
+		else if (entry->offset < offset)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * In the case that an entry with the same offset is found, a pointer to
+ * the existing entry is stored in dupentry and the function returns -EEXIST
+ */
+static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
+			   struct zswap_entry **dupentry)
+{
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+	struct zswap_entry *myentry;
+
+	while (*link) {
+		parent = *link;
+		myentry = rb_entry(parent, struct zswap_entry, rbnode);
+		if (myentry->offset > entry->offset)
+			link = &(*link)->rb_left;
+		else if (myentry->offset < entry->offset)
+			link = &(*link)->rb_right;
+		else {
+			*dupentry = myentry;
+			return -EEXIST;
+		}
+	}
+	rb_link_node(&entry->rbnode, parent, link);
+	rb_insert_color(&entry->rbnode, root);
+	return 0;
+}
+
+/*
+ * Unlink an entry from the tree and the lru, dropping the tree's
+ * reference.  Caller must hold the tree lock; returns the remaining
+ * refcount like zswap_entry_put().
+ */
+static int zswap_rb_erase(struct zswap_tree *tree, struct zswap_entry *entry)
+{
+	rb_erase(&entry->rbnode, &tree->rbroot);
+	list_del_init(&entry->lru);
+	return zswap_entry_put(entry);
+}
+
+/*********************************
+* helpers
+**********************************/
+static bool zswap_is_full(void)
+{
+	unsigned long pool_pages;
+
+	pool_pages = atomic_long_read(&zswap_pool_bytes) >> PAGE_SHIFT;
+	return totalram_pages * zswap_max_pool_percent / 100 < pool_pages;
+}
+
+static int zswap_decompress(struct zswap_entry *entry, struct page *page)
+{
+	size_t dlen = PAGE_SIZE;
+	u8 *dst;
+	int ret;
+
+	dst = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_decompress_safe(entry->data, entry->length, dst, &dlen);
+	kunmap_atomic(dst, KM_USER0);
+	if (ret != LZO_E_OK || dlen != PAGE_SIZE)
+		return -EIO;
+	return 0;
+}
+
+/*********************************
+* writeback code
+**********************************/
+/* return enum for zswap_get_swap_cache_page */
+enum zswap_get_swap_ret {
+	ZSWAP_SWAPCACHE_NEW,
+	ZSWAP_SWAPCACHE_EXIST,
+	ZSWAP_SWAPCACHE_NOMEM
+};
+
+/*
+ * zswap_get_swap_cache_page
+ *
+ * This is an adaption of read_swap_cache_async()
+ *
+ * This function tries to find a page with the given swap entry
+ * in the swapper_space address space (the swap cache).  If the page
+ * is found, it is returned in retpage.  Otherwise, a page is allocated,
+ * added to the swap cache, and returned in retpage.
+ *
+ * If success, the swap cache page is returned in retpage
+ * Returns ZSWAP_SWAPCACHE_EXIST if page was already in the swap cache
+ * Returns ZSWAP_SWAPCACHE_NEW if the new page needs to be populated,
+ *     the new page is added to swapcache and locked
+ * Returns ZSWAP_SWAPCACHE_NOMEM on error
+ */
+static int zswap_get_swap_cache_page(swp_entry_t entry,
+				     struct page **retpage)
+{
+	struct page *found_page, *new_page = NULL;
+	int err;
+
+	*retpage = NULL;
+	do {
+		/*
+		 * First check the swap cache.  Since this is normally
+		 * called after lookup_swap_cache() failed, re-calling
+		 * that would confuse statistics.
+		 */
+		found_page = find_get_page(&swapper_space, entry.val);
+		if (found_page)
+			break;
+
+		/*
+		 * Get a new page to read into from swap.
+		 */
+		if (!new_page) {
+			new_page = alloc_page(GFP_KERNEL);
+			if (!new_page)
+				break; /* Out of memory */
+		}
+
+		/*
+		 * call radix_tree_preload() while we can wait.
+		 */
+		err = radix_tree_preload(GFP_KERNEL);
+		if (err)
+			break;
+
+		/*
+		 * Swap entry may have been freed since our caller observed it.
+		 */
+		err = swapcache_prepare(entry);
+		if (err == -EEXIST) { /* seems racy */
+			radix_tree_preload_end();
+			continue;
+		}
+		if (err) { /* swp entry is obsolete ? */
+			radix_tree_preload_end();
+			break;
+		}
+
+		/* May fail (-ENOMEM) if radix-tree node allocation failed. */
+		__set_page_locked(new_page);
+		SetPageSwapBacked(new_page);
+		err = __add_to_swap_cache(new_page, entry);
+		if (likely(!err)) {
+			radix_tree_preload_end();
+			lru_cache_add_anon(new_page);
+			*retpage = new_page;
+			return ZSWAP_SWAPCACHE_NEW;
+		}
+		radix_tree_preload_end();
+		ClearPageSwapBacked(new_page);
+		__clear_page_locked(new_page);
+		/*
+		 * add_to_swap_cache() doesn't return -EEXIST, so we can safely
+		 * clear SWAP_HAS_CACHE flag.
+		 */
+		swapcache_free(entry, NULL);
+	} while (err != -ENOMEM);
+
+	if (new_page)
+		page_cache_release(new_page);
+	if (!found_page)
+		return ZSWAP_SWAPCACHE_NOMEM;
+	*retpage = found_page;
+	return ZSWAP_SWAPCACHE_EXIST;
+}
+
+/*
+ * Attempts to free an entry by adding a page to the swap cache,
+ * decompressing the entry data into the page, and issuing a
+ * bio write to write the page back to the swap device.
+ *
+ * The caller holds a reference on @entry, which has already been taken
+ * off the lru list; it is dropped here.
+ */
+static int zswap_writeback_entry(struct zswap_tree *tree, unsigned type,
+				 struct zswap_entry *entry)
+{
+	swp_entry_t swpentry = swp_entry(type, entry->offset);
+	struct page *page;
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+	int ret, refcount;
+
+	switch (zswap_get_swap_cache_page(swpentry, &page)) {
+	case ZSWAP_SWAPCACHE_NOMEM: /* no memory or invalidate happened */
+		ret = -ENOMEM;
+		goto fail;
+
+	case ZSWAP_SWAPCACHE_EXIST:
+		/* page is already in the swap cache, ignore for now */
+		page_cache_release(page);
+		ret = -EEXIST;
+		goto fail;
+
+	case ZSWAP_SWAPCACHE_NEW: /* page is locked */
+		if (zswap_decompress(entry, page)) {
+			/*
+			 * Corrupted data: leave the page !uptodate so that
+			 * the next swap-in gets an I/O error instead.
+			 */
+			unlock_page(page);
+			page_cache_release(page);
+			ret = -EIO;
+			goto fail;
+		}
+		SetPageUptodate(page);
+	}
+
+	/* start writeback */
+	SetPageReclaim(page);
+	__swap_writepage(page, &wbc);
+	page_cache_release(page);
+	zswap_written_back_pages++;
+
+	spin_lock(&tree->lock);
+	/* drop local reference */
+	refcount = zswap_entry_put(entry);
+	/*
+	 * The data now lives in the swap cache and on disk; drop the
+	 * tree's reference too, unless the entry was invalidated (and
+	 * possibly replaced) while we were writing it back.
+	 */
+	if (entry == zswap_rb_search(&tree->rbroot, entry->offset))
+		refcount = zswap_rb_erase(tree, entry);
+	spin_unlock(&tree->lock);
+	if (!refcount)
+		zswap_free_entry(entry);
+	return 0;
+
+fail:
+	spin_lock(&tree->lock);
+	refcount = zswap_entry_put(entry);
+	/* still valid: give it another chance later */
+	if (refcount && list_empty(&entry->lru))
+		list_add_tail(&entry->lru, &tree->lru);
+	spin_unlock(&tree->lock);
+	if (!refcount)
+		zswap_free_entry(entry);
+	return ret;
+}
+
+/*
+ * Write back up to @nr of the oldest entries of @type.  Returns 0 if at
+ * least one entry was written back.
+ */
+static int zswap_writeback(unsigned type, int nr)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+	int written = 0;
+
+	while (nr--) {
+		spin_lock(&tree->lock);
+		if (list_empty(&tree->lru)) {
+			spin_unlock(&tree->lock);
+			break;
+		}
+		entry = list_first_entry(&tree->lru, struct zswap_entry, lru);
+		list_del_init(&entry->lru);
+		zswap_entry_get(entry);
+		spin_unlock(&tree->lock);
+
+		if (!zswap_writeback_entry(tree, type, entry))
+			written++;
+	}
+	return written ? 0 : -EAGAIN;
+}
+
+/*********************************
+* shrinker
+**********************************/
+/*
+ * Stores only write back when they find the pool full.  Under memory
+ * pressure, the shrinker has the oldest entries of all swap areas written
+ * back by a work item: that needs to allocate swap cache pages and issue
+ * I/O, which the reclaim context calling the shrinker should not do.
+ */
+static atomic_t zswap_shrink_target = ATOMIC_INIT(0);
+
+static void zswap_shrink_work_fn(struct work_struct *work)
+{
+	int nr = atomic_xchg(&zswap_shrink_target, 0);
+	unsigned type;
+	bool progress;
+
+	nr = min(nr, atomic_read(&zswap_stored_pages));
+	mutex_lock(&zswap_trees_mutex);
+	while (nr > 0) {
+		progress = false;
+		for (type = 0; type < MAX_SWAPFILES && nr > 0; type++) {
+			if (!zswap_trees[type])
+				continue;
+			if (!zswap_writeback(type, 1)) {
+				progress = true;
+				nr--;
+			}
+		}
+		if (!progress)
+			break;
+		cond_resched();
+	}
+	mutex_unlock(&zswap_trees_mutex);
+}
+
+static DECLARE_WORK(zswap_shrink_work, zswap_shrink_work_fn);
+
+static int zswap_shrink(struct shrinker *shrink, int nr_to_scan,
+			gfp_t gfp_mask)
+{
+	if (nr_to_scan) {
+		atomic_add(nr_to_scan, &zswap_shrink_target);
+		schedule_work(&zswap_shrink_work);
+	}
+	return atomic_read(&zswap_stored_pages);
+}
+
+static struct shrinker zswap_shrinker = {
+	.shrink = zswap_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+/*********************************
+* swap hooks
+**********************************/
+/*
+ * zswap_store - compress a locked swap cache page into the pool
+ *
+ * Called from swap_writepage().  Returns 0 if the page was stored, in
+ * which case no I/O to the swap device is needed.
+ */
+int zswap_store(struct page *page)
+{
+	swp_entry_t swp = { .val = page_private(page), };
+	unsigned type = swp_type(swp);
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry, *dupentry;
+	size_t dlen;
+	u8 *src, *dst;
+	void *buf;
+	int ret, refcount;
+
+	if (!zswap_enabled || !tree)
+		return -ENODEV;
+
+	/* reclaim space if needed */
+	if (zswap_is_full()) {
+		zswap_pool_limit_hit++;
+		if (zswap_writeback(type, ZSWAP_WRITEBACK_BATCH)) {
+			zswap_reject_reclaim_fail++;
+			return -ENOMEM;
+		}
+	}
+
+	/* allocate entry */
+	entry = zswap_entry_cache_alloc(GFP_KERNEL);
+	if (!entry) {
+		zswap_reject_alloc_fail++;
+		return -ENOMEM;
+	}
+
+	/* compress */
+	dst = get_cpu_var(zswap_dstmem);
+	src = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, &dlen,
+			       __get_cpu_var(zswap_wrkmem));
+	kunmap_atomic(src, KM_USER0);
+	if (ret != LZO_E_OK || dlen >= PAGE_SIZE) {
+		/* storing this would not save anything */
+		put_cpu_var(zswap_dstmem);
+		zswap_reject_compress_poor++;
+		ret = -EINVAL;
+		goto freeentry;
+	}
+
+	/* store */
+	buf = kmalloc(dlen, GFP_NOWAIT | __GFP_NORETRY | __GFP_NOWARN);
+	if (!buf) {
+		put_cpu_var(zswap_dstmem);
+		zswap_reject_alloc_fail++;
+		ret = -ENOMEM;
+		goto freeentry;
+	}
+	/*
+	 * The buffer takes up a whole kmalloc size class: a page that
+	 * compresses to just over half its size saves nothing either.
+	 */
+	if (ksize(buf) >= PAGE_SIZE) {
+		put_cpu_var(zswap_dstmem);
+		kfree(buf);
+		zswap_reject_compress_poor++;
+		ret = -EINVAL;
+		goto freeentry;
+	}
+	memcpy(buf, dst, dlen);
+	put_cpu_var(zswap_dstmem);
+
+	/* populate entry */
+	entry->offset = swp_offset(swp);
+	entry->data = buf;
+	entry->length = dlen;
+	atomic_long_add(ksize(buf), &zswap_pool_bytes);
+	atomic_inc(&zswap_stored_pages);
+
+	/* map */
+	spin_lock(&tree->lock);
+	do {
+		ret = zswap_rb_insert(&tree->rbroot, entry, &dupentry);
+		if (ret == -EEXIST) {
+			zswap_duplicate_entry++;
+			/* remove from rbtree */
+			refcount = zswap_rb_erase(tree, dupentry);
+			if (!refcount) {
+				/* free */
+				spin_unlock(&tree->lock);
+				zswap_free_entry(dupentry);
+				spin_lock(&tree->lock);
+			}
+		}
+	} while (ret == -EEXIST);
+	list_add_tail(&entry->lru, &tree->lru);
+	spin_unlock(&tree->lock);
+
+	return 0;
+
+freeentry:
+	kmem_cache_free(zswap_entry_cache, entry);
+	return ret;
+}
+
+/*
+ * zswap_load - fill a locked swap cache page from the pool
+ *
+ * Called from swap_readpage().  Returns 0 if the page was found in the
+ * pool, in which case no I/O to the swap device is needed: the page is
+ * marked uptodate, or PageError if the compressed data was corrupted.
+ */
+int zswap_load(struct page *page)
+{
+	swp_entry_t swp = { .val = page_private(page), };
+	struct zswap_tree *tree = zswap_trees[swp_type(swp)];
+	struct zswap_entry *entry;
+	int ret, refcount;
+
+	if (!tree)
+		return -ENODEV;
+
+	/* find */
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, swp_offset(swp));
+	if (!entry) {
+		/* entry was written back */
+		spin_unlock(&tree->lock);
+		return -ENOENT;
+	}
+	zswap_entry_get(entry);
+	spin_unlock(&tree->lock);
+
+	/* decompress */
+	ret = zswap_decompress(entry, page);
+	if (likely(!ret))
+		SetPageUptodate(page);
+	else {
+		WARN_ON_ONCE(1);
+		SetPageError(page);
+	}
+
+	spin_lock(&tree->lock);
+	refcount = zswap_entry_put(entry);
+	spin_unlock(&tree->lock);
+	if (!refcount)
+		zswap_free_entry(entry);
+
+	return 0;
+}
+
+/* frees an entry in zswap, called when its swap slot is freed */
+void zswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+	int refcount;
+
+	if (!tree)
+		return;
+
+	/* find */
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (!entry) {
+		/* entry was written back */
+		spin_unlock(&tree->lock);
+		return;
+	}
+
+	/* remove from rbtree and lru */
+	refcount = zswap_rb_erase(tree, entry);
+	spin_unlock(&tree->lock);
+
+	if (!refcount)
+		zswap_free_entry(entry);
+}
+
+/* frees all zswap entries for the given swap type */
+void zswap_invalidate_area(unsigned type)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry, *n;
+
+	if (!tree)
+		return;
+
+	/* wait for the shrink work to be done with the tree */
+	mutex_lock(&zswap_trees_mutex);
+
+	/* walk the tree and free everything */
+	spin_lock(&tree->lock);
+	list_for_each_entry_safe(entry, n, &tree->lru, lru) {
+		rb_erase(&entry->rbnode, &tree->rbroot);
+		zswap_free_entry(entry);
+	}
+	/*
+	 * Entries off the lru are being written back and still referenced;
+	 * swapoff's try_to_unuse() has waited for those, so none remain.
+	 */
+	WARN_ON(!RB_EMPTY_ROOT(&tree->rbroot));
+	tree->rbroot = RB_ROOT;
+	INIT_LIST_HEAD(&tree->lru);
+	spin_unlock(&tree->lock);
+
+	zswap_trees[type] = NULL;
+	mutex_unlock(&zswap_trees_mutex);
+	kfree(tree);
+}
+
+/* sets up the per swap type tree, called from swapon */
+void zswap_init_area(unsigned type)
+{
+	struct zswap_tree *tree;
+
+	if (!zswap_enabled)
+		return;
+
+	tree = kzalloc(sizeof(struct zswap_tree), GFP_KERNEL);
+	if (!tree) {
+		pr_err("zswap: alloc failed, zswap disabled for swap type %d\n",
+		       type);
+		return;
+	}
+
+	tree->rbroot = RB_ROOT;
+	INIT_LIST_HEAD(&tree->lru);
+	spin_lock_init(&tree->lock);
+	zswap_trees[type] = tree;
+}
+
+/*********************************
+* debugfs functions
+**********************************/
+#ifdef CONFIG_DEBUG_FS
+
+static struct dentry *zswap_debugfs_root;
+
+static int zswap_pool_pages_get(void *data, u64 *val)
+{
+	*val = atomic_long_read(&zswap_pool_bytes) >> PAGE_SHIFT;
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_pool_pages_fops, zswap_pool_pages_get,
+			NULL, "%llu\n");
+
+static int zswap_stored_pages_get(void *data, u64 *val)
+{
+	*val = atomic_read(&zswap_stored_pages);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_stored_pages_fops, zswap_stored_pages_get,
+			NULL, "%llu\n");
+
+static int __init zswap_debugfs_init(void)
+{
+	if (!debugfs_initialized())
+		return -ENODEV;
+
+	zswap_debugfs_root = debugfs_create_dir("zswap", NULL);
+	if (!zswap_debugfs_root)
+		return -ENOMEM;
+
+	debugfs_create_u64("pool_limit_hit", S_IRUGO,
+			zswap_debugfs_root, &zswap_pool_limit_hit);
+	debugfs_create_u64("reject_reclaim_fail", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_reclaim_fail);
+	debugfs_create_u64("reject_alloc_fail", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_alloc_fail);
+	debugfs_create_u64("reject_compress_poor", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_compress_poor);
+	debugfs_create_u64("written_back_pages", S_IRUGO,
+			zswap_debugfs_root, &zswap_written_back_pages);
+	debugfs_create_u64("duplicate_entry", S_IRUGO,
+			zswap_debugfs_root, &zswap_duplicate_entry);
+	debugfs_create_file("pool_pages", S_IRUGO,
+			zswap_debugfs_root, NULL, &zswap_pool_pages_fops);
+	debugfs_create_file("stored_pages", S_IRUGO,
+			zswap_debugfs_root, NULL, &zswap_stored_pages_fops);
+
+	return 0;
+}
+#else
+static int __init zswap_debugfs_init(void)
+{
+	return 0;
+}
+#endif
+
+/*********************************
+* module init and exit
+**********************************/
+static int __init init_zswap(void)
+{
+	if (!zswap_enabled)
+		return 0;
+
+	pr_info("loading zswap\n");
+	zswap_entry_cache = KMEM_CACHE(zswap_entry, 0);
+	if (!zswap_entry_cache) {
+		pr_err("zswap: entry cache creation failed\n");
+		goto error;
+	}
+	if (zswap_cpu_init()) {
+		pr_err("zswap: per-cpu initialization failed\n");
+		goto pcpufail;
+	}
+	register_shrinker(&zswap_shrinker);
+	zswap_debugfs_init();
+	return 0;
+
+pcpufail:
+	kmem_cache_destroy(zswap_entry_cache);
+error:
+	zswap_enabled = false;
+	return -ENOMEM;
+}
+module_init(init_zswap);
@@ -0,0 +1,166 @@
+/*
+ * futex-hash.c
+ *
+ * hash: Stress the futex hash table with futexes nobody waits on
+ *
+ * Every thread owns an array of futexes and keeps calling FUTEX_WAIT on
+ * them with a value that does not match, so that the call returns right
+ * after looking up and locking the futex's hash bucket, or FUTEX_WAKE,
+ * which finds no waiters.  As the futexes are private to each thread,
+ * any contention measured comes from unrelated futexes sharing a hash
+ * bucket.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static int		nr_threads;
+static int		nr_futexes	= 1024;
+static int		runtime		= 10;
+static bool		use_wake;
+static bool		shared;
+
+static const struct option options[] = {
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Specify number of threads (default: online cpus)"),
+	OPT_INTEGER('f', "futexes", &nr_futexes,
+		    "Specify number of futexes per thread"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Specify runtime in seconds"),
+	OPT_BOOLEAN('w', "wake", &use_wake,
+		    "Call FUTEX_WAKE instead of FUTEX_WAIT"),
+	OPT_BOOLEAN('S', "shared", &shared,
+		    "Use shared futexes instead of private ones"),
+	OPT_END()
+};
+
+static const char * const bench_futex_hash_usage[] = {
+	"perf bench futex hash <options>",
+	NULL
+};
+
+struct worker {
+	pthread_t	thread;
+	unsigned int	*futexes;
+	unsigned long	ops;
+};
+
+static volatile int	done;
+static int		futex_flag;
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long ops = 0;
+	int i, ret;
+
+	while (!done) {
+		for (i = 0; i < nr_futexes; i++) {
+			if (use_wake)
+				ret = syscall(SYS_futex, &w->futexes[i],
+					      FUTEX_WAKE | futex_flag,
+					      1, NULL, NULL, 0);
+			else
+				ret = syscall(SYS_futex, &w->futexes[i],
+					      FUTEX_WAIT | futex_flag,
+					      1234, NULL, NULL, 0);
+			if (ret < 0 && errno != EWOULDBLOCK)
+				die("futex() failed: %s\n", strerror(errno));
+		}
+		ops += nr_futexes;
+	}
+
+	w->ops = ops;
+	return NULL;
+}
+
+int bench_futex_hash(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct worker *workers;
+	struct timeval start, stop, diff;
+	unsigned long long total = 0;
+	double secs;
+	int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_hash_usage, 0);
+
+	if (nr_threads <= 0)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_futexes <= 0 || runtime <= 0) {
+		fprintf(stderr, "Invalid number of futexes or runtime\n");
+		return 1;
+	}
+	if (!shared)
+		futex_flag = FUTEX_PRIVATE_FLAG;
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		die("calloc() failed\n");
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].futexes = calloc(nr_futexes, sizeof(unsigned int));
+		if (!workers[i].futexes)
+			die("calloc() failed\n");
+		if (pthread_create(&workers[i].thread, NULL,
+				   worker_thread, &workers[i]))
+			die("pthread_create() failed\n");
+	}
+
+	sleep(runtime);
+	done = 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].ops;
+		free(workers[i].futexes);
+	}
+	gettimeofday(&stop, NULL);
+
+	timersub(&stop, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d threads calling %s on %d %s futexes each "
+		       "for %d secs\n\n",
+		       nr_threads, use_wake ? "FUTEX_WAKE" : "FUTEX_WAIT",
+		       nr_futexes, shared ? "shared" : "private", runtime);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14.0lf ops/sec\n", total / secs);
+		printf(" %14.0lf ops/sec per thread\n",
+		       total / secs / nr_threads);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0lf\n", total / secs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	free(workers);
+	return 0;
+}
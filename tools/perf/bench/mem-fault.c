@@ -0,0 +1,168 @@
+/*
+ * mem-fault.c
+ *
+ * fault: Page faults on fresh anonymous memory, concurrent with munmap()
+ *
+ * Every fault thread repeatedly maps a private anonymous area, touches
+ * each page of it and unmaps it again, while the munmap threads map and
+ * unmap single pages elsewhere in the address space: the page faults of
+ * the former compete with the address space changes of the latter for
+ * mmap_sem.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+static const char	*length_str	= "4MB";
+static int		nr_fault_threads;
+static int		nr_munmap_threads = 1;
+static int		loops		= 100;
+
+static const struct option options[] = {
+	OPT_STRING('l', "length", &length_str, "4MB",
+		    "Specify length of memory each thread faults in per loop. "
+		    "available unit: B, MB, GB (upper and lower)"),
+	OPT_INTEGER('t', "threads", &nr_fault_threads,
+		    "Specify number of fault threads (default: online cpus)"),
+	OPT_INTEGER('m', "munmap-threads", &nr_munmap_threads,
+		    "Specify number of threads calling mmap()/munmap()"),
+	OPT_INTEGER('r', "loops", &loops,
+		    "Specify number of loops of each fault thread"),
+	OPT_END()
+};
+
+static const char * const bench_mem_fault_usage[] = {
+	"perf bench mem fault <options>",
+	NULL
+};
+
+static size_t		length;
+static long		page_size;
+static volatile int	done;
+
+static void *fault_thread(void *arg __used)
+{
+	int i;
+	size_t off;
+	char *p;
+
+	for (i = 0; i < loops; i++) {
+		p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			die("mmap() failed\n");
+		for (off = 0; off < length; off += page_size)
+			p[off] = 1;
+		munmap(p, length);
+	}
+	return NULL;
+}
+
+static void *munmap_thread(void *arg __used)
+{
+	char *p;
+
+	while (!done) {
+		p = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			die("mmap() failed\n");
+		munmap(p, page_size);
+	}
+	return NULL;
+}
+
+int bench_mem_fault(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	pthread_t *faulters, *unmappers;
+	struct timeval start, stop, diff;
+	unsigned long long result_usec;
+	double nr_faults;
+	int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_fault_usage, 0);
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (nr_fault_threads <= 0)
+		nr_fault_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_munmap_threads < 0)
+		nr_munmap_threads = 0;
+
+	length = (size_t)perf_atoll((char *)length_str);
+	if ((s64)length <= 0) {
+		fprintf(stderr, "Invalid length:%s\n", length_str);
+		return 1;
+	}
+	length = (length + page_size - 1) & ~(page_size - 1);
+
+	faulters = calloc(nr_fault_threads, sizeof(pthread_t));
+	unmappers = calloc(nr_munmap_threads + 1, sizeof(pthread_t));
+	if (!faulters || !unmappers)
+		die("calloc() failed\n");
+
+	for (i = 0; i < nr_munmap_threads; i++)
+		if (pthread_create(&unmappers[i], NULL, munmap_thread, NULL))
+			die("pthread_create() failed\n");
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr_fault_threads; i++)
+		if (pthread_create(&faulters[i], NULL, fault_thread, NULL))
+			die("pthread_create() failed\n");
+	for (i = 0; i < nr_fault_threads; i++)
+		pthread_join(faulters[i], NULL);
+	gettimeofday(&stop, NULL);
+
+	done = 1;
+	for (i = 0; i < nr_munmap_threads; i++)
+		pthread_join(unmappers[i], NULL);
+
+	timersub(&stop, &start, &diff);
+	result_usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	nr_faults = (double)nr_fault_threads * loops * (length / page_size);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d threads faulting in %s %d times, "
+		       "%d threads calling munmap()\n\n",
+		       nr_fault_threads, length_str, loops,
+		       nr_munmap_threads);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14lf usecs/fault\n",
+		       (double)result_usec / nr_faults);
+		printf(" %14.0lf faults/sec\n",
+		       nr_faults / ((double)result_usec / 1000000.0));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	free(faulters);
+	free(unmappers);
+	return 0;
+}
@@ -39,6 +39,10 @@ struct slabinfo {
 	unsigned long cpuslab_flush, deactivate_full, deactivate_empty;
 	unsigned long deactivate_to_head, deactivate_to_tail;
 	unsigned long deactivate_remote_frees, order_fallback;
+	unsigned long cmpxchg_double_cpu_fail;
+	unsigned long cpu_partial_alloc, cpu_partial_free;
+	unsigned long cpu_partial_node, cpu_partial_drain;
+	int cpu_partial;
 	int numa[MAX_NODES];
 	int numa_partial[MAX_NODES];
 } slabinfo[MAX_SLABS];
@@ -465,6 +469,16 @@ static void slab_stats(struct slabinfo *s)
 	if (s->alloc_refill)
 		printf("Refill %8lu\n", s->alloc_refill);
 
+	if (s->cmpxchg_double_cpu_fail)
+		printf("Cmpxchg_double cpu fail %8lu\n",
+			s->cmpxchg_double_cpu_fail);
+
+	if (s->cpu_partial_alloc || s->cpu_partial_free)
+		printf("Cpu partial: limit %d objects, alloc %lu, free %lu, "
+			"node refill %lu, drain %lu\n", s->cpu_partial,
+			s->cpu_partial_alloc, s->cpu_partial_free,
+			s->cpu_partial_node, s->cpu_partial_drain);
+
 	total = s->deactivate_full + s->deactivate_empty +
 			s->deactivate_to_head + s->deactivate_to_tail;
 
@@ -1150,6 +1164,7 @@ static void read_slab_dir(void)
 			slab->align = get_obj("align");
 			slab->cache_dma = get_obj("cache_dma");
 			slab->cpu_slabs = get_obj("cpu_slabs");
+			slab->cpu_partial = get_obj("cpu_partial");
 			slab->destroy_by_rcu = get_obj("destroy_by_rcu");
 			slab->hwcache_align = get_obj("hwcache_align");
 			slab->object_size = get_obj("object_size");
@@ -1190,6 +1205,11 @@ static void read_slab_dir(void)
 			slab->deactivate_to_tail = get_obj("deactivate_to_tail");
 			slab->deactivate_remote_frees = get_obj("deactivate_remote_frees");
 			slab->order_fallback = get_obj("order_fallback");
+			slab->cmpxchg_double_cpu_fail = get_obj("cmpxchg_double_cpu_fail");
+			slab->cpu_partial_alloc = get_obj("cpu_partial_alloc");
+			slab->cpu_partial_free = get_obj("cpu_partial_free");
+			slab->cpu_partial_node = get_obj("cpu_partial_node");
+			slab->cpu_partial_drain = get_obj("cpu_partial_drain");
 			chdir("..");
 			if (slab->name[0] == ':')
 				alias_targets++;
@@ -0,0 +1,160 @@
+/*
+ * jitter.c - measure the interruptions seen by a busy task
+ *
+ * Spins on one CPU reading the monotonic clock, and reports every gap
+ * between two consecutive reads that is longer than a threshold: that
+ * is time the task did not run, taken by interrupts (such as the
+ * scheduler tick), softirqs or other tasks.
+ *
+ * Run it on a CPU listed in nohz_full= to see what remains once the
+ * tick of a single busy task is stopped, and on a normal CPU for
+ * comparison.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+
+#define NSEC_PER_USEC	1000ULL
+#define NSEC_PER_SEC	1000000000ULL
+
+/* Histogram of the gaps, in power of two microseconds buckets */
+#define NR_BUCKETS	24
+
+static int cpu = -1;
+static unsigned int duration = 10;
+static unsigned long long threshold = 10 * NSEC_PER_USEC;
+static int verbose;
+
+static unsigned long long histogram[NR_BUCKETS];
+
+static void usage(void)
+{
+	fprintf(stderr, "jitter: [-c cpu] [-d seconds] [-t usecs] [-v]\n");
+	exit(1);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void cmdline(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:d:t:v")) != -1) {
+		switch (opt) {
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 't':
+			threshold = strtoull(optarg, NULL, 0) * NSEC_PER_USEC;
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!duration || !threshold)
+		usage();
+}
+
+static void bind_cpu(void)
+{
+	cpu_set_t set;
+
+	if (cpu < 0)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		perror("sched_setaffinity");
+		exit(1);
+	}
+}
+
+static void account_gap(unsigned long long gap)
+{
+	unsigned long long usecs = gap / NSEC_PER_USEC;
+	int bucket = 0;
+
+	while (usecs > 1 && bucket < NR_BUCKETS - 1) {
+		usecs >>= 1;
+		bucket++;
+	}
+	histogram[bucket]++;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long start, end, prev, now, gap;
+	unsigned long long nr_gaps = 0, lost = 0, max = 0;
+	int i;
+
+	cmdline(argc, argv);
+	bind_cpu();
+
+	start = prev = now_ns();
+	end = start + duration * NSEC_PER_SEC;
+
+	do {
+		now = now_ns();
+		gap = now - prev;
+		prev = now;
+
+		if (gap < threshold)
+			continue;
+
+		nr_gaps++;
+		lost += gap;
+		if (gap > max)
+			max = gap;
+		account_gap(gap);
+
+		if (verbose)
+			printf("%12.6f: %llu usecs\n",
+			       (double)(now - start) / NSEC_PER_SEC,
+			       gap / NSEC_PER_USEC);
+	} while (now < end);
+
+	printf("cpu %d, %u secs, threshold %llu usecs\n",
+	       cpu < 0 ? sched_getcpu() : cpu, duration,
+	       threshold / NSEC_PER_USEC);
+	printf("interruptions: %llu (%.1f/sec)\n",
+	       nr_gaps, (double)nr_gaps / duration);
+	printf("time lost:     %llu usecs (%.4f%%)\n", lost / NSEC_PER_USEC,
+	       100.0 * lost / (now - start));
+	printf("longest:       %llu usecs\n", max / NSEC_PER_USEC);
+
+	if (!nr_gaps)
+		return 0;
+
+	printf("\n%12s %12s\n", "usecs", "count");
+	for (i = 0; i < NR_BUCKETS; i++) {
+		if (!histogram[i])
+			continue;
+		printf("%5llu - %-5llu %12llu\n",
+		       i ? 1ULL << i : 0ULL, (1ULL << (i + 1)) - 1,
+		       histogram[i]);
+	}
+
+	return 0;
+}